@@ -36,6 +36,25 @@ static void PerfomanceInsertPrimitive(benchmark::State& state) {
     }
 }
 
+static void PerfomanceInsertExtents(benchmark::State& state) {
+    for (auto _ : state) {
+        state.PauseTiming();
+
+        auto file = util::MakePtr<mem::File>("perf.ddb");
+        auto database = db::Database(file, db::OpenMode::kWrite);
+        database.SetExtentPages(static_cast<size_t>(state.range(1)));
+
+        auto age = ts::NewClass<ts::PrimitiveClass<int>>("age");
+        database.AddClass(age);
+
+        state.ResumeTiming();
+
+        for (int64_t i = 0; i < state.range(0); ++i) {
+            database.AddNode(ts::New<ts::Primitive<int>>(age, 100));
+        }
+    }
+}
+
 static void PerfomanceRemoveByValue(benchmark::State& state) {
     for (auto _ : state) {
         state.PauseTiming();
@@ -57,7 +76,7 @@ static void PerfomanceRemoveByValue(benchmark::State& state) {
         state.ResumeTiming();
 
         for (int64_t i = 0; i < size; ++i) {
-            database.RemoveNodesIf(age, [i](auto it) { return it->Id() == ID(i); });
+            database.RemoveNode(age, ID(i));
         }
     }
 }
@@ -83,7 +102,7 @@ static void PerfomanceRemoveByVariable(benchmark::State& state) {
         state.ResumeTiming();
 
         for (int64_t i = 0; i < size; ++i) {
-            database.RemoveNodesIf(name, [i](auto it) { return it->Id() == ID(i); });
+            database.RemoveNode(name, ID(i));
         }
     }
 }
@@ -129,10 +148,37 @@ static void PerfomanceMatch(benchmark::State& state) {
     }
 }
 
+// Scans are compared between builds with different DDB_PAGE_SIZE by the counters
+static void PerfomanceScan(benchmark::State& state) {
+    auto file = util::MakePtr<mem::File>("perf.ddb");
+    auto database = db::Database(file, db::OpenMode::kWrite);
+
+    auto name = ts::NewClass<ts::StringClass>("name");
+    auto age = ts::NewClass<ts::PrimitiveClass<int>>("age");
+    database.AddClass(name);
+    database.AddClass(age);
+
+    for (int64_t i = 0; i < state.range(0); ++i) {
+        database.AddNode(ts::New<ts::Primitive<int>>(age, static_cast<int>(i)));
+        database.AddNode(ts::New<ts::String>(name, "test name"));
+    }
+
+    for (auto _ : state) {
+        size_t count = 0;
+        database.VisitNodes(age, db::kAll, [&count](auto) { ++count; });
+        database.VisitNodes(name, db::kAll, [&count](auto) { ++count; });
+        benchmark::DoNotOptimize(count);
+    }
+    state.counters["page_size"] = static_cast<double>(mem::kPageSize);
+    state.counters["file_size"] = static_cast<double>(file->GetSize());
+}
+
 BENCHMARK(PerfomanceInsertString)->Arg(10'000);
 BENCHMARK(PerfomanceInsertPrimitive)->Arg(10'000);
+BENCHMARK(PerfomanceInsertExtents)->Args({100'000, 1})->Args({100'000, 64})->Args({100'000, 1024});
 BENCHMARK(PerfomanceRemoveByValue)->Arg(10'000);
 BENCHMARK(PerfomanceRemoveByVariable)->Arg(10'000);
 BENCHMARK(PerfomanceMatch)->Arg(100);
+BENCHMARK(PerfomanceScan)->Arg(100'000);
 
 BENCHMARK_MAIN();
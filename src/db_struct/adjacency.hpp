@@ -0,0 +1,81 @@
+#pragma once
+
+#include <string>
+
+#include "id_directory.hpp"
+
+namespace db {
+
+// Relations of a class grouped by one of their ends, the key. Relations with the same key form a
+// doubly linked list threaded through the records of the relations, the head of the list is kept
+// by the key. Both directories are dense, ids are stored incremented so that zero means no one
+class Adjacency {
+    struct Edge {
+        ts::ObjectId neighbour;
+        ts::ObjectId next;
+        ts::ObjectId previous;
+    };
+
+    DenseDirectory<ts::ObjectId> heads_;
+    DenseDirectory<Edge> edges_;
+
+public:
+    Adjacency() {
+    }
+
+    Adjacency(const std::string& name, mem::PageAllocator::Ptr& alloc, mem::Offset heads_sentinel,
+              mem::Offset edges_sentinel, DEFAULT_LOGGER(logger))
+        : heads_(name + "_Heads", alloc, heads_sentinel, logger),
+          edges_(name + "_Edges", alloc, edges_sentinel, logger) {
+    }
+
+    void Insert(ts::ObjectId key, ts::ObjectId neighbour, ts::ObjectId relation) {
+        auto head = heads_.Get(key);
+        if (head != 0) {
+            auto edge = edges_.Get(head - 1);
+            edge.previous = relation + 1;
+            edges_.Set(head - 1, edge);
+        }
+        edges_.Set(relation, Edge{neighbour + 1, head, 0});
+        heads_.Set(key, relation + 1);
+    }
+
+    void Erase(ts::ObjectId key, ts::ObjectId relation) {
+        auto edge = edges_.Get(relation);
+        if (edge.neighbour == 0) {
+            return;
+        }
+        if (edge.previous != 0) {
+            auto previous = edges_.Get(edge.previous - 1);
+            previous.next = edge.next;
+            edges_.Set(edge.previous - 1, previous);
+        } else {
+            heads_.Set(key, edge.next);
+        }
+        if (edge.next != 0) {
+            auto next = edges_.Get(edge.next - 1);
+            next.previous = edge.previous;
+            edges_.Set(edge.next - 1, next);
+        }
+        edges_.Erase(relation);
+    }
+
+    // Functor is called with the other end and the id of every relation of the key, the latest
+    // added first
+    template <typename Functor>
+    requires std::is_invocable_v<Functor, ts::ObjectId, ts::ObjectId>
+    void Visit(ts::ObjectId key, Functor functor) {
+        for (auto relation = heads_.Get(key); relation != 0;) {
+            auto edge = edges_.Get(relation - 1);
+            functor(edge.neighbour - 1, relation - 1);
+            relation = edge.next;
+        }
+    }
+
+    void Drop() {
+        heads_.Drop();
+        edges_.Drop();
+    }
+};
+
+}  // namespace db
@@ -0,0 +1,143 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "hash_index.hpp"
+#include "page_records.hpp"
+
+namespace db {
+
+constexpr inline size_t kBloomWords = 16;
+constexpr inline size_t kBloomBits = kBloomWords * 64;
+constexpr inline size_t kBloomProbes = 4;
+
+// Key of the value of the field with the given number
+[[nodiscard]] inline uint64_t BloomKey(size_t field, std::string_view value) {
+    auto key = HashBytes(value) + field * 0x9e3779b97f4a7c15ull;
+    key = (key ^ (key >> 30)) * 0xbf58476d1ce4e5b9ull;
+    key = (key ^ (key >> 27)) * 0x94d049bb133111ebull;
+    return key ^ (key >> 31);
+}
+
+// Bloom filters of the string fields of the nodes of every data page of a variable size class,
+// all fields of a page share one filter. Bits can't be taken away, so the filter of a page is
+// built again from the nodes left in it when the page is compacted by a removal
+class BloomFilters {
+    std::vector<std::string> paths_;
+    std::vector<FieldPath> fields_;
+    PageRecords records_;
+
+    void CollectFields(const ts::Class::Ptr& field_class, const std::string& path) {
+        if (util::Is<ts::StringClass>(field_class)) {
+            paths_.push_back(path);
+        } else if (util::Is<ts::StructClass>(field_class)) {
+            for (auto& field : util::As<ts::StructClass>(field_class)->GetFields()) {
+                CollectFields(field, path.empty() ? field->Name() : path + "." + field->Name());
+            }
+        }
+    }
+
+    // Bits of the key are given by double hashing of its halves
+    template <typename Functor>
+    static void VisitBits(uint64_t key, Functor functor) {
+        auto first = key & 0xffffffffull;
+        auto step = (key >> 32) | 1;
+        for (size_t i = 0; i < kBloomProbes; ++i) {
+            auto bit = (first + i * step) % kBloomBits;
+            functor(bit / 64, uint64_t{1} << (bit % 64));
+        }
+    }
+
+    // Returns whether some bit was not set
+    bool AddBits(std::vector<uint64_t>::iterator words, const Node& node) {
+        auto data = node.Data<ts::Object>();
+        auto changed = false;
+        for (size_t i = 0; i < fields_.size(); ++i) {
+            std::string_view value = util::As<ts::String>(fields_[i].Extract(data))->Value();
+            VisitBits(BloomKey(i, value), [&words, &changed](size_t word, uint64_t mask) {
+                changed |= (words[word] & mask) == 0;
+                words[word] |= mask;
+            });
+        }
+        return changed;
+    }
+
+public:
+    BloomFilters() {
+    }
+
+    BloomFilters(const ts::Class::Ptr& node_class, mem::PageAllocator::Ptr& alloc,
+                 mem::Offset sentinel_offset, DEFAULT_LOGGER(logger)) {
+        CollectFields(node_class, util::Is<ts::StructClass>(node_class) ? "" : node_class->Name());
+        for (auto& path : paths_) {
+            fields_.emplace_back(path);
+        }
+        records_ = PageRecords(node_class->Name() + "_Filters", alloc, sentinel_offset,
+                               kBloomWords, logger);
+    }
+
+    [[nodiscard]] bool IsEmpty() const {
+        return fields_.empty();
+    }
+
+    [[nodiscard]] std::optional<size_t> FindField(const std::string& path) const {
+        auto it = std::find(paths_.begin(), paths_.end(), path);
+        if (it == paths_.end()) {
+            return std::nullopt;
+        }
+        return it - paths_.begin();
+    }
+
+    // Values of the node written into the page are added to its filter
+    void Add(mem::PageIndex page, const Node& node) {
+        auto record = records_.Find(page);
+        if (!record.has_value()) {
+            record = records_.Insert(page);
+        }
+        if (AddBits(records_.Words(record.value()), node)) {
+            records_.Write(record.value());
+        }
+    }
+
+    // Filter is built again from all the nodes of the page
+    void Rebuild(mem::PageIndex page, const std::vector<Node>& nodes) {
+        if (auto record = records_.Find(page); record.has_value()) {
+            auto words = records_.Words(record.value());
+            std::fill(words, words + kBloomWords, 0);
+            for (auto& node : nodes) {
+                AddBits(words, node);
+            }
+            records_.Write(record.value());
+        }
+    }
+
+    void Erase(mem::PageIndex page) {
+        records_.Erase(page);
+    }
+
+    // Whether a node of the page may have the value of the field, the page without the filter
+    // may have any
+    [[nodiscard]] bool MayContain(mem::PageIndex page, size_t field, std::string_view value) const {
+        auto record = records_.Find(page);
+        if (!record.has_value()) {
+            return true;
+        }
+        auto words = records_.Words(record.value());
+        auto found = true;
+        VisitBits(BloomKey(field, value), [&words, &found](size_t word, uint64_t mask) {
+            found &= (words[word] & mask) != 0;
+        });
+        return found;
+    }
+
+    void Drop() {
+        records_.Drop();
+    }
+};
+
+}  // namespace db
@@ -20,7 +20,7 @@ private:
     ClassCache class_cache_;
 
     std::string GetSerializedClass(mem::PageIndex index) const {
-        auto header = mem::ClassHeader(index).ReadClassHeader(alloc_->GetFile());
+        auto header = mem::ClassHeader(index).ReadClassHeader(alloc_->GetHeaders());
         ts::ClassObject class_object;
         class_object.Read(alloc_->GetFile(), mem::GetOffset(header.index_, header.free_offset_));
         return class_object.ToString();
@@ -53,12 +53,13 @@ private:
         return util::MakePtr<ts::ClassObject>(new_class);
     }
 
-    mem::ClassHeader InitializeClassHeader(mem::PageIndex index,
-                                           ts::ClassObject::Ptr& class_object) {
+    mem::ClassHeader InitializeClassHeader(mem::PageIndex index, ts::ClassObject::Ptr& class_object,
+                                           mem::PageLayout layout) {
         return mem::ClassHeader(index)
-            .ReadClassHeader(alloc_->GetFile())
-            .InitClassHeader(alloc_->GetFile(), class_object->Size())
-            .WriteMagic(alloc_->GetFile(), rand());
+            .ReadClassHeader(alloc_->GetHeaders())
+            .InitClassHeader(alloc_->GetHeaders(), class_object->Size())
+            .WriteMagic(alloc_->GetHeaders(), rand())
+            .WriteLayout(alloc_->GetHeaders(), layout);
     }
 
 public:
@@ -68,11 +69,9 @@ public:
         : LOGGER(logger), alloc_(alloc) {
 
         DEBUG("Class list sentinel offset:", mem::kClassListSentinelOffset);
-        DEBUG("Class list count:", alloc_->GetFile()->Read<size_t>(
-                                       mem::GetCountFromSentinel(mem::kClassListSentinelOffset)));
-
-        class_list_ =
-            mem::PageList("Class_List", alloc_->GetFile(), mem::kClassListSentinelOffset, LOGGER);
+        class_list_ = mem::PageList("Class_List", alloc_->GetHeaders(),
+                                    mem::kClassListSentinelOffset, LOGGER);
+        DEBUG("Class list count:", class_list_.GetPagesCount());
 
         INFO("ClassList initialized");
 
@@ -107,8 +106,9 @@ public:
         return std::nullopt;
     }
 
+    // Layout is kept only by a new class, existing one keeps its own
     template <ts::ClassLike C>
-    void AddClass(const util::Ptr<C>& new_class) {
+    void AddClass(const util::Ptr<C>& new_class, mem::PageLayout layout = mem::PageLayout::kRows) {
         INFO("Adding new class..");
 
         auto class_object = MakeClassHolder(new_class);
@@ -123,7 +123,7 @@ public:
         if (!cache_index.has_value()) {
             DEBUG(class_object->ToString());
             if (!index.has_value()) {
-                auto header = InitializeClassHeader(alloc_->AllocatePage(), class_object);
+                auto header = InitializeClassHeader(alloc_->AllocatePage(), class_object, layout);
                 DEBUG("Index: ", header.index_);
 
                 class_list_.PushBack(header.index_);
@@ -175,7 +175,7 @@ public:
     requires std::invocable<F, mem::ClassHeader>
     void VisitClasses(F functor) {
         for (auto& class_header : class_list_) {
-            functor(mem::ClassHeader(class_header.index_).ReadClassHeader(alloc_->GetFile()));
+            functor(mem::ClassHeader(class_header.index_).ReadClassHeader(alloc_->GetHeaders()));
         }
     }
 
@@ -2,14 +2,17 @@
 
 #include <iterator>
 #include <optional>
+#include <ranges>
 #include <set>
 #include <type_traits>
 #include <unordered_map>
 #include <unordered_set>
 #include <vector>
 
+#include "mappedfile.hpp"
 #include "pattern.hpp"
 #include "struct.hpp"
+#include "wal.hpp"
 #include "val_node_storage.hpp"
 #include "var_node_storage.hpp"
 
@@ -17,6 +20,9 @@ namespace db {
 
 enum class OpenMode { kDefault, kRead, kWrite };
 
+// Objects of BulkLoader are added by batches of about this number of pages
+constexpr inline size_t kBulkBatchPages = 16;
+
 using ValNodeIterator = db::ValNodeStorage::NodeIterator;
 using VarNodeIterator = db::VarNodeStorage::NodeIterator;
 
@@ -25,9 +31,106 @@ class Database {
     DECLARE_LOGGER;
     mem::Superblock superblock_;
     mem::File::Ptr file_;
+    mem::Wal::Ptr wal_;
+    mem::HeaderCache::Ptr headers_;
     mem::PageAllocator::Ptr alloc_;
+    size_t extent_pages_ = mem::kDefaultExtentPages;
     ClassStorage::Ptr class_storage_;
 
+    // Node storages of the classes used so far keyed by the page of the class header. Class
+    // objects are mapped to it by address, so the class is serialized and found only once
+    std::unordered_map<mem::PageIndex, NodeStorage::Ptr> storages_;
+    std::unordered_map<const ts::Class*, std::pair<ts::Class::Ptr, mem::PageIndex>> class_indices_;
+
+    void Load() {
+        storages_.clear();
+        class_indices_.clear();
+        headers_ = util::MakePtr<mem::HeaderCache>(file_);
+        alloc_ = util::MakePtr<mem::PageAllocator>(headers_, LOGGER);
+        alloc_->SetExtentPages(extent_pages_);
+        INFO("Allocator initialized");
+        class_storage_ = util::MakePtr<ClassStorage>(alloc_, LOGGER);
+    }
+
+    template <typename Storage, ts::ClassLike C>
+    Storage& GetStorage(const util::Ptr<C>& node_class) {
+        auto known = class_indices_.find(node_class.get());
+        if (known != class_indices_.end()) {
+            return static_cast<Storage&>(*storages_.at(known->second.second));
+        }
+        auto index = class_storage_->FindClass(node_class);
+        if (!index.has_value()) {
+            throw error::RuntimeError("No such class in class storage");
+        }
+        auto& storage = storages_[index.value()];
+        if (storage == nullptr) {
+            storage = util::MakePtr<Storage>(node_class, class_storage_, alloc_, LOGGER);
+        }
+        class_indices_.emplace(node_class.get(), std::pair{node_class, index.value()});
+        return static_cast<Storage&>(*storage);
+    }
+
+    template <ts::ClassLike C>
+    NodeStorage& GetNodeStorage(const util::Ptr<C>& node_class) {
+        if (node_class->Size().has_value()) {
+            return GetStorage<ValNodeStorage>(node_class);
+        }
+        return GetStorage<VarNodeStorage>(node_class);
+    }
+
+    void EraseStorage(mem::PageIndex index) {
+        storages_.erase(index);
+        std::erase_if(class_indices_,
+                      [index](const auto& entry) { return entry.second.second == index; });
+    }
+
+    // Bounds of the filter are converted to the type of the field, the pages are compared as
+    // arrays of it
+    template <typename T, typename Functor>
+    void VisitSelections(ValNodeStorage& storage, const ts::Class::Ptr& node_class,
+                         const Filter<T>& filter, Functor functor, size_t threads = 1) {
+        auto field_class = FieldPath(filter.GetField()).Resolve(node_class);
+        auto access = mem::ScopedAccess(file_, mem::Access::kSequential);
+#define DDB_SELECT_PRIMITIVE(P)                                             \
+    if (util::Is<ts::PrimitiveClass<P>>(field_class)) {                     \
+        storage.VisitSelections<P>(                                         \
+            filter.GetField(), ClampBound<P>(filter.From(), Bound::kLower), \
+            ClampBound<P>(filter.To(), Bound::kUpper), functor, threads);   \
+        return;                                                             \
+    }
+        DDB_PRIMITIVE_GENERATOR(DDB_SELECT_PRIMITIVE)
+#undef DDB_SELECT_PRIMITIVE
+        throw error::TypeError("Field is not primitive: " + filter.GetField());
+    }
+
+    // Changed metadata is written back at commit, or on checkpoint if the database is not logged
+    void FlushHeaders() {
+        if (headers_ != nullptr) {
+            headers_->Flush();
+        }
+    }
+
+    // Changes of the functor are committed as a single transaction if the database is logged
+    template <typename Functor>
+    void Atomically(Functor functor) {
+        if (wal_ == nullptr) {
+            functor();
+            return;
+        }
+        wal_->Begin();
+        try {
+            functor();
+        } catch (...) {
+            ERROR("Rolling back transaction");
+            wal_->Rollback(file_);
+            // In-memory state of allocator and class storage may be ahead of the file
+            Load();
+            throw;
+        }
+        FlushHeaders();
+        wal_->Commit(file_);
+    }
+
     void InitializeSuperblock(OpenMode mode) {
         switch (mode) {
             case OpenMode::kRead: {
@@ -128,35 +231,22 @@ class Database {
     // Definitly needed review and rethinking
     std::optional<PatterMatchResultImpl> PatternMatchImpl(Pattern::Ptr pattern) {
         std::optional<PatterMatchResultImpl> result = std::nullopt;
-        auto& file = alloc_->GetFile();
 
         auto structure_class =
             ts::NewClass<ts::StructClass>(GenerateName(pattern), pattern->GetRootClass());
 
         for (auto& end : pattern->GetRelations()) {
             auto pattern_result = PatternMatchImpl(end.pattern);
-            std::unordered_map<ts::ObjectId, mem::Offset> from_index;
-            std::unordered_map<ts::ObjectId, mem::Offset> to_index;
-
-            auto fill_from = [&from_index](auto node) {
-                from_index.insert({node.Id(), node.GetRealOffset()});
-            };
-            auto fill_to = [&to_index](auto node) {
-                to_index.insert({node.Id(), node.GetRealOffset()});
-            };
-
-            VisitNodes(end.relation->FromClass(), kAll, fill_from);
-            VisitNodes(end.relation->ToClass(), kAll, fill_to);
-
-            auto from_magic =
-                mem::ClassHeader(class_storage_->FindClass(end.relation->FromClass()).value())
-                    .ReadMagic(alloc_->GetFile())
-                    .magic_;
+            std::unordered_map<ts::ObjectId, std::vector<SubPatternResult*>> subpatterns;
+            if (pattern_result.has_value()) {
+                for (auto& subpattern : pattern_result.value()) {
+                    subpatterns[subpattern.from].push_back(&subpattern);
+                }
+            }
 
-            auto to_magic =
-                mem::ClassHeader(class_storage_->FindClass(end.relation->ToClass()).value())
-                    .ReadMagic(alloc_->GetFile())
-                    .magic_;
+            auto& relation_storage = GetNodeStorage(end.relation);
+            auto& from_storage = GetNodeStorage(end.relation->FromClass());
+            auto& to_storage = GetNodeStorage(end.relation->ToClass());
 
             //  TODO: Manage lazy deletion
             structure_class->AddField(pattern_result.has_value()
@@ -165,36 +255,56 @@ class Database {
 
             PatterMatchResultImpl inner_map;
 
-            auto merge = [&from_index, &to_index, &pattern_result, &inner_map, &end, &file,
-                          from_magic, to_magic, &structure_class](auto relation_node) {
-                auto from = relation_node->template Data<ts::Relation>()->FromId();
-                auto to = relation_node->template Data<ts::Relation>()->ToId();
-
-                auto from_node =
-                    Node(from_magic, end.relation->FromClass(), file, from_index[from]);
-                auto to_node = Node(to_magic, end.relation->ToClass(), file, to_index[to]);
-
-                if (end.predicate_(from_node, to_node)) {
-                    if (pattern_result.has_value()) {
-                        for (auto& subpattern : pattern_result.value()) {
-                            if (subpattern.from == to) {
-                                // would match cycles
-                                auto new_struct = util::MakePtr<ts::Struct>(structure_class);
-                                new_struct->AddFieldValue(from_node.Data<ts::Object>());
-                                new_struct->AddFieldValue(subpattern.value);
-                                inner_map.push_back({from, {to}, new_struct});
-                            }
-                        }
-                    } else {
+            auto merge = [&subpatterns, &pattern_result, &inner_map, &end, &structure_class](
+                             ts::ObjectId from, Node& from_node, ts::ObjectId to, Node& to_node) {
+                if (!end.predicate_(from_node, to_node)) {
+                    return;
+                }
+                if (pattern_result.has_value()) {
+                    for (auto subpattern : subpatterns[to]) {
+                        // would match cycles
                         auto new_struct = util::MakePtr<ts::Struct>(structure_class);
                         new_struct->AddFieldValue(from_node.Data<ts::Object>());
-                        new_struct->AddFieldValue(to_node.Data<ts::Object>());
+                        new_struct->AddFieldValue(subpattern->value);
                         inner_map.push_back({from, {to}, new_struct});
                     }
+                } else {
+                    auto new_struct = util::MakePtr<ts::Struct>(structure_class);
+                    new_struct->AddFieldValue(from_node.Data<ts::Object>());
+                    new_struct->AddFieldValue(to_node.Data<ts::Object>());
+                    inner_map.push_back({from, {to}, new_struct});
                 }
             };
 
-            VisitNodes(end.relation, kAll, merge);
+            // Ends of relations are found by the directory, relation to a removed node is left by
+            // lazy removal and skipped
+            if (pattern_result.has_value()) {
+                // Only roots of the matched subpatterns can be the to ends, their relations are
+                // expanded backwards
+                for (auto& root : subpatterns) {
+                    auto to = root.first;
+                    auto to_node = to_storage.GetNode(to);
+                    if (to_node == nullptr) {
+                        continue;
+                    }
+                    relation_storage.VisitIncoming(to, [&](ts::ObjectId from, ts::ObjectId) {
+                        if (auto from_node = from_storage.GetNode(from); from_node != nullptr) {
+                            merge(from, *from_node, to, *to_node);
+                        }
+                    });
+                }
+            } else {
+                auto expand = [&merge, &relation_storage, &to_storage](auto from_it) {
+                    auto from = from_it.Id();
+                    Node from_node = *from_it;
+                    relation_storage.VisitOutgoing(from, [&](ts::ObjectId to, ts::ObjectId) {
+                        if (auto to_node = to_storage.GetNode(to); to_node != nullptr) {
+                            merge(from, from_node, to, *to_node);
+                        }
+                    });
+                };
+                VisitNodes(end.relation->FromClass(), kAll, expand);
+            }
             if (result.has_value()) {
                 result = IntersectPatterMatchResults(result.value(), inner_map);
             } else {
@@ -209,28 +319,80 @@ public:
     using Ptr = util::Ptr<Database>;
 
     Database(const mem::File::Ptr& file, OpenMode mode = OpenMode::kDefault, DEFAULT_LOGGER(logger))
-        : LOGGER(logger), file_(file) {
+        : Database(file, nullptr, mode, logger) {
+    }
 
-        InitializeSuperblock(mode);
+    // Every change of the database is a transaction of the log. Transactions left in the log by
+    // a crash are recovered on open, the log is checkpointed in background and on close
+    Database(const mem::File::Ptr& file, const mem::Wal::Ptr& wal,
+             OpenMode mode = OpenMode::kDefault, DEFAULT_LOGGER(logger))
+        : LOGGER(logger), file_(file), wal_(wal) {
 
-        alloc_ = util::MakePtr<mem::PageAllocator>(file_, LOGGER);
-        INFO("Allocator initialized");
-        class_storage_ = util::MakePtr<ClassStorage>(alloc_, LOGGER);
+        if (wal_ != nullptr) {
+            wal_->Recover(file_);
+            file_->SetJournal(wal_);
+        }
+        Atomically([this, mode] { InitializeSuperblock(mode); });
+        Load();
+        if (wal_ != nullptr) {
+            wal_->StartCheckpointer(file_);
+        }
     }
 
     ~Database() {
         INFO("Closing database");
+        if (wal_ != nullptr) {
+            wal_->StopCheckpointer();
+            try {
+                Checkpoint();
+            } catch (const error::Error& e) {
+                ERROR("Can't checkpoint on close: ", e.what());
+            }
+            file_->SetJournal(nullptr);
+        } else {
+            try {
+                FlushHeaders();
+            } catch (const error::Error& e) {
+                ERROR("Can't flush headers on close: ", e.what());
+            }
+        }
     };
 
+    // Count of pages the file grows by at most when it runs out of reserved ones, bulk ingest
+    // goes faster with larger extents
+    void SetExtentPages(size_t pages) {
+        alloc_->SetExtentPages(pages);
+        extent_pages_ = pages;
+    }
+
+    // Syncs the file and deletes the log segments that are not needed by recovery anymore
+    void Checkpoint() {
+        if (wal_ != nullptr) {
+            wal_->Checkpoint(file_);
+        } else {
+            FlushHeaders();
+            file_->Sync();
+        }
+    }
+
+    // Nodes of a fixed size class of primitives may be kept in columns, see NodeLayout. Layout is
+    // chosen once, when the class is added for the first time
     template <ts::ClassLike C>
-    void AddClass(const util::Ptr<C>& new_class) {
-        class_storage_->AddClass(new_class);
+    void AddClass(const util::Ptr<C>& new_class, mem::PageLayout layout = mem::PageLayout::kRows) {
+        if (layout == mem::PageLayout::kColumns && !NodeLayout::SupportsColumns(new_class)) {
+            throw error::TypeError("Class can't be placed in columns: " + new_class->Name());
+        }
+        Atomically([&] { class_storage_->AddClass(new_class, layout); });
     }
 
     template <ts::ClassLike C>
     void RemoveClass(const util::Ptr<C>& node_class) {
-        NodeStorage(node_class, class_storage_, alloc_, LOGGER).Drop();
-        class_storage_->RemoveClass(node_class);
+        Atomically([&] {
+            auto& storage = GetNodeStorage(node_class);
+            storage.Drop();
+            EraseStorage(storage.GetIndex());
+            class_storage_->RemoveClass(node_class);
+        });
     }
 
     template <ts::ClassLike C>
@@ -260,29 +422,169 @@ public:
 
     template <ts::ObjectLike O>
     requires(!std::is_same_v<O, ts::ClassObject>) void AddNode(util::Ptr<O> node) {
-        if (node->GetClass()->Size().has_value()) {
-            ValNodeStorage(node->GetClass(), class_storage_, alloc_, LOGGER).AddNode(node);
-        } else {
-            VarNodeStorage(node->GetClass(), class_storage_, alloc_, LOGGER).AddNode(node);
+        Atomically([&] {
+            if (node->GetClass()->Size().has_value()) {
+                GetStorage<ValNodeStorage>(node->GetClass()).AddNode(node);
+            } else {
+                GetStorage<VarNodeStorage>(node->GetClass()).AddNode(node);
+            }
+        });
+    }
+
+    // Adds the objects of one class by a single transaction. Ids are given one after another and
+    // every page is written at once, see ValNodeStorage::AddNodes
+    template <std::ranges::forward_range R>
+    void AddNodes(R&& nodes) {
+        if (std::ranges::empty(nodes)) {
+            return;
+        }
+        auto node_class = (*std::ranges::begin(nodes))->GetClass();
+        for (auto& node : nodes) {
+            if (node->GetClass() != node_class &&
+                node->GetClass()->Serialize() != node_class->Serialize()) {
+                throw error::BadArgument("Objects of different classes");
+            }
         }
+        Atomically([&] {
+            if (node_class->Size().has_value()) {
+                GetStorage<ValNodeStorage>(node_class).AddNodes(nodes);
+            } else {
+                GetStorage<VarNodeStorage>(node_class).AddNodes(nodes);
+            }
+        });
     }
 
+    // Streams objects of one class into the database. They are collected into batches of
+    // kBulkBatchPages pages, every batch is added by AddNodes as a transaction of its own
+    template <ts::ObjectLike O>
+    class BulkLoader {
+        DECLARE_LOGGER;
+        Database& database_;
+        std::vector<util::Ptr<O>> batch_;
+        size_t batch_bytes_ = 0;
+        size_t limit_;
+
+    public:
+        explicit BulkLoader(Database& database, size_t batch_pages = kBulkBatchPages)
+            : LOGGER(database.LOGGER), database_(database), limit_(batch_pages * mem::kPageSize) {
+        }
+        BulkLoader(const BulkLoader&) = delete;
+        BulkLoader& operator=(const BulkLoader&) = delete;
+
+        // Objects left in the batch are added, errors are only logged
+        ~BulkLoader() {
+            try {
+                Flush();
+            } catch (const error::Error& e) {
+                ERROR("Bulk load failed: ", e.what());
+            }
+        }
+
+        void Add(util::Ptr<O> node) {
+            batch_bytes_ += node->Size() + sizeof(mem::Magic) + sizeof(ts::ObjectId);
+            batch_.push_back(std::move(node));
+            if (batch_bytes_ >= limit_) {
+                Flush();
+            }
+        }
+
+        void Flush() {
+            auto batch = std::move(batch_);
+            batch_.clear();
+            batch_bytes_ = 0;
+            database_.AddNodes(batch);
+        }
+    };
+
     template <ts::ClassLike C, typename Predicate>
     void RemoveNodesIf(const util::Ptr<C>& node_class, Predicate predicate) {
-        if (node_class->Size().has_value()) {
-            if constexpr (std::is_invocable_r_v<bool, Predicate, ValNodeIterator>) {
-                ValNodeStorage(node_class, class_storage_, alloc_, LOGGER).RemoveNodesIf(predicate);
+        Atomically([&] {
+            if (node_class->Size().has_value()) {
+                if constexpr (std::is_invocable_r_v<bool, Predicate, ValNodeIterator>) {
+                    GetStorage<ValNodeStorage>(node_class).RemoveNodesIf(predicate);
+                } else {
+                    ERROR("Bad predicate");
+                }
+
             } else {
-                ERROR("Bad predicate");
+                if constexpr (std::is_invocable_r_v<bool, Predicate, VarNodeIterator>) {
+                    GetStorage<VarNodeStorage>(node_class).RemoveNodesIf(predicate);
+                } else {
+                    ERROR("Bad predicate");
+                }
             }
+        });
+    }
 
-        } else {
-            if constexpr (std::is_invocable_r_v<bool, Predicate, VarNodeIterator>) {
-                VarNodeStorage(node_class, class_storage_, alloc_, LOGGER).RemoveNodesIf(predicate);
+    // Nodes are found by the id directory of the class without a scan
+    template <ts::ClassLike C>
+    [[nodiscard]] Node::Ptr GetNode(const util::Ptr<C>& node_class, ts::ObjectId id) {
+        return GetNodeStorage(node_class).GetNode(id);
+    }
+
+    template <ts::ClassLike C>
+    [[nodiscard]] bool ContainsNode(const util::Ptr<C>& node_class, ts::ObjectId id) {
+        return GetNodeStorage(node_class).ContainsNode(id);
+    }
+
+    // Returns false if there is no node with the id
+    template <ts::ClassLike C>
+    bool RemoveNode(const util::Ptr<C>& node_class, ts::ObjectId id) {
+        bool removed = false;
+        Atomically([&] {
+            if (node_class->Size().has_value()) {
+                removed = GetStorage<ValNodeStorage>(node_class).RemoveNode(id);
             } else {
-                ERROR("Bad predicate");
+                removed = GetStorage<VarNodeStorage>(node_class).RemoveNode(id);
             }
-        }
+        });
+        return removed;
+    }
+
+    // Functor is called with the id of the to end and the id of every relation of the class from
+    // the node, the cost is the number of those relations
+    template <typename Functor>
+    requires std::is_invocable_v<Functor, ts::ObjectId, ts::ObjectId>
+    void VisitOutgoing(const ts::RelationClass::Ptr& relation_class, ts::ObjectId from,
+                       Functor functor) {
+        GetNodeStorage(relation_class).VisitOutgoing(from, functor);
+    }
+
+    // Functor is called with the id of the from end and the id of every relation of the class to
+    // the node, the cost is the number of those relations
+    template <typename Functor>
+    requires std::is_invocable_v<Functor, ts::ObjectId, ts::ObjectId>
+    void VisitIncoming(const ts::RelationClass::Ptr& relation_class, ts::ObjectId to,
+                       Functor functor) {
+        GetNodeStorage(relation_class).VisitIncoming(to, functor);
+    }
+
+    // Nodes of the class are put into a B+tree by the primitive field or into a hash table by the
+    // string field, the index is kept up to date by every change of the class. Path is given by
+    // names of nested struct fields
+    template <ts::ClassLike C>
+    void CreateIndex(const util::Ptr<C>& node_class, const std::string& path) {
+        Atomically([&] {
+            auto& storage = GetNodeStorage(node_class);
+            if (util::Is<ts::StringClass>(FieldPath(path).Resolve(node_class))) {
+                auto& index = storage.AddHashIndex(path);
+                VisitNodes(node_class, kAll, [&index](auto it) { index.Insert(*it); });
+            } else {
+                auto& index = storage.AddIndex(path);
+                VisitNodes(node_class, kAll, [&index](auto it) { index.Insert(*it); });
+            }
+        });
+    }
+
+    template <ts::ClassLike C>
+    void DropIndex(const util::Ptr<C>& node_class, const std::string& path) {
+        Atomically([&] { GetNodeStorage(node_class).DropIndex(path); });
+    }
+
+    template <ts::ClassLike C>
+    [[nodiscard]] bool HasIndex(const util::Ptr<C>& node_class, const std::string& path) {
+        auto& storage = GetNodeStorage(node_class);
+        return storage.FindIndex(path) != nullptr || storage.FindHashIndex(path) != nullptr;
     }
 
     // TODO: I'm thinking about implementing some sort of Java StreamAPI-like API in future it
@@ -293,24 +595,121 @@ public:
 
     template <ts::ClassLike C, typename Predicate, typename Functor>
     void VisitNodes(const util::Ptr<C>& node_class, Predicate predicate, Functor functor) {
+        auto access = mem::ScopedAccess(file_, mem::Access::kSequential);
         if (node_class->Size().has_value()) {
             if constexpr (std::is_invocable_r_v<bool, Predicate, ValNodeIterator>) {
-                ValNodeStorage(node_class, class_storage_, alloc_, LOGGER)
-                    .VisitNodes(predicate, functor);
+                GetStorage<ValNodeStorage>(node_class).VisitNodes(predicate, functor);
             } else {
                 ERROR("Bad predicate");
             }
 
         } else {
             if constexpr (std::is_invocable_r_v<bool, Predicate, VarNodeIterator>) {
-                VarNodeStorage(node_class, class_storage_, alloc_, LOGGER)
-                    .VisitNodes(predicate, functor);
+                GetStorage<VarNodeStorage>(node_class).VisitNodes(predicate, functor);
             } else {
                 ERROR("Bad predicate");
             }
         }
     }
 
+    // Functor is called with Node::Ptr of every node with the field in the range. Nodes are found
+    // by the index of the field in the order of values if there is one, otherwise by a scan. Scan
+    // of a fixed size class skips the pages by their zone map, in columns it reads only the field
+    template <ts::ClassLike C, typename T, typename Functor>
+    void VisitNodes(const util::Ptr<C>& node_class, const Range<T>& range, Functor functor) {
+        auto& storage = GetNodeStorage(node_class);
+        if (auto index = storage.FindIndex(range.field); index != nullptr) {
+            auto access = mem::ScopedAccess(file_, mem::Access::kRandom);
+            index->Visit(range, [&storage, &functor](ts::ObjectId id) {
+                if (auto node = storage.GetNode(id); node != nullptr) {
+                    functor(node);
+                }
+            });
+            return;
+        }
+        auto path = FieldPath(range.field);
+        auto field_class = path.Resolve(node_class);
+        auto from = EncodeKey(field_class, range.from, Bound::kLower);
+        auto to = EncodeKey(field_class, range.to, Bound::kUpper);
+        auto check = [&path, &functor, from, to](const Node::Ptr& node) {
+            auto key = EncodeKey(path.Extract(node->template Data<ts::Object>()));
+            if (from <= key && key <= to) {
+                functor(node);
+            }
+        };
+        if (node_class->Size().has_value()) {
+            auto access = mem::ScopedAccess(file_, mem::Access::kSequential);
+            GetStorage<ValNodeStorage>(node_class).VisitNodesInRange(range.field, from, to, check);
+        } else {
+            VisitNodes(node_class, kAll, [&check](auto it) { check(util::MakePtr<Node>(*it)); });
+        }
+    }
+
+    // Functor is called with Node::Ptr of every node with the field passing the filter. Pages of
+    // a fixed size class of primitives are filtered by the selection kernels and only the chosen
+    // nodes are built, other classes are scanned as by Range. Both clamp the bounds by ClampBound
+    template <ts::ClassLike C, typename T, typename Functor>
+    void VisitNodes(const util::Ptr<C>& node_class, const Filter<T>& filter, Functor functor) {
+        if (!NodeLayout::SupportsColumns(node_class)) {
+            VisitNodes(node_class, filter.ToRange(), functor);
+            return;
+        }
+        auto& storage = GetStorage<ValNodeStorage>(node_class);
+        VisitSelections(storage, node_class, filter, [&storage, &functor](const Selection& chosen) {
+            chosen.VisitSlots([&storage, &functor, &chosen](size_t slot) {
+                functor(storage.ReadSlot(chosen.page, slot));
+            });
+        });
+    }
+
+    // Count of the nodes with the field passing the filter, nodes of a fixed size class of
+    // primitives are not built and their pages are split between the given count of threads
+    template <ts::ClassLike C, typename T>
+    [[nodiscard]] size_t CountNodes(const util::Ptr<C>& node_class, const Filter<T>& filter,
+                                    size_t threads = 1) {
+        size_t count = 0;
+        if (!NodeLayout::SupportsColumns(node_class)) {
+            VisitNodes(node_class, filter.ToRange(), [&count](const Node::Ptr&) { ++count; });
+            return count;
+        }
+        VisitSelections(GetStorage<ValNodeStorage>(node_class), node_class, filter,
+                        [&count](const Selection& chosen) { count += chosen.Count(); }, threads);
+        return count;
+    }
+
+    // Functor is called with Node::Ptr of every node with the string field equal to the value.
+    // Nodes are found by the hash index of the field if there is one, otherwise by a scan that
+    // skips the pages by their Bloom filters
+    template <ts::ClassLike C, typename Functor>
+    void VisitNodes(const util::Ptr<C>& node_class, const Equals& equals, Functor functor) {
+        auto path = FieldPath(equals.field);
+        if (!util::Is<ts::StringClass>(path.Resolve(node_class))) {
+            throw error::TypeError("Field is not a string: " + equals.field);
+        }
+        auto matches = [&path, &equals](const Node::Ptr& node) {
+            auto field = path.Extract(node->Data<ts::Object>());
+            return util::As<ts::String>(field)->Value() == equals.value;
+        };
+        auto& storage = GetNodeStorage(node_class);
+        if (auto index = storage.FindHashIndex(equals.field); index != nullptr) {
+            auto access = mem::ScopedAccess(file_, mem::Access::kRandom);
+            index->Visit(equals.value, [&storage, &matches, &functor](ts::ObjectId id) {
+                if (auto node = storage.GetNode(id); node != nullptr && matches(node)) {
+                    functor(node);
+                }
+            });
+            return;
+        }
+        auto access = mem::ScopedAccess(file_, mem::Access::kSequential);
+        GetStorage<VarNodeStorage>(node_class)
+            .VisitNodesWithValue(equals.field, equals.value, [&matches, &functor](auto it) {
+                auto node = util::MakePtr<Node>(*it);
+                if (matches(node)) {
+                    functor(node);
+                }
+            });
+    }
+
     template <ts::ClassLike C, typename Predicate>
     void PrintNodesIf(util::Ptr<C>& node_class, Predicate predicate, std::ostream& os = std::cout) {
         auto print = [&os](auto node) { os << node->ToString() << std::endl; };
@@ -331,6 +730,8 @@ public:
     // Definitly needed review and rethinking
     template <typename Container>
     void PatternMatch(Pattern::Ptr pattern, std::back_insert_iterator<Container> back_inserter) {
+        // Scans switch to sequential access by themselves, the rest are node probes
+        auto access = mem::ScopedAccess(file_, mem::Access::kRandom);
         auto result_impl = PatternMatchImpl(pattern);
         if (result_impl.has_value()) {
             std::transform(result_impl.value().begin(), result_impl.value().end(), back_inserter,
@@ -0,0 +1,185 @@
+#pragma once
+
+#include <algorithm>
+#include <bit>
+#include <cstdint>
+#include <limits>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#include <immintrin.h>
+#define DDB_SELECT_AVX2
+#endif
+
+#include "index.hpp"
+
+namespace db {
+
+// Predicate on a primitive field given by its path: value of the field lies in [from, to]. Unlike
+// Range it is evaluated over the values of a whole page at once. Bounds are converted to the type
+// of the field
+template <typename T>
+requires std::is_arithmetic_v<T>
+class Filter {
+    std::string field_;
+    T from_ = std::numeric_limits<T>::lowest();
+    T to_ = std::numeric_limits<T>::max();
+
+public:
+    explicit Filter(std::string field) : field_(std::move(field)) {
+    }
+
+    Filter& Between(T from, T to) {
+        from_ = from;
+        to_ = to;
+        return *this;
+    }
+
+    Filter& Equal(T value) {
+        return Between(value, value);
+    }
+
+    Filter& AtLeast(T from) {
+        from_ = from;
+        return *this;
+    }
+
+    Filter& AtMost(T to) {
+        to_ = to;
+        return *this;
+    }
+
+    [[nodiscard]] const std::string& GetField() const {
+        return field_;
+    }
+
+    [[nodiscard]] T From() const {
+        return from_;
+    }
+
+    [[nodiscard]] T To() const {
+        return to_;
+    }
+
+    [[nodiscard]] Range<T> ToRange() const {
+        return Range<T>{field_, from_, to_};
+    }
+};
+
+// Slots of a data page chosen by a filter, bit i of the words is the slot i
+struct Selection {
+    mem::PageIndex page;
+    std::vector<uint64_t> bits;
+
+    [[nodiscard]] size_t Count() const {
+        size_t count = 0;
+        for (auto word : bits) {
+            count += std::popcount(word);
+        }
+        return count;
+    }
+
+    template <typename Functor>
+    void VisitSlots(Functor functor) const {
+        for (size_t word = 0; word < bits.size(); ++word) {
+            for (auto rest = bits[word]; rest != 0; rest &= rest - 1) {
+                functor(word * 64 + std::countr_zero(rest));
+            }
+        }
+    }
+};
+
+// Comparisons have no branches, so the compiler vectorizes the loop for the target it builds for.
+// NaN is not chosen, like by the ordered comparisons of the AVX2 lanes
+template <typename T>
+inline void SelectBetweenScalar(const T* values, size_t count, T from, T to, uint64_t* bits,
+                                size_t first = 0) {
+    for (auto i = first; i < count; ++i) {
+        auto chosen = static_cast<uint64_t>((values[i] >= from) & (values[i] <= to));
+        bits[i / 64] |= chosen << (i % 64);
+    }
+}
+
+#ifdef DDB_SELECT_AVX2
+
+// Lanes of a 256 bit register for the types compared by AVX2, zero for the others
+template <typename T>
+constexpr inline size_t kAvx2Lanes =
+    (std::is_floating_point_v<T> || (std::is_integral_v<T> && !std::is_same_v<T, bool>)) &&
+            (sizeof(T) == 4 || sizeof(T) == 8)
+        ? 32 / sizeof(T)
+        : 0;
+
+[[nodiscard]] inline bool HasAvx2() {
+    static const bool has_avx2 = __builtin_cpu_supports("avx2");
+    return has_avx2;
+}
+
+// Bits of the lanes in [from, to]. Unsigned values are compared as signed ones with the highest
+// bit flipped
+template <typename T>
+[[nodiscard]] __attribute__((target("avx2"))) inline uint64_t SelectLanesAvx2(const T* values,
+                                                                              T from, T to) {
+    if constexpr (std::is_same_v<T, float>) {
+        auto lanes = _mm256_loadu_ps(values);
+        auto chosen = _mm256_and_ps(_mm256_cmp_ps(lanes, _mm256_set1_ps(from), _CMP_GE_OQ),
+                                    _mm256_cmp_ps(lanes, _mm256_set1_ps(to), _CMP_LE_OQ));
+        return static_cast<uint32_t>(_mm256_movemask_ps(chosen));
+    } else if constexpr (std::is_same_v<T, double>) {
+        auto lanes = _mm256_loadu_pd(values);
+        auto chosen = _mm256_and_pd(_mm256_cmp_pd(lanes, _mm256_set1_pd(from), _CMP_GE_OQ),
+                                    _mm256_cmp_pd(lanes, _mm256_set1_pd(to), _CMP_LE_OQ));
+        return static_cast<uint32_t>(_mm256_movemask_pd(chosen));
+    } else if constexpr (sizeof(T) == 4) {
+        auto bias = _mm256_set1_epi32(std::is_signed_v<T> ? 0 : INT32_MIN);
+        auto lanes = _mm256_xor_si256(
+            _mm256_loadu_si256(reinterpret_cast<const __m256i*>(values)), bias);
+        auto low = _mm256_xor_si256(_mm256_set1_epi32(static_cast<int32_t>(from)), bias);
+        auto high = _mm256_xor_si256(_mm256_set1_epi32(static_cast<int32_t>(to)), bias);
+        auto missed =
+            _mm256_or_si256(_mm256_cmpgt_epi32(low, lanes), _mm256_cmpgt_epi32(lanes, high));
+        return ~static_cast<uint32_t>(_mm256_movemask_ps(_mm256_castsi256_ps(missed))) & 0xff;
+    } else {
+        auto bias = _mm256_set1_epi64x(std::is_signed_v<T> ? 0 : INT64_MIN);
+        auto lanes = _mm256_xor_si256(
+            _mm256_loadu_si256(reinterpret_cast<const __m256i*>(values)), bias);
+        auto low = _mm256_xor_si256(_mm256_set1_epi64x(static_cast<int64_t>(from)), bias);
+        auto high = _mm256_xor_si256(_mm256_set1_epi64x(static_cast<int64_t>(to)), bias);
+        auto missed =
+            _mm256_or_si256(_mm256_cmpgt_epi64(low, lanes), _mm256_cmpgt_epi64(lanes, high));
+        return ~static_cast<uint32_t>(_mm256_movemask_pd(_mm256_castsi256_pd(missed))) & 0xf;
+    }
+}
+
+template <typename T>
+__attribute__((target("avx2"))) inline void SelectBetweenAvx2(const T* values, size_t count,
+                                                              T from, T to, uint64_t* bits) {
+    constexpr auto kLanes = kAvx2Lanes<T>;
+    size_t i = 0;
+    for (; i + kLanes <= count; i += kLanes) {
+        bits[i / 64] |= SelectLanesAvx2(values + i, from, to) << (i % 64);
+    }
+    SelectBetweenScalar(values, count, from, to, bits, i);
+}
+
+#endif
+
+// Bit i of the selection is set if values[i] lies in [from, to], the selection has a word for
+// every 64 values. Wide types are compared by AVX2 when the processor has it
+template <typename T>
+inline void SelectBetween(const T* values, size_t count, T from, T to, uint64_t* bits) {
+    std::fill(bits, bits + (count + 63) / 64, 0);
+#ifdef DDB_SELECT_AVX2
+    if constexpr (kAvx2Lanes<T> != 0) {
+        if (HasAvx2()) {
+            SelectBetweenAvx2(values, count, from, to, bits);
+            return;
+        }
+    }
+#endif
+    SelectBetweenScalar(values, count, from, to, bits);
+}
+
+}  // namespace db
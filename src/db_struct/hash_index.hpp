@@ -0,0 +1,301 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "id_directory.hpp"
+#include "index.hpp"
+
+namespace db {
+
+// Predicate on a string field given by its path: value of the field is equal to the string
+struct Equals {
+    std::string field;
+    std::string value;
+};
+
+// FNV-1a of the bytes. Hashes are kept in the file, so the function must not depend on the
+// standard library
+[[nodiscard]] inline uint64_t HashBytes(std::string_view bytes) {
+    uint64_t hash = 14695981039346656037ull;
+    for (auto byte : bytes) {
+        hash ^= static_cast<uint8_t>(byte);
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+struct HashEntry {
+    uint64_t hash;
+    ts::ObjectId id;
+};
+
+constexpr inline size_t kHashBucketCapacity =
+    (mem::kPageSize - sizeof(mem::Page) - sizeof(uint64_t) - sizeof(mem::PageIndex)) /
+    sizeof(HashEntry);
+
+// Body of a bucket page, entries of a full bucket go on in its overflow page
+struct HashBucket {
+    uint64_t count;
+    mem::PageIndex overflow;
+    HashEntry entries[kHashBucketCapacity];
+};
+
+static_assert(sizeof(mem::Page) + sizeof(HashBucket) <= mem::kPageSize);
+
+struct HashState {
+    uint64_t level;
+    uint64_t split;
+    uint64_t count;
+};
+
+// Secondary index of a class by a string field, a linear hash table of pages. There are
+// 2^level + split buckets, a hash falls into the bucket given by its level low bits, or by one bit
+// more if that bucket is already split. When the table is loaded enough the bucket at the split
+// pointer is split into itself and a new bucket at the end, so the table grows by one page at a
+// time. Meta page keeps the list of the bucket directory, the state of the table and the path
+class HashIndex {
+    static constexpr size_t kDirectoryOffset = sizeof(mem::Page);
+    static constexpr size_t kStateOffset = kDirectoryOffset + sizeof(mem::ListHead);
+    static constexpr size_t kPathOffset = kStateOffset + sizeof(HashState);
+    static constexpr double kMaxLoad = 0.75;
+
+    DECLARE_LOGGER;
+    std::string path_;
+    FieldPath field_path_;
+    mem::PageIndex meta_;
+    mem::PageAllocator::Ptr alloc_;
+    // Pages of the buckets by their numbers, incremented so that zero means no page
+    DenseDirectory<mem::PageIndex> buckets_;
+    HashState state_;
+
+    [[nodiscard]] static mem::Offset GetBucketOffset(mem::PageIndex index) {
+        return mem::GetOffset(index, sizeof(mem::Page));
+    }
+
+    [[nodiscard]] HashBucket ReadBucket(mem::PageIndex index) {
+        return alloc_->GetFile()->Read<HashBucket>(GetBucketOffset(index));
+    }
+
+    // Only the used part of the entries is written
+    void WriteBucket(mem::PageIndex index, const HashBucket& bucket) {
+        alloc_->GetFile()->Write<HashBucket>(
+            bucket, GetBucketOffset(index), 0,
+            offsetof(HashBucket, entries) + bucket.count * sizeof(HashEntry));
+    }
+
+    mem::PageIndex AllocateBucket() {
+        auto index = alloc_->AllocatePage();
+        auto page = mem::ReadPage(mem::Page(index), alloc_->GetHeaders());
+        page.type_ = mem::PageType::kIndex;
+        mem::WritePage(page, alloc_->GetHeaders());
+        HashBucket bucket;
+        bucket.count = 0;
+        bucket.overflow = mem::kSentinelIndex;
+        WriteBucket(index, bucket);
+        return index;
+    }
+
+    [[nodiscard]] size_t GetBucketsCount() const {
+        return (uint64_t{1} << state_.level) + state_.split;
+    }
+
+    [[nodiscard]] uint64_t GetBucketNumber(uint64_t hash) const {
+        auto number = hash & ((uint64_t{1} << state_.level) - 1);
+        if (number < state_.split) {
+            number = hash & ((uint64_t{1} << (state_.level + 1)) - 1);
+        }
+        return number;
+    }
+
+    [[nodiscard]] mem::PageIndex GetBucketPage(uint64_t number) {
+        return buckets_.Get(number) - 1;
+    }
+
+    void WriteState() {
+        alloc_->GetFile()->Write<HashState>(state_, mem::GetOffset(meta_, kStateOffset));
+    }
+
+    // Entries of the chain are collected, its overflow pages are freed
+    std::vector<HashEntry> TakeChain(mem::PageIndex first) {
+        std::vector<HashEntry> entries;
+        for (auto index = first; index != mem::kSentinelIndex;) {
+            auto bucket = ReadBucket(index);
+            entries.insert(entries.end(), bucket.entries, bucket.entries + bucket.count);
+            if (index != first) {
+                alloc_->FreePage(index);
+            }
+            index = bucket.overflow;
+        }
+        return entries;
+    }
+
+    void WriteChain(mem::PageIndex first, const std::vector<HashEntry>& entries) {
+        HashBucket bucket;
+        size_t position = 0;
+        for (auto index = first; index != mem::kSentinelIndex; index = bucket.overflow) {
+            bucket.count = std::min(kHashBucketCapacity, entries.size() - position);
+            std::copy_n(entries.begin() + position, bucket.count, bucket.entries);
+            position += bucket.count;
+            bucket.overflow = position == entries.size() ? mem::kSentinelIndex : AllocateBucket();
+            WriteBucket(index, bucket);
+        }
+    }
+
+    // Entries of the bucket at the split pointer with the next bit of the hash set move to the
+    // new bucket
+    void Split() {
+        auto high = uint64_t{1} << state_.level;
+        auto number = state_.split;
+        auto page = GetBucketPage(number);
+        auto new_page = AllocateBucket();
+        buckets_.Set(number + high, new_page + 1);
+        std::vector<HashEntry> stay;
+        std::vector<HashEntry> moved;
+        for (auto& entry : TakeChain(page)) {
+            (entry.hash & high ? moved : stay).push_back(entry);
+        }
+        WriteChain(page, stay);
+        WriteChain(new_page, moved);
+        if (++state_.split == high) {
+            ++state_.level;
+            state_.split = 0;
+        }
+        DEBUG("Bucket ", number, " split, buckets count: ", GetBucketsCount());
+    }
+
+    [[nodiscard]] uint64_t Hash(const Node& node) const {
+        auto field = field_path_.Extract(node.Data<ts::Object>());
+        return HashBytes(util::As<ts::String>(field)->Value());
+    }
+
+public:
+    HashIndex(const ts::Class::Ptr& node_class, mem::PageAllocator::Ptr& alloc,
+              mem::PageIndex meta, DEFAULT_LOGGER(logger))
+        : LOGGER(logger),
+          meta_(meta),
+          alloc_(alloc),
+          buckets_(node_class->Name() + "_Buckets", alloc, mem::GetOffset(meta, kDirectoryOffset),
+                   logger) {
+        auto& file = alloc->GetFile();
+        state_ = file->Read<HashState>(mem::GetOffset(meta, kStateOffset));
+        auto size = file->Read<size_t>(mem::GetOffset(meta, kPathOffset));
+        path_ = file->ReadString(mem::GetOffset(meta, kPathOffset + sizeof(size_t)), size);
+        field_path_ = FieldPath(path_);
+    }
+
+    static void Validate(const ts::Class::Ptr& node_class, const std::string& path) {
+        if (kPathOffset + sizeof(size_t) + path.size() >= mem::kPageSize) {
+            throw error::BadArgument("Too long field path");
+        }
+        if (!util::Is<ts::StringClass>(FieldPath(path).Resolve(node_class))) {
+            throw error::TypeError("Field is not a string: " + path);
+        }
+    }
+
+    // Meta page must be allocated, the table gets its first bucket
+    static HashIndex Create(const ts::Class::Ptr& node_class, mem::PageAllocator::Ptr& alloc,
+                            mem::PageIndex meta, const std::string& path,
+                            DEFAULT_LOGGER(logger)) {
+        Validate(node_class, path);
+        auto& headers = alloc->GetHeaders();
+        auto sentinel = mem::Page(mem::kSentinelIndex);
+        sentinel.type_ = mem::PageType::kSentinel;
+        headers->Write<mem::Page>(sentinel, mem::GetOffset(meta, kDirectoryOffset));
+        headers->Write<size_t>(0,
+                               mem::GetCountFromSentinel(mem::GetOffset(meta, kDirectoryOffset)));
+        auto& file = alloc->GetFile();
+        file->Write<HashState>(HashState{0, 0, 0}, mem::GetOffset(meta, kStateOffset));
+        file->Write<size_t>(path.size(), mem::GetOffset(meta, kPathOffset));
+        file->Write(path, mem::GetOffset(meta, kPathOffset + sizeof(size_t)));
+        auto index = HashIndex(node_class, alloc, meta, logger);
+        index.buckets_.Set(0, index.AllocateBucket() + 1);
+        return index;
+    }
+
+    [[nodiscard]] const std::string& GetPath() const {
+        return path_;
+    }
+
+    [[nodiscard]] mem::PageIndex GetMeta() const {
+        return meta_;
+    }
+
+    [[nodiscard]] const FieldPath& GetFieldPath() const {
+        return field_path_;
+    }
+
+    void Insert(const Node& node) {
+        auto hash = Hash(node);
+        auto index = GetBucketPage(GetBucketNumber(hash));
+        auto bucket = ReadBucket(index);
+        while (bucket.count == kHashBucketCapacity) {
+            if (bucket.overflow == mem::kSentinelIndex) {
+                bucket.overflow = AllocateBucket();
+                WriteBucket(index, bucket);
+            }
+            index = bucket.overflow;
+            bucket = ReadBucket(index);
+        }
+        bucket.entries[bucket.count++] = HashEntry{hash, node.Id()};
+        WriteBucket(index, bucket);
+        auto capacity = static_cast<double>(GetBucketsCount() * kHashBucketCapacity);
+        if (++state_.count > kMaxLoad * capacity) {
+            Split();
+        }
+        WriteState();
+    }
+
+    bool Erase(const Node& node) {
+        auto entry = HashEntry{Hash(node), node.Id()};
+        auto index = GetBucketPage(GetBucketNumber(entry.hash));
+        while (index != mem::kSentinelIndex) {
+            auto bucket = ReadBucket(index);
+            auto end = bucket.entries + bucket.count;
+            auto it = std::find_if(bucket.entries, end, [&entry](const HashEntry& other) {
+                return other.id == entry.id && other.hash == entry.hash;
+            });
+            if (it != end) {
+                *it = *(end - 1);
+                --bucket.count;
+                WriteBucket(index, bucket);
+                --state_.count;
+                WriteState();
+                return true;
+            }
+            index = bucket.overflow;
+        }
+        return false;
+    }
+
+    // Functor is called with ids of the nodes with the same hash of the field, the value itself
+    // is checked by the caller
+    template <typename Functor>
+    void Visit(std::string_view value, Functor functor) {
+        auto hash = HashBytes(value);
+        for (auto index = GetBucketPage(GetBucketNumber(hash)); index != mem::kSentinelIndex;) {
+            auto bucket = ReadBucket(index);
+            for (uint64_t i = 0; i < bucket.count; ++i) {
+                if (bucket.entries[i].hash == hash) {
+                    functor(bucket.entries[i].id);
+                }
+            }
+            index = bucket.overflow;
+        }
+    }
+
+    void Drop() {
+        for (uint64_t number = 0; number < GetBucketsCount(); ++number) {
+            auto page = GetBucketPage(number);
+            TakeChain(page);
+            alloc_->FreePage(page);
+        }
+        buckets_.Drop();
+    }
+};
+
+}  // namespace db
@@ -0,0 +1,109 @@
+#pragma once
+
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include "allocator.hpp"
+#include "logger.hpp"
+#include "pagelist.hpp"
+
+namespace db {
+
+// Ids of a class are given by its counter one after another, so a directory keyed by id is a dense
+// array split by pages: the entry of an id is found by division, zero entry means no value.
+// Pages of the directory are linked to the class header, their indices are kept in memory
+template <typename T>
+requires std::is_trivially_copyable_v<T>
+class DenseDirectory {
+    DECLARE_LOGGER;
+    mem::PageAllocator::Ptr alloc_;
+    mem::PageList page_list_;
+    std::vector<mem::PageIndex> pages_;
+
+public:
+    static constexpr size_t kEntriesPerPage = (mem::kPageSize - sizeof(mem::Page)) / sizeof(T);
+
+private:
+    [[nodiscard]] mem::Offset GetEntryOffset(ts::ObjectId id) const {
+        auto in_page = sizeof(mem::Page) + id % kEntriesPerPage * sizeof(T);
+        return mem::GetOffset(pages_[id / kEntriesPerPage], static_cast<mem::PageOffset>(in_page));
+    }
+
+    void AllocatePage() {
+        auto page = alloc_->AllocatePage(page_list_, mem::PageType::kDirectory);
+        pages_.push_back(page.index_);
+        DEBUG("Directory page allocated: ", page);
+    }
+
+public:
+    DenseDirectory() {
+    }
+
+    DenseDirectory(const std::string& name, mem::PageAllocator::Ptr& alloc,
+                   mem::Offset sentinel_offset, DEFAULT_LOGGER(logger))
+        : LOGGER(logger),
+          alloc_(alloc),
+          page_list_(name, alloc->GetHeaders(), sentinel_offset, logger) {
+        for (auto& page : page_list_) {
+            pages_.push_back(page.index_);
+        }
+    }
+
+    [[nodiscard]] T Get(ts::ObjectId id) {
+        if (id / kEntriesPerPage >= pages_.size()) {
+            return T{};
+        }
+        return alloc_->GetFile()->Read<T>(GetEntryOffset(id));
+    }
+
+    void Set(ts::ObjectId id, const T& value) {
+        while (id / kEntriesPerPage >= pages_.size()) {
+            AllocatePage();
+        }
+        alloc_->GetFile()->Write<T>(value, GetEntryOffset(id));
+    }
+
+    void Erase(ts::ObjectId id) {
+        if (id / kEntriesPerPage < pages_.size()) {
+            alloc_->GetFile()->Write<T>(T{}, GetEntryOffset(id));
+        }
+    }
+
+    [[nodiscard]] size_t GetPagesCount() const {
+        return pages_.size();
+    }
+
+    // Functor is called with the key and the value of every nonzero entry in the order of keys,
+    // the entries are read a page at a time
+    template <typename Functor>
+    void Visit(Functor functor) {
+        for (size_t page = 0; page < pages_.size(); ++page) {
+            auto entries = alloc_->GetFile()->ReadVector<T>(
+                mem::GetOffset(pages_[page], sizeof(mem::Page)), kEntriesPerPage);
+            for (size_t entry = 0; entry < kEntriesPerPage; ++entry) {
+                if (entries[entry] != T{}) {
+                    functor(page * kEntriesPerPage + entry, entries[entry]);
+                }
+            }
+        }
+    }
+
+    // Pages beyond the given count are freed with their entries
+    void Shrink(size_t pages) {
+        while (pages_.size() > pages) {
+            page_list_.Unlink(pages_.back());
+            alloc_->FreePage(pages_.back());
+            pages_.pop_back();
+        }
+    }
+
+    void Drop() {
+        Shrink(0);
+    }
+};
+
+// Offsets of the nodes of a class by their ids
+using IdDirectory = DenseDirectory<mem::Offset>;
+
+}  // namespace db
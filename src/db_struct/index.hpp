@@ -0,0 +1,234 @@
+#pragma once
+
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <sstream>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include "btree.hpp"
+#include "node.hpp"
+
+namespace db {
+
+// Predicate on a primitive field given by its path: value of the field lies in [from, to].
+// Bounds are converted to the type of the field
+template <typename T>
+requires std::is_arithmetic_v<T>
+struct Range {
+    std::string field;
+    T from;
+    T to;
+};
+
+// Code of the value that keeps the order of values
+template <typename T>
+requires std::is_arithmetic_v<T>
+[[nodiscard]] inline uint64_t EncodeKey(T value) {
+    if constexpr (std::is_floating_point_v<T>) {
+        auto bits = std::bit_cast<uint64_t>(static_cast<double>(value));
+        return bits >> 63 ? ~bits : bits | (uint64_t{1} << 63);
+    } else if constexpr (std::is_signed_v<T>) {
+        return static_cast<uint64_t>(static_cast<int64_t>(value)) ^ (uint64_t{1} << 63);
+    } else {
+        return static_cast<uint64_t>(value);
+    }
+}
+
+[[nodiscard]] inline bool IsPrimitive(const ts::Class::Ptr& field_class) {
+#define DDB_IS_PRIMITIVE(P)                             \
+    if (util::Is<ts::PrimitiveClass<P>>(field_class)) { \
+        return true;                                    \
+    }
+    DDB_PRIMITIVE_GENERATOR(DDB_IS_PRIMITIVE)
+#undef DDB_IS_PRIMITIVE
+    return false;
+}
+
+enum class Bound { kLower, kUpper };
+
+// Fractional bound of an integer field is rounded inwards: the lower one up and the upper one
+// down, so the range has the same values of the field
+template <typename P, typename T>
+[[nodiscard]] inline auto RoundBound(T value, Bound bound) {
+    if constexpr (std::is_integral_v<P> && std::is_floating_point_v<T>) {
+        return bound == Bound::kLower ? std::ceil(value) : std::floor(value);
+    } else {
+        return value;
+    }
+}
+
+// Bound is converted to the type of the field, bounds beyond the type are clamped. Long double
+// keeps every 64 bit integer
+template <typename P, typename T>
+[[nodiscard]] inline P ClampBound(T value, Bound bound) {
+    auto rounded = RoundBound<P>(value, bound);
+    auto wide = static_cast<long double>(rounded);
+    if (wide <= static_cast<long double>(std::numeric_limits<P>::lowest())) {
+        return std::numeric_limits<P>::lowest();
+    }
+    if (wide >= static_cast<long double>(std::numeric_limits<P>::max())) {
+        return std::numeric_limits<P>::max();
+    }
+    return static_cast<P>(rounded);
+}
+
+// Bound of a range is converted to the type of the primitive field class and clamped to it
+template <typename T>
+[[nodiscard]] inline uint64_t EncodeKey(const ts::Class::Ptr& field_class, T value, Bound bound) {
+#define DDB_ENCODE_PRIMITIVE(P)                           \
+    if (util::Is<ts::PrimitiveClass<P>>(field_class)) {   \
+        return EncodeKey<P>(ClampBound<P>(value, bound)); \
+    }
+    DDB_PRIMITIVE_GENERATOR(DDB_ENCODE_PRIMITIVE)
+#undef DDB_ENCODE_PRIMITIVE
+    throw error::TypeError("Field is not primitive");
+}
+
+[[nodiscard]] inline uint64_t EncodeKey(const ts::Object::Ptr& field) {
+#define DDB_ENCODE_PRIMITIVE(P)                                          \
+    if (util::Is<ts::Primitive<P>>(field)) {                             \
+        return EncodeKey<P>(util::As<ts::Primitive<P>>(field)->Value()); \
+    }
+    DDB_PRIMITIVE_GENERATOR(DDB_ENCODE_PRIMITIVE)
+#undef DDB_ENCODE_PRIMITIVE
+    throw error::TypeError("Field is not primitive");
+}
+
+// Path is a list of names of nested struct fields separated by dots, primitive class is the field
+// of itself by its name
+class FieldPath {
+    std::vector<std::string> names_;
+
+public:
+    FieldPath() {
+    }
+
+    explicit FieldPath(const std::string& path) {
+        std::stringstream stream(path);
+        std::string name;
+        while (std::getline(stream, name, '.')) {
+            names_.push_back(name);
+        }
+        if (names_.empty()) {
+            throw error::BadArgument("Empty field path");
+        }
+    }
+
+    [[nodiscard]] ts::Class::Ptr Resolve(ts::Class::Ptr node_class) const {
+        if (!util::Is<ts::StructClass>(node_class)) {
+            if (names_.size() != 1 || names_[0] != node_class->Name()) {
+                throw error::BadArgument("No such field: " + names_[0]);
+            }
+            return node_class;
+        }
+        for (auto& name : names_) {
+            if (!util::Is<ts::StructClass>(node_class)) {
+                throw error::BadArgument("No such field: " + name);
+            }
+            auto& fields = util::As<ts::StructClass>(node_class)->GetFields();
+            auto it = std::find_if(fields.begin(), fields.end(),
+                                   [&name](auto& field) { return field->Name() == name; });
+            if (it == fields.end()) {
+                throw error::BadArgument("No such field: " + name);
+            }
+            node_class = *it;
+        }
+        return node_class;
+    }
+
+    [[nodiscard]] ts::Object::Ptr Extract(ts::Object::Ptr object) const {
+        if (!util::Is<ts::Struct>(object)) {
+            return object;
+        }
+        for (auto& name : names_) {
+            object = util::As<ts::Struct>(object)->GetField<ts::Object>(name);
+        }
+        return object;
+    }
+};
+
+// Secondary index of a class by a primitive field. Its meta page keeps the root of the tree and
+// the path of the field, keys are codes of the field values with ids of the nodes
+class FieldIndex {
+    std::string path_;
+    FieldPath field_path_;
+    ts::Class::Ptr field_class_;
+    mem::PageIndex meta_;
+    mem::BTree tree_;
+
+    static constexpr size_t kPathOffset = sizeof(mem::Page) + sizeof(mem::PageIndex);
+
+public:
+    FieldIndex(const ts::Class::Ptr& node_class, mem::PageAllocator::Ptr& alloc,
+               mem::PageIndex meta, DEFAULT_LOGGER(logger))
+        : meta_(meta), tree_(alloc, mem::GetOffset(meta, sizeof(mem::Page)), logger) {
+        auto& file = alloc->GetFile();
+        auto size = file->Read<size_t>(mem::GetOffset(meta, kPathOffset));
+        path_ = file->ReadString(mem::GetOffset(meta, kPathOffset + sizeof(size_t)), size);
+        field_path_ = FieldPath(path_);
+        field_class_ = field_path_.Resolve(node_class);
+    }
+
+    static void Validate(const ts::Class::Ptr& node_class, const std::string& path) {
+        if (kPathOffset + sizeof(size_t) + path.size() >= mem::kPageSize) {
+            throw error::BadArgument("Too long field path");
+        }
+        if (!IsPrimitive(FieldPath(path).Resolve(node_class))) {
+            throw error::TypeError("Field is not primitive: " + path);
+        }
+    }
+
+    // Meta page must be allocated, the tree is empty
+    static FieldIndex Create(const ts::Class::Ptr& node_class, mem::PageAllocator::Ptr& alloc,
+                             mem::PageIndex meta, const std::string& path,
+                             DEFAULT_LOGGER(logger)) {
+        Validate(node_class, path);
+        auto& file = alloc->GetFile();
+        file->Write<size_t>(path.size(), mem::GetOffset(meta, kPathOffset));
+        file->Write(path, mem::GetOffset(meta, kPathOffset + sizeof(size_t)));
+        mem::BTree::Create(alloc, mem::GetOffset(meta, sizeof(mem::Page)), logger);
+        return FieldIndex(node_class, alloc, meta, logger);
+    }
+
+    [[nodiscard]] const std::string& GetPath() const {
+        return path_;
+    }
+
+    [[nodiscard]] mem::PageIndex GetMeta() const {
+        return meta_;
+    }
+
+    [[nodiscard]] const FieldPath& GetFieldPath() const {
+        return field_path_;
+    }
+
+    [[nodiscard]] const ts::Class::Ptr& GetFieldClass() const {
+        return field_class_;
+    }
+
+    void Insert(const Node& node) {
+        tree_.Insert({EncodeKey(field_path_.Extract(node.Data<ts::Object>())), node.Id()});
+    }
+
+    void Erase(const Node& node) {
+        tree_.Erase({EncodeKey(field_path_.Extract(node.Data<ts::Object>())), node.Id()});
+    }
+
+    // Functor is called with ids of the nodes in the order of the field values
+    template <typename T, typename Functor>
+    void Visit(const Range<T>& range, Functor functor) {
+        tree_.Visit(EncodeKey(field_class_, range.from, Bound::kLower),
+                    EncodeKey(field_class_, range.to, Bound::kUpper), functor);
+    }
+
+    void Drop() {
+        tree_.Drop();
+    }
+};
+
+}  // namespace db
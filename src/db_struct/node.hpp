@@ -38,6 +38,11 @@ public:
         : magic_(magic), meta_(id), data_(data), state_(ObjectState::kValid) {
     }
 
+    // Free or invalid node, free one keeps the next free offset
+    Node(mem::Magic magic, ObjectState state, mem::PageOffset next_free = 0)
+        : magic_(magic), meta_(next_free), state_(state) {
+    }
+
     size_t Size() const {
         switch (state_) {
             case ObjectState::kFree: {
@@ -55,15 +60,12 @@ public:
     mem::Offset Write(mem::File::Ptr& file, mem::Offset offset) const {
         switch (state_) {
             case ObjectState::kFree:
-                file->Write<mem::Magic>(~magic_, offset);
-                offset += sizeof(mem::Magic);
-                return file->Write(std::get<mem::PageOffset>(meta_), offset);
+                return file->WriteFields(offset, ~magic_, std::get<mem::PageOffset>(meta_)) +
+                       static_cast<mem::Offset>(sizeof(mem::Magic));
 
             case ObjectState::kValid:
-                file->Write<mem::Magic>(magic_, offset);
-                offset += sizeof(mem::Magic);
-                file->Write(std::get<ts::ObjectId>(meta_), offset);
-                offset += sizeof(ts::ObjectId);
+                file->WriteFields(offset, magic_, std::get<ts::ObjectId>(meta_));
+                offset += sizeof(mem::Magic) + sizeof(ts::ObjectId);
                 return data_->Write(file, offset);
             case ObjectState::kInvalid:
                 throw error::BadArgument("Trying to write invalid object");
@@ -104,6 +106,7 @@ public:
     Node(mem::Magic magic, ts::Class::Ptr data_class, mem::File::Ptr& file, mem::Offset offset)
         : magic_(magic) {
 
+        // Free slot at the end of the last page has only its magic inside the file
         auto read_magic = file->Read<mem::Magic>(offset);
         offset += sizeof(mem::Magic);
 
@@ -0,0 +1,357 @@
+#pragma once
+
+#include <algorithm>
+#include <cstring>
+#include <optional>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include "filter.hpp"
+#include "index.hpp"
+#include "node.hpp"
+#include "overflow.hpp"
+
+namespace db {
+
+// Placement of the nodes of a class inside its data pages. Rows keep every node in one piece.
+// Columns split the page into minipages: the magics, the ids and every primitive field of the
+// nodes, each of them in a run of the page capacity. A node is still addressed by the offset of
+// its slot in rows, so the pages, the occupancy and the directory don't see the difference. Free
+// slot keeps the inverted magic in the minipage of the magics. Fields of a fixed size class of
+// primitives are known in both layouts, so its pages can be filtered without building the nodes.
+// Nodes of a variable size class are addressed by their slots in the slot array of the page, the
+// records are moved inside the page by their storage. Large nodes are read from their overflow
+// chains
+class NodeLayout {
+    struct Column {
+        std::string path;
+        ts::Class::Ptr field_class;
+        size_t size;
+        // Offset of the minipage in columns and of the field inside the node in rows
+        mem::PageOffset start;
+        size_t row_offset;
+    };
+
+    mem::Magic magic_ = 0;
+    ts::Class::Ptr node_class_;
+    bool columnar_ = false;
+    bool slotted_ = false;
+    size_t row_size_ = 0;
+    size_t capacity_ = 0;
+    mem::PageOffset ids_start_ = 0;
+    std::vector<Column> columns_;
+
+    void CollectColumns(const ts::Class::Ptr& field_class, const std::string& path) {
+        if (util::Is<ts::StructClass>(field_class)) {
+            for (auto& field : util::As<ts::StructClass>(field_class)->GetFields()) {
+                CollectColumns(field, path.empty() ? field->Name() : path + "." + field->Name());
+            }
+        } else {
+            columns_.push_back(Column{path, field_class, field_class->Size().value(), 0, 0});
+        }
+    }
+
+    [[nodiscard]] static mem::Offset GetColumnOffset(mem::Offset offset, mem::PageOffset start,
+                                                     size_t size, size_t slot) {
+        return mem::GetOffset(mem::GetIndex(offset),
+                              static_cast<mem::PageOffset>(start + slot * size));
+    }
+
+    [[nodiscard]] mem::Offset GetMagicOffset(mem::Offset offset, size_t slot) const {
+        return GetColumnOffset(offset, sizeof(mem::Page), sizeof(mem::Magic), slot);
+    }
+
+    [[nodiscard]] mem::Offset GetIdOffset(mem::Offset offset, size_t slot) const {
+        return GetColumnOffset(offset, ids_start_, sizeof(ts::ObjectId), slot);
+    }
+
+    [[nodiscard]] mem::Offset GetFieldOffset(mem::Offset offset, size_t slot,
+                                             size_t column) const {
+        return GetColumnOffset(offset, columns_[column].start, columns_[column].size, slot);
+    }
+
+    [[nodiscard]] static mem::Offset GetRecordOffset(mem::Offset offset, const mem::Slot& slot) {
+        return mem::GetOffset(mem::GetIndex(offset), slot.offset_);
+    }
+
+    [[nodiscard]] static ts::Object::Ptr DefaultObject(const ts::Class::Ptr& object_class) {
+        if (util::Is<ts::StructClass>(object_class)) {
+            return ts::DefaultNew<ts::Struct>(util::As<ts::StructClass>(object_class));
+        }
+#define DDB_DEFAULT_PRIMITIVE(P)                                                   \
+    if (util::Is<ts::PrimitiveClass<P>>(object_class)) {                           \
+        auto primitive_class = util::As<ts::PrimitiveClass<P>>(object_class);      \
+        return ts::DefaultNew<ts::Primitive<P>>(primitive_class);                  \
+    }
+        DDB_PRIMITIVE_GENERATOR(DDB_DEFAULT_PRIMITIVE)
+#undef DDB_DEFAULT_PRIMITIVE
+        throw error::TypeError("Class can't be placed in columns");
+    }
+
+    void ReadFields(mem::File::Ptr& file, const ts::Object::Ptr& object, mem::Offset offset,
+                    size_t slot, size_t& column) const {
+        if (util::Is<ts::Struct>(object)) {
+            for (auto& field : util::As<ts::Struct>(object)->GetFields()) {
+                ReadFields(file, field, offset, slot, column);
+            }
+        } else {
+            object->Read(file, GetFieldOffset(offset, slot, column++));
+        }
+    }
+
+    void WriteFields(mem::File::Ptr& file, const ts::Object::Ptr& object, mem::Offset offset,
+                     size_t slot, size_t& column) const {
+        if (util::Is<ts::Struct>(object)) {
+            for (auto& field : util::As<ts::Struct>(object)->GetFields()) {
+                WriteFields(file, field, offset, slot, column);
+            }
+        } else {
+            object->Write(file, GetFieldOffset(offset, slot, column++));
+        }
+    }
+
+    template <typename P, typename Functor>
+    void VisitKeys(mem::File::Ptr& file, mem::PageIndex index, size_t column, size_t count,
+                   Functor functor) const {
+        // Vector of bools has no data to read into
+        using Stored = std::conditional_t<std::is_same_v<P, bool>, uint8_t, P>;
+        auto values =
+            file->ReadVector<Stored>(mem::GetOffset(index, columns_[column].start), count);
+        for (size_t slot = 0; slot < count; ++slot) {
+            functor(slot, EncodeKey<P>(static_cast<P>(values[slot])));
+        }
+    }
+
+public:
+    NodeLayout() {
+    }
+
+    NodeLayout(const ts::Class::Ptr& node_class, mem::Magic magic, mem::PageLayout layout)
+        : magic_(magic),
+          node_class_(node_class),
+          columnar_(layout == mem::PageLayout::kColumns),
+          slotted_(!node_class->Size().has_value()) {
+        if (!slotted_) {
+            row_size_ = sizeof(mem::Magic) + sizeof(ts::ObjectId) + node_class->Size().value();
+            // Slot is used while it ends before the end of the page
+            capacity_ = (mem::kPageSize - sizeof(mem::Page) - 1) / row_size_;
+        }
+        if (!SupportsColumns(node_class)) {
+            if (columnar_) {
+                throw error::TypeError("Class can't be placed in columns: " + node_class->Name());
+            }
+            return;
+        }
+        CollectColumns(node_class, util::Is<ts::StructClass>(node_class) ? "" : node_class->Name());
+        ids_start_ = static_cast<mem::PageOffset>(sizeof(mem::Page) +
+                                                  capacity_ * sizeof(mem::Magic));
+        auto start = ids_start_ + capacity_ * sizeof(ts::ObjectId);
+        auto row_offset = sizeof(mem::Magic) + sizeof(ts::ObjectId);
+        for (auto& column : columns_) {
+            column.start = static_cast<mem::PageOffset>(start);
+            column.row_offset = row_offset;
+            start += capacity_ * column.size;
+            row_offset += column.size;
+        }
+    }
+
+    // Columns hold primitive fields only, nested structs are flattened
+    [[nodiscard]] static bool SupportsColumns(const ts::Class::Ptr& node_class) {
+        if (util::Is<ts::StructClass>(node_class)) {
+            auto& fields = util::As<ts::StructClass>(node_class)->GetFields();
+            return std::all_of(fields.begin(), fields.end(),
+                               [](auto& field) { return SupportsColumns(field); });
+        }
+        return IsPrimitive(node_class);
+    }
+
+    [[nodiscard]] bool IsColumnar() const {
+        return columnar_;
+    }
+
+    [[nodiscard]] bool IsSlotted() const {
+        return slotted_;
+    }
+
+    // Node too large for a page is written to a chain of overflow pages, its record in the data
+    // page is a stub: the magic, the id, the head of the chain and the size of the node
+    static constexpr size_t kStubSize =
+        sizeof(mem::Magic) + sizeof(ts::ObjectId) + sizeof(mem::PageIndex) + sizeof(size_t);
+
+    [[nodiscard]] static std::pair<mem::PageIndex, size_t> ReadChain(mem::File::Ptr& file,
+                                                                     mem::Offset record) {
+        std::pair<mem::PageIndex, size_t> chain;
+        file->ReadFields(record + static_cast<mem::Offset>(sizeof(mem::Magic) +
+                                                           sizeof(ts::ObjectId)),
+                         chain.first, chain.second);
+        return chain;
+    }
+
+    // Slots beyond the capacity of the page are never written, free slot of a slotted page has
+    // no record
+    [[nodiscard]] mem::Magic ReadMagic(mem::File::Ptr& file, mem::Offset offset) const {
+        if (slotted_) {
+            auto slot = file->Read<mem::Slot>(offset);
+            return slot.size_ == 0 ? ~magic_
+                                   : file->Read<mem::Magic>(GetRecordOffset(offset, slot));
+        }
+        if (!columnar_) {
+            return file->Read<mem::Magic>(offset);
+        }
+        auto slot = GetSlot(offset);
+        return slot < capacity_ ? file->Read<mem::Magic>(GetMagicOffset(offset, slot)) : 0;
+    }
+
+    [[nodiscard]] ts::ObjectId ReadId(mem::File::Ptr& file, mem::Offset offset) const {
+        if (slotted_) {
+            offset = GetRecordOffset(offset, file->Read<mem::Slot>(offset));
+        }
+        if (!columnar_) {
+            return file->Read<ts::ObjectId>(offset + static_cast<mem::Offset>(sizeof(mem::Magic)));
+        }
+        return file->Read<ts::ObjectId>(GetIdOffset(offset, GetSlot(offset)));
+    }
+
+    [[nodiscard]] Node ReadNode(mem::File::Ptr& file, mem::Offset offset) const {
+        if (slotted_) {
+            auto slot = file->Read<mem::Slot>(offset);
+            if (slot.size_ == 0) {
+                return Node(magic_, ObjectState::kFree);
+            }
+            offset = GetRecordOffset(offset, slot);
+            if (slot.IsOverflow()) {
+                auto [head, size] = ReadChain(file, offset);
+                mem::File::Ptr chain = util::MakePtr<mem::OverflowFile>(file, head, size);
+                return Node(magic_, node_class_, chain, 0);
+            }
+        }
+        if (!columnar_) {
+            return Node(magic_, node_class_, file, offset);
+        }
+        auto magic = ReadMagic(file, offset);
+        auto slot = GetSlot(offset);
+        if (magic == magic_) {
+            auto data = DefaultObject(node_class_);
+            size_t column = 0;
+            ReadFields(file, data, offset, slot, column);
+            return Node(magic_, file->Read<ts::ObjectId>(GetIdOffset(offset, slot)), data);
+        } else if (magic == ~magic_) {
+            return Node(magic_, ObjectState::kFree,
+                        file->Read<mem::PageOffset>(GetIdOffset(offset, slot)));
+        }
+        return Node(magic_, ObjectState::kInvalid);
+    }
+
+    void WriteNode(mem::File::Ptr& file, const Node& node, mem::Offset offset) const {
+        if (slotted_) {
+            throw error::RuntimeError("Slotted nodes are placed by their storage");
+        }
+        if (!columnar_) {
+            node.Write(file, offset);
+            return;
+        }
+        auto slot = GetSlot(offset);
+        switch (node.State()) {
+            case ObjectState::kFree:
+                file->Write<mem::Magic>(~magic_, GetMagicOffset(offset, slot));
+                file->Write<mem::PageOffset>(node.NextFree(), GetIdOffset(offset, slot));
+                return;
+            case ObjectState::kValid: {
+                file->Write<mem::Magic>(magic_, GetMagicOffset(offset, slot));
+                file->Write<ts::ObjectId>(node.Id(), GetIdOffset(offset, slot));
+                size_t column = 0;
+                WriteFields(file, node.Data<ts::Object>(), offset, slot, column);
+                return;
+            }
+            default:
+                throw error::BadArgument("Trying to write invalid object");
+        }
+    }
+
+    [[nodiscard]] std::optional<size_t> FindColumn(const std::string& path) const {
+        auto it = std::find_if(columns_.begin(), columns_.end(),
+                               [&path](auto& column) { return column.path == path; });
+        if (it == columns_.end()) {
+            return std::nullopt;
+        }
+        return it - columns_.begin();
+    }
+
+    // Functor is called with the offset of every occupied slot among the first count slots of the
+    // page which code of the field lies in [from, to]. Only the minipage of the field is read
+    template <typename Functor>
+    void VisitColumnInRange(mem::File::Ptr& file, mem::PageIndex index, size_t column,
+                            size_t count, const std::vector<uint64_t>& occupied, uint64_t from,
+                            uint64_t to, Functor functor) const {
+        count = std::min(count, capacity_);
+        auto visit = [&](size_t slot, uint64_t key) {
+            if ((occupied[slot / 64] >> (slot % 64) & 1) != 0 && from <= key && key <= to) {
+                functor(mem::GetOffset(index, static_cast<mem::PageOffset>(
+                                                  sizeof(mem::Page) + slot * row_size_)));
+            }
+        };
+        auto& field_class = columns_[column].field_class;
+#define DDB_VISIT_PRIMITIVE(P)                           \
+    if (util::Is<ts::PrimitiveClass<P>>(field_class)) {  \
+        VisitKeys<P>(file, index, column, count, visit); \
+        return;                                          \
+    }
+        DDB_PRIMITIVE_GENERATOR(DDB_VISIT_PRIMITIVE)
+#undef DDB_VISIT_PRIMITIVE
+        throw error::TypeError("Field is not primitive");
+    }
+
+    [[nodiscard]] size_t GetRowSize() const {
+        return row_size_;
+    }
+
+    // Count of the slots of a page of a fixed size class
+    [[nodiscard]] size_t GetCapacity() const {
+        return capacity_;
+    }
+
+    [[nodiscard]] size_t GetSlot(mem::Offset offset) const {
+        auto in_page = offset - mem::GetPageAddress(mem::GetIndex(offset));
+        return (in_page - sizeof(mem::Page)) / row_size_;
+    }
+
+    // Count of the slots of the page written at least once
+    [[nodiscard]] size_t GetInitializedSlots(const mem::Page& page) const {
+        return std::min(capacity_, (page.initialized_offset_ - sizeof(mem::Page)) / row_size_);
+    }
+
+    [[nodiscard]] mem::Offset GetSlotOffset(mem::PageIndex index, size_t slot) const {
+        return mem::GetOffset(index, static_cast<mem::PageOffset>(sizeof(mem::Page) +
+                                                                 slot * row_size_));
+    }
+
+    // Bits of the initialized slots of the page which field lies in [from, to], free slots are
+    // masked by the storage. Values are gathered into an array, from their minipage in columns or
+    // from the nodes in rows, and compared a page at a time
+    template <typename P>
+    void Select(mem::File::Ptr& file, const mem::Page& page, size_t column, P from, P to,
+                std::vector<uint64_t>& bits) const {
+        // Vector of bools has no data to read into
+        using Stored = std::conditional_t<std::is_same_v<P, bool>, uint8_t, P>;
+        auto count = GetInitializedSlots(page);
+        std::vector<Stored> values(count);
+        if (columnar_) {
+            values = file->ReadVector<Stored>(mem::GetOffset(page.index_, columns_[column].start),
+                                              count);
+        } else {
+            auto body = file->ReadString(mem::GetOffset(page.index_, sizeof(mem::Page)),
+                                         count * row_size_);
+            for (size_t slot = 0; slot < count; ++slot) {
+                std::memcpy(&values[slot],
+                            body.data() + slot * row_size_ + columns_[column].row_offset,
+                            sizeof(Stored));
+            }
+        }
+        bits.resize((count + 63) / 64);
+        SelectBetween<Stored>(values.data(), count, static_cast<Stored>(from),
+                              static_cast<Stored>(to), bits.data());
+    }
+};
+
+}  // namespace db
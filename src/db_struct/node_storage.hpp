@@ -1,8 +1,21 @@
 #pragma once
 
+#include <optional>
+#include <ranges>
+
+#include "adjacency.hpp"
 #include "allocator.hpp"
+#include "bloom_filter.hpp"
 #include "class_storage.hpp"
+#include "hash_index.hpp"
+#include "id_directory.hpp"
+#include "index.hpp"
 #include "logger.hpp"
+#include "node.hpp"
+#include "node_layout.hpp"
+#include "occupancy.hpp"
+#include "page_directory.hpp"
+#include "zone_map.hpp"
 
 namespace db {
 
@@ -13,56 +26,319 @@ protected:
     ClassStorage::Ptr class_storage_;
     mem::PageAllocator::Ptr alloc_;
     mem::PageList data_page_list_;
+    // Data pages in the order of the list, a scan takes the pages from it instead of the links
+    PageDirectory pages_;
+    // Magic and index of the class, the id counter is read from the header cache
+    mem::ClassHeader header_;
+    // Placement of the nodes in the data pages, rows unless the class was added with columns
+    NodeLayout layout_;
+    IdDirectory directory_;
+    // Relations of the class by their from and to ends, only for relation classes
+    std::optional<Adjacency> outgoing_;
+    std::optional<Adjacency> incoming_;
+    // Meta pages of the B+tree and hash indexes are linked to the class header
+    mem::PageList index_list_;
+    std::vector<FieldIndex> indexes_;
+    mem::PageList hash_index_list_;
+    std::vector<HashIndex> hash_indexes_;
+    // Bounds of the primitive fields by data pages, only for fixed size classes
+    std::optional<ZoneMap> zones_;
+    // Filters of the string fields by data pages, only for variable size classes
+    std::optional<BloomFilters> filters_;
+    // Occupied slots by data pages, only for fixed size classes
+    std::optional<Occupancy> occupancy_;
+    // Overflow pages of the large nodes, only for variable size classes
+    mem::PageList overflow_list_;
 
     mem::Page AllocatePage() {
-        data_page_list_.PushBack(alloc_->AllocatePage());
-        DEBUG(mem::Page(data_page_list_.Back()));
-        auto page = ReadPage(mem::Page(data_page_list_.Back()), alloc_->GetFile());
-        page.type_ = mem::PageType::kData;
+        auto page = alloc_->AllocatePage(data_page_list_, mem::PageType::kData);
+        pages_.PushBack(page.index_);
         DEBUG(page);
-        return WritePage(page, alloc_->GetFile());
+        // Records of a variable size class grow down from the end of the page to its slots
+        if (layout_.IsSlotted()) {
+            page.free_offset_ = static_cast<mem::PageOffset>(mem::kPageSize);
+        }
+        return WritePage(page, alloc_->GetHeaders());
     }
 
     void FreePage(mem::PageIndex index) {
+        if (zones_.has_value()) {
+            zones_->Erase(index);
+        }
+        if (filters_.has_value()) {
+            filters_->Erase(index);
+        }
+        if (occupancy_.has_value()) {
+            occupancy_->Erase(index);
+        }
+        pages_.Erase(index);
         data_page_list_.Unlink(index);
         alloc_->FreePage(index);
     }
 
+    // Functor is called with the index of every data page at the positions [from, to) of the
+    // list which the predicate doesn't skip. Next pages are known from the directory, so they are
+    // loaded ahead of the functor by batches of the I/O depth
+    template <typename Skip, typename Functor>
+    void VisitDataPages(size_t from, size_t to, Skip skip, Functor functor) {
+        auto& file = alloc_->GetFile();
+        auto window = std::max<size_t>(file->GetIoDepth(), 1);
+        std::vector<mem::PageIndex> batch;
+        for (auto position = from; position < to;) {
+            batch.clear();
+            for (; position < to && batch.size() < window; ++position) {
+                if (!skip(pages_.Get(position))) {
+                    batch.push_back(pages_.Get(position));
+                }
+            }
+            if (window > 1) {
+                PrefetchPages(file, batch);
+            }
+            for (auto index : batch) {
+                functor(index);
+            }
+        }
+    }
+
     mem::Page GetBack() {
         if (data_page_list_.IsEmpty()) {
             return AllocatePage();
         } else {
-            return ReadPage(mem::Page(data_page_list_.Back()), alloc_->GetFile());
+            return ReadPage(mem::Page(data_page_list_.Back()), alloc_->GetHeaders());
         }
     }
 
+    void SetBack(const mem::Page& back) {
+        WritePage(back, alloc_->GetHeaders());
+    }
+
+    ts::ObjectId NextId() {
+        auto id = header_.ReadNodeId(alloc_->GetHeaders()).id_;
+        header_.WriteNodeId(alloc_->GetHeaders(), id + 1);
+        return id;
+    }
+
     mem::Page GetFront() {
         if (data_page_list_.IsEmpty()) {
             throw error::RuntimeError("No front");
         } else {
-            return ReadPage(mem::Page(data_page_list_.Front()), alloc_->GetFile());
+            return ReadPage(mem::Page(data_page_list_.Front()), alloc_->GetHeaders());
         }
     }
 
-    mem::ClassHeader GetHeader() {
-        auto index = class_storage_->FindClass(nodes_class_);
-        if (!index.has_value()) {
-            throw error::RuntimeError("No such class in class storage");
+    [[nodiscard]] const mem::ClassHeader& GetHeader() const {
+        return header_;
+    }
+
+    // Written node is put into the directory, the indexes and the summaries of its page and, if
+    // it is a relation, into the adjacency
+    void IndexNode(const Node& node, mem::Offset offset) {
+        directory_.Set(node.Id(), offset);
+        if (zones_.has_value()) {
+            zones_->Widen(mem::GetIndex(offset), node);
+        }
+        if (filters_.has_value()) {
+            filters_->Add(mem::GetIndex(offset), node);
+        }
+        if (outgoing_.has_value()) {
+            auto relation = node.Data<ts::Relation>();
+            outgoing_->Insert(relation->FromId(), relation->ToId(), node.Id());
+            incoming_->Insert(relation->ToId(), relation->FromId(), node.Id());
+        }
+        for (auto& index : indexes_) {
+            index.Insert(node);
         }
-        return mem::ClassHeader(index.value()).ReadClassHeader(alloc_->GetFile());
+        for (auto& index : hash_indexes_) {
+            index.Insert(node);
+        }
+    }
+
+    void UnindexNode(const Node& node) {
+        directory_.Erase(node.Id());
+        if (outgoing_.has_value()) {
+            auto relation = node.Data<ts::Relation>();
+            outgoing_->Erase(relation->FromId(), node.Id());
+            incoming_->Erase(relation->ToId(), node.Id());
+        }
+        for (auto& index : indexes_) {
+            index.Erase(node);
+        }
+        for (auto& index : hash_indexes_) {
+            index.Erase(node);
+        }
+    }
+
+    mem::PageIndex AllocateIndexMeta(mem::PageList& list, const std::string& path) {
+        if (FindIndex(path) != nullptr || FindHashIndex(path) != nullptr) {
+            throw error::RuntimeError("Index already exists: " + path);
+        }
+        auto meta = alloc_->AllocatePage();
+        list.PushBack(meta);
+        auto page = ReadPage(mem::Page(meta), alloc_->GetHeaders());
+        page.type_ = mem::PageType::kIndex;
+        WritePage(page, alloc_->GetHeaders());
+        return meta;
+    }
+
+    void FreeIndexMeta(mem::PageList& list, mem::PageIndex meta) {
+        list.Unlink(meta);
+        alloc_->FreePage(meta);
     }
 
 public:
+    using Ptr = util::Ptr<NodeStorage>;
+
     template <ts::ClassLike C>
     NodeStorage(const util::Ptr<C>& nodes_class, ClassStorage::Ptr& class_storage,
                 mem::PageAllocator::Ptr& alloc, DEFAULT_LOGGER(logger))
         : LOGGER(logger), nodes_class_(nodes_class), class_storage_(class_storage), alloc_(alloc) {
 
-        data_page_list_ = mem::PageList(nodes_class->Name(), alloc_->GetFile(),
-                                        GetHeader().GetNodeListSentinelOffset(), LOGGER);
+        auto index = class_storage_->FindClass(nodes_class_);
+        if (!index.has_value()) {
+            throw error::RuntimeError("No such class in class storage");
+        }
+        header_ = mem::ClassHeader(index.value()).ReadClassHeader(alloc_->GetHeaders());
+        layout_ = NodeLayout(nodes_class_, header_.magic_, header_.layout_);
+        data_page_list_ = mem::PageList(nodes_class->Name(), alloc_->GetHeaders(),
+                                        header_.GetNodeListSentinelOffset(), LOGGER);
+        pages_ = PageDirectory(nodes_class->Name() + "_Pages", alloc_,
+                               header_.GetListSentinelOffset(mem::ClassList::kPages), LOGGER);
+        directory_ = IdDirectory(nodes_class->Name() + "_Directory", alloc_,
+                                 header_.GetListSentinelOffset(mem::ClassList::kDirectory), LOGGER);
+        if (util::Is<ts::RelationClass>(nodes_class_)) {
+            outgoing_ = Adjacency(nodes_class->Name() + "_Outgoing", alloc_,
+                                  header_.GetListSentinelOffset(mem::ClassList::kOutgoingHeads),
+                                  header_.GetListSentinelOffset(mem::ClassList::kOutgoingEdges),
+                                  LOGGER);
+            incoming_ = Adjacency(nodes_class->Name() + "_Incoming", alloc_,
+                                  header_.GetListSentinelOffset(mem::ClassList::kIncomingHeads),
+                                  header_.GetListSentinelOffset(mem::ClassList::kIncomingEdges),
+                                  LOGGER);
+        }
+        index_list_ = mem::PageList(nodes_class->Name() + "_Indexes", alloc_->GetHeaders(),
+                                    header_.GetListSentinelOffset(mem::ClassList::kIndexes),
+                                    LOGGER);
+        for (auto& page : index_list_) {
+            indexes_.emplace_back(nodes_class_, alloc_, page.index_, LOGGER);
+        }
+        hash_index_list_ =
+            mem::PageList(nodes_class->Name() + "_Hash_Indexes", alloc_->GetHeaders(),
+                          header_.GetListSentinelOffset(mem::ClassList::kHashIndexes), LOGGER);
+        for (auto& page : hash_index_list_) {
+            hash_indexes_.emplace_back(nodes_class_, alloc_, page.index_, LOGGER);
+        }
+        if (nodes_class_->Size().has_value() && !util::Is<ts::RelationClass>(nodes_class_)) {
+            zones_ = ZoneMap(nodes_class_, alloc_,
+                             header_.GetListSentinelOffset(mem::ClassList::kZones), LOGGER);
+            if (zones_->IsEmpty()) {
+                zones_.reset();
+            }
+        }
+        if (nodes_class_->Size().has_value()) {
+            occupancy_ = Occupancy(nodes_class_, layout_.GetCapacity(), alloc_,
+                                   header_.GetListSentinelOffset(mem::ClassList::kOccupancy),
+                                   LOGGER);
+        }
+        overflow_list_ = mem::PageList(nodes_class->Name() + "_Overflow", alloc_->GetHeaders(),
+                                       header_.GetListSentinelOffset(mem::ClassList::kOverflow),
+                                       LOGGER);
+        if (!nodes_class_->Size().has_value() && !util::Is<ts::RelationClass>(nodes_class_)) {
+            filters_ = BloomFilters(nodes_class_, alloc_,
+                                    header_.GetListSentinelOffset(mem::ClassList::kFilters),
+                                    LOGGER);
+            if (filters_->IsEmpty()) {
+                filters_.reset();
+            }
+        }
+    }
+
+    [[nodiscard]] mem::PageIndex GetIndex() const {
+        return header_.index_;
+    }
+
+    [[nodiscard]] mem::Magic GetMagic() const {
+        return header_.magic_;
+    }
+
+    // Node is found by the directory and checked to still have the id, nullptr if there is none
+    [[nodiscard]] Node::Ptr GetNode(ts::ObjectId id) {
+        auto offset = directory_.Get(id);
+        if (offset == 0) {
+            return nullptr;
+        }
+        auto node = util::MakePtr<Node>(layout_.ReadNode(alloc_->GetFile(), offset));
+        if (node->State() != ObjectState::kValid || node->Id() != id) {
+            return nullptr;
+        }
+        return node;
+    }
+
+    [[nodiscard]] bool ContainsNode(ts::ObjectId id) {
+        return GetNode(id) != nullptr;
+    }
+
+    [[nodiscard]] FieldIndex* FindIndex(const std::string& path) {
+        auto it = std::find_if(indexes_.begin(), indexes_.end(),
+                               [&path](auto& index) { return index.GetPath() == path; });
+        return it == indexes_.end() ? nullptr : &*it;
+    }
+
+    [[nodiscard]] HashIndex* FindHashIndex(const std::string& path) {
+        auto it = std::find_if(hash_indexes_.begin(), hash_indexes_.end(),
+                               [&path](auto& index) { return index.GetPath() == path; });
+        return it == hash_indexes_.end() ? nullptr : &*it;
+    }
+
+    // Index is empty, nodes are added to it by the caller
+    FieldIndex& AddIndex(const std::string& path) {
+        FieldIndex::Validate(nodes_class_, path);
+        auto meta = AllocateIndexMeta(index_list_, path);
+        indexes_.push_back(FieldIndex::Create(nodes_class_, alloc_, meta, path, LOGGER));
+        return indexes_.back();
+    }
+
+    HashIndex& AddHashIndex(const std::string& path) {
+        HashIndex::Validate(nodes_class_, path);
+        auto meta = AllocateIndexMeta(hash_index_list_, path);
+        hash_indexes_.push_back(HashIndex::Create(nodes_class_, alloc_, meta, path, LOGGER));
+        return hash_indexes_.back();
+    }
+
+    void DropIndex(const std::string& path) {
+        if (auto index = FindIndex(path); index != nullptr) {
+            index->Drop();
+            FreeIndexMeta(index_list_, index->GetMeta());
+            indexes_.erase(indexes_.begin() + (index - indexes_.data()));
+        } else if (auto hash_index = FindHashIndex(path); hash_index != nullptr) {
+            hash_index->Drop();
+            FreeIndexMeta(hash_index_list_, hash_index->GetMeta());
+            hash_indexes_.erase(hash_indexes_.begin() + (hash_index - hash_indexes_.data()));
+        } else {
+            throw error::RuntimeError("No such index: " + path);
+        }
+    }
+
+    // Functor is called with the to end and the id of every relation from the node
+    template <typename Functor>
+    void VisitOutgoing(ts::ObjectId from, Functor functor) {
+        if (!outgoing_.has_value()) {
+            throw error::TypeError("Class is not a relation");
+        }
+        outgoing_->Visit(from, functor);
+    }
+
+    // Functor is called with the from end and the id of every relation to the node
+    template <typename Functor>
+    void VisitIncoming(ts::ObjectId to, Functor functor) {
+        if (!incoming_.has_value()) {
+            throw error::TypeError("Class is not a relation");
+        }
+        incoming_->Visit(to, functor);
     }
 
     void Drop() {
+        // Directory is dropped first, so the data pages are not erased from it one by one
+        pages_.Drop();
         std::vector<mem::PageIndex> indicies;
         for (auto& page : data_page_list_) {
             DEBUG("Freeing page: ", page);
@@ -71,6 +347,34 @@ public:
         for (auto index : indicies) {
             FreePage(index);
         }
+        indicies.clear();
+        for (auto& page : overflow_list_) {
+            indicies.push_back(page.index_);
+        }
+        for (auto index : indicies) {
+            overflow_list_.Unlink(index);
+            alloc_->FreePage(index);
+        }
+        directory_.Drop();
+        if (outgoing_.has_value()) {
+            outgoing_->Drop();
+            incoming_->Drop();
+        }
+        if (zones_.has_value()) {
+            zones_->Drop();
+        }
+        if (filters_.has_value()) {
+            filters_->Drop();
+        }
+        if (occupancy_.has_value()) {
+            occupancy_->Drop();
+        }
+        while (!indexes_.empty()) {
+            DropIndex(indexes_.back().GetPath());
+        }
+        while (!hash_indexes_.empty()) {
+            DropIndex(hash_indexes_.back().GetPath());
+        }
     }
 };
 
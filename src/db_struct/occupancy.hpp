@@ -0,0 +1,124 @@
+#pragma once
+
+#include <bit>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "page_records.hpp"
+
+namespace db {
+
+// Occupied slots of every data page of a fixed size class, bit i of the record of a page is set
+// while its slot i has a node. Bitmaps are mirrored in memory, so live nodes and holes of a page
+// are found by its words without reading the slots
+class Occupancy {
+    size_t words_ = 0;
+    PageRecords records_;
+
+    [[nodiscard]] static uint64_t Bit(size_t slot) {
+        return uint64_t{1} << (slot % 64);
+    }
+
+    size_t FindOrInsert(mem::PageIndex page) {
+        auto record = records_.Find(page);
+        return record.has_value() ? record.value() : records_.Insert(page);
+    }
+
+public:
+    Occupancy() {
+    }
+
+    Occupancy(const ts::Class::Ptr& node_class, size_t capacity, mem::PageAllocator::Ptr& alloc,
+              mem::Offset sentinel_offset, DEFAULT_LOGGER(logger))
+        : words_((capacity + 63) / 64),
+          records_(node_class->Name() + "_Occupancy", alloc, sentinel_offset, words_, logger) {
+    }
+
+    // Slots [from, from + count) of the page are taken
+    void Set(mem::PageIndex page, size_t from, size_t count = 1) {
+        auto record = FindOrInsert(page);
+        auto bits = records_.Words(record);
+        for (auto slot = from; slot < from + count; ++slot) {
+            bits[slot / 64] |= Bit(slot);
+        }
+        records_.Write(record);
+    }
+
+    void Reset(mem::PageIndex page, size_t slot) {
+        auto record = records_.Find(page);
+        if (!record.has_value()) {
+            return;
+        }
+        records_.Words(record.value())[slot / 64] &= ~Bit(slot);
+        records_.Write(record.value());
+    }
+
+    // First occupied slot of the page from the given one on
+    [[nodiscard]] std::optional<size_t> Next(mem::PageIndex page, size_t slot) const {
+        auto record = records_.Find(page);
+        if (!record.has_value()) {
+            return std::nullopt;
+        }
+        auto bits = records_.Words(record.value());
+        for (auto word = slot / 64; word < words_; ++word) {
+            auto rest = word == slot / 64 ? bits[word] & ~(Bit(slot) - 1) : bits[word];
+            if (rest != 0) {
+                return word * 64 + std::countr_zero(rest);
+            }
+        }
+        return std::nullopt;
+    }
+
+    // Last occupied slot of the page before the given one
+    [[nodiscard]] std::optional<size_t> Previous(mem::PageIndex page, size_t slot) const {
+        auto record = records_.Find(page);
+        if (!record.has_value()) {
+            return std::nullopt;
+        }
+        auto bits = records_.Words(record.value());
+        for (auto word = std::min(slot / 64 + 1, words_); word > 0; --word) {
+            auto rest = word - 1 == slot / 64 ? bits[word - 1] & (Bit(slot) - 1) : bits[word - 1];
+            if (rest != 0) {
+                return word * 64 - 1 - std::countl_zero(rest);
+            }
+        }
+        return std::nullopt;
+    }
+
+    // First free slot among the first count slots of the page
+    [[nodiscard]] std::optional<size_t> FindFree(mem::PageIndex page, size_t count) const {
+        auto record = records_.Find(page);
+        if (!record.has_value()) {
+            return count == 0 ? std::nullopt : std::optional<size_t>(0);
+        }
+        auto bits = records_.Words(record.value());
+        for (size_t word = 0; word * 64 < count; ++word) {
+            if (~bits[word] != 0) {
+                auto slot = word * 64 + std::countr_one(bits[word]);
+                return slot < count ? std::optional<size_t>(slot) : std::nullopt;
+            }
+        }
+        return std::nullopt;
+    }
+
+    // Bits of the selection are kept only for the occupied slots
+    void Mask(mem::PageIndex page, std::vector<uint64_t>& bits) const {
+        auto record = records_.Find(page);
+        for (size_t word = 0; word < bits.size(); ++word) {
+            bits[word] &= record.has_value() && word < words_ ? records_.Words(record.value())[word]
+                                                              : 0;
+        }
+    }
+
+    void Erase(mem::PageIndex page) {
+        records_.Erase(page);
+    }
+
+    void Drop() {
+        records_.Drop();
+    }
+};
+
+}  // namespace db
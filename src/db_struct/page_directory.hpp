@@ -0,0 +1,121 @@
+#pragma once
+
+#include <algorithm>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "allocator.hpp"
+#include "id_directory.hpp"
+#include "logger.hpp"
+
+namespace db {
+
+// Data pages of a class in the order of its node list, so the i-th page is found without walking
+// the list and the pages ahead of a scan are known. Entry of a data page is its index incremented,
+// zero entry is left by a freed page. Entries are kept in a dense directory linked to the class
+// header and mirrored in memory without the holes, they are rewritten once the holes outnumber the
+// pages
+class PageDirectory {
+    DECLARE_LOGGER;
+    DenseDirectory<mem::PageIndex> directory_;
+    std::vector<mem::PageIndex> data_pages_;
+    std::unordered_map<mem::PageIndex, size_t> entries_;
+    // Entries written so far, holes included
+    size_t entries_count_ = 0;
+
+public:
+    static constexpr size_t kEntriesPerPage = DenseDirectory<mem::PageIndex>::kEntriesPerPage;
+
+private:
+    void WriteEntry(mem::PageIndex data_page) {
+        directory_.Set(entries_count_, data_page + 1);
+        entries_[data_page] = entries_count_++;
+    }
+
+    // Entries are written again one after another, the pages left without entries are freed
+    void Compact() {
+        DEBUG("Compacting page directory, entries: ", entries_count_);
+        auto written = entries_count_;
+        entries_count_ = 0;
+        entries_.clear();
+        for (auto data_page : data_pages_) {
+            WriteEntry(data_page);
+        }
+        auto used = (entries_count_ + kEntriesPerPage - 1) / kEntriesPerPage;
+        for (auto entry = entries_count_; entry < std::min(written, used * kEntriesPerPage);
+             ++entry) {
+            directory_.Erase(entry);
+        }
+        directory_.Shrink(used);
+    }
+
+public:
+    PageDirectory() {
+    }
+
+    PageDirectory(const std::string& name, mem::PageAllocator::Ptr& alloc,
+                  mem::Offset sentinel_offset, DEFAULT_LOGGER(logger))
+        : LOGGER(logger), directory_(name, alloc, sentinel_offset, logger) {
+        directory_.Visit([this](size_t entry, mem::PageIndex value) {
+            entries_count_ = entry + 1;
+            entries_[value - 1] = entry;
+            data_pages_.push_back(value - 1);
+        });
+    }
+
+    [[nodiscard]] size_t GetPagesCount() const {
+        return data_pages_.size();
+    }
+
+    // Index of the data page at the position of the node list
+    [[nodiscard]] mem::PageIndex Get(size_t position) const {
+        return data_pages_[position];
+    }
+
+    [[nodiscard]] const std::vector<mem::PageIndex>& Pages() const {
+        return data_pages_;
+    }
+
+    // Data page is pushed back to the node list
+    void PushBack(mem::PageIndex data_page) {
+        WriteEntry(data_page);
+        data_pages_.push_back(data_page);
+    }
+
+    // Entry of the freed data page becomes a hole. Pages are freed much less often than scanned,
+    // so the pages in memory are shifted instead of keeping holes for the scans to skip
+    void Erase(mem::PageIndex data_page) {
+        auto it = entries_.find(data_page);
+        if (it == entries_.end()) {
+            return;
+        }
+        directory_.Erase(it->second);
+        entries_.erase(it);
+        std::erase(data_pages_, data_page);
+        if (entries_count_ > 2 * data_pages_.size() + kEntriesPerPage) {
+            Compact();
+        }
+    }
+
+    void Drop() {
+        directory_.Drop();
+        data_pages_.clear();
+        entries_.clear();
+        entries_count_ = 0;
+    }
+};
+
+// Pages are loaded into the cache as a hint, every run of adjacent ones by a single batch
+inline void PrefetchPages(mem::File::Ptr& file, const std::vector<mem::PageIndex>& pages) {
+    for (size_t first = 0; first < pages.size();) {
+        auto last = first + 1;
+        while (last < pages.size() && pages[last] == pages[last - 1] + 1) {
+            ++last;
+        }
+        file->Prefetch(mem::GetPageAddress(pages[first]), (last - first) * mem::kPageSize);
+        first = last;
+    }
+}
+
+}  // namespace db
@@ -0,0 +1,151 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "allocator.hpp"
+#include "logger.hpp"
+#include "pagelist.hpp"
+
+namespace db {
+
+// Records of the same size about data pages of a class. Record of a data page is its index,
+// incremented so that zero means a free record, followed by the words of the record. Records are
+// kept in pages linked to the class header and mirrored in memory
+class PageRecords {
+    DECLARE_LOGGER;
+    mem::PageAllocator::Ptr alloc_;
+    mem::PageList page_list_;
+    std::vector<mem::PageIndex> pages_;
+    size_t words_ = 0;
+    size_t records_per_page_ = 0;
+    std::vector<mem::PageIndex> owners_;
+    std::vector<uint64_t> data_;
+    std::unordered_map<mem::PageIndex, size_t> records_;
+    std::vector<size_t> free_records_;
+
+    [[nodiscard]] size_t GetRecordSize() const {
+        return sizeof(mem::PageIndex) + words_ * sizeof(uint64_t);
+    }
+
+    [[nodiscard]] mem::Offset GetRecordOffset(size_t record) const {
+        auto in_page = sizeof(mem::Page) + record % records_per_page_ * GetRecordSize();
+        return mem::GetOffset(pages_[record / records_per_page_],
+                              static_cast<mem::PageOffset>(in_page));
+    }
+
+    void AllocatePage() {
+        auto page = alloc_->AllocatePage(page_list_, mem::PageType::kIndex);
+        pages_.push_back(page.index_);
+        auto first = owners_.size();
+        owners_.resize(first + records_per_page_, 0);
+        data_.resize(owners_.size() * words_, 0);
+        for (auto record = owners_.size(); record > first; --record) {
+            free_records_.push_back(record - 1);
+        }
+        DEBUG("Records page allocated: ", page);
+    }
+
+public:
+    // Maximal count of words of a record
+    static constexpr size_t kMaxWords =
+        (mem::kPageSize - sizeof(mem::Page) - sizeof(mem::PageIndex)) / sizeof(uint64_t);
+
+    PageRecords() {
+    }
+
+    PageRecords(const std::string& name, mem::PageAllocator::Ptr& alloc,
+                mem::Offset sentinel_offset, size_t words, DEFAULT_LOGGER(logger))
+        : LOGGER(logger),
+          alloc_(alloc),
+          page_list_(name, alloc->GetHeaders(), sentinel_offset, logger),
+          words_(words),
+          records_per_page_((mem::kPageSize - sizeof(mem::Page)) /
+                            (sizeof(mem::PageIndex) + words * sizeof(uint64_t))) {
+        auto& file = alloc_->GetFile();
+        for (auto& page : page_list_) {
+            pages_.push_back(page.index_);
+        }
+        owners_.resize(pages_.size() * records_per_page_);
+        data_.resize(owners_.size() * words_);
+        for (auto record = owners_.size(); record > 0; --record) {
+            auto offset = GetRecordOffset(record - 1);
+            owners_[record - 1] = file->Read<mem::PageIndex>(offset);
+            if (owners_[record - 1] == 0) {
+                free_records_.push_back(record - 1);
+                continue;
+            }
+            records_[owners_[record - 1] - 1] = record - 1;
+            auto record_words = file->ReadVector<uint64_t>(
+                offset + static_cast<mem::Offset>(sizeof(mem::PageIndex)), words_);
+            std::copy(record_words.begin(), record_words.end(), Words(record - 1));
+        }
+    }
+
+    [[nodiscard]] std::vector<uint64_t>::iterator Words(size_t record) {
+        return data_.begin() + static_cast<ptrdiff_t>(record * words_);
+    }
+
+    [[nodiscard]] std::vector<uint64_t>::const_iterator Words(size_t record) const {
+        return data_.begin() + static_cast<ptrdiff_t>(record * words_);
+    }
+
+    [[nodiscard]] std::optional<size_t> Find(mem::PageIndex page) const {
+        auto it = records_.find(page);
+        if (it == records_.end()) {
+            return std::nullopt;
+        }
+        return it->second;
+    }
+
+    // Record of the page is taken from the free ones, its words are zero
+    size_t Insert(mem::PageIndex page) {
+        if (free_records_.empty()) {
+            AllocatePage();
+        }
+        auto record = free_records_.back();
+        free_records_.pop_back();
+        records_.emplace(page, record);
+        owners_[record] = page + 1;
+        std::fill(Words(record), Words(record + 1), 0);
+        return record;
+    }
+
+    void Write(size_t record) {
+        auto& file = alloc_->GetFile();
+        auto offset = GetRecordOffset(record);
+        file->Write<mem::PageIndex>(owners_[record], offset);
+        file->Write(data_, offset + static_cast<mem::Offset>(sizeof(mem::PageIndex)),
+                    record * words_, words_);
+    }
+
+    // Record of the freed page is released
+    void Erase(mem::PageIndex page) {
+        auto it = records_.find(page);
+        if (it == records_.end()) {
+            return;
+        }
+        owners_[it->second] = 0;
+        alloc_->GetFile()->Write<mem::PageIndex>(0, GetRecordOffset(it->second));
+        free_records_.push_back(it->second);
+        records_.erase(it);
+    }
+
+    void Drop() {
+        for (auto index : pages_) {
+            page_list_.Unlink(index);
+            alloc_->FreePage(index);
+        }
+        pages_.clear();
+        owners_.clear();
+        data_.clear();
+        records_.clear();
+        free_records_.clear();
+    }
+};
+
+}  // namespace db
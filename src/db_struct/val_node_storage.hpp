@@ -1,5 +1,7 @@
 #pragma once
 
+#include <future>
+
 #include "node.hpp"
 #include "node_storage.hpp"
 #include "pagelist.hpp"
@@ -16,6 +18,9 @@ namespace db {
  * Currently fixed but need to review it later cause I'm not sure that remade logic correct
  */
 
+// Slots of a page are initialized in order, page keeps the end of the initialized ones. Slots of
+// the nodes are marked in the occupancy, so iteration jumps over the free slots by the bitmaps and
+// insertion takes a hole of the back page before initializing a new slot
 class ValNodeStorage : public NodeStorage {
 
 public:
@@ -24,96 +29,73 @@ public:
         mem::Magic magic_;
         ts::Class::Ptr node_class_;
         mem::File::Ptr file_;
+        const NodeLayout* layout_;
+        const Occupancy* occupancy_;
         mem::PageList& page_list_;
 
-        mem::PageOffset inner_offset_;
         mem::PageList::PageIterator current_page_;
-
-        mem::Offset end_offset_;
+        size_t slot_;
 
         Node::Ptr curr_;
 
-        [[nodiscard]] mem::PageOffset InPageOffset() const noexcept {
-            return inner_offset_;
-        }
         [[nodiscard]] mem::PageList::PageIterator Page() const noexcept {
             return current_page_;
         }
 
-        [[nodiscard]] size_t GetNodesInPage() const {
-            return (mem::kPageSize - sizeof(mem::Page)) / Size();
-        }
-
-        [[nodiscard]] ts::ObjectId GetInPageIndex() const {
-            return (inner_offset_ - sizeof(mem::Page)) / Size();
-        }
-
     public:
         [[nodiscard]] size_t Size() const {
             return sizeof(mem::Magic) + sizeof(ts::ObjectId) + node_class_->Size().value();
         }
 
         [[nodiscard]] ts::ObjectId Id() {
-            return file_->Read<ts::ObjectId>(GetRealOffset() +
-                                             static_cast<mem::Offset>(sizeof(mem::Magic)));
+            return layout_->ReadId(file_, GetRealOffset());
         }
 
         [[nodiscard]] mem::Offset GetRealOffset() {
-            return mem::GetOffset(current_page_->index_, inner_offset_);
+            return layout_->GetSlotOffset(current_page_->index_, slot_);
         }
 
     private:
-        void RegenerateEnd() {
-            auto back = mem::ReadPage(mem::Page(page_list_.Back()), file_);
-            end_offset_ = mem::GetOffset(back.index_, back.initialized_offset_);
-        }
-
-        ObjectState State() {
-            auto magic = file_->Read<mem::Magic>(GetRealOffset());
-            if (magic == magic_) {
-                return ObjectState::kValid;
-            } else if (magic == ~magic_) {
-                return ObjectState::kFree;
-            } else {
-                return ObjectState::kInvalid;
-                // throw error::RuntimeError("Invalid iterator");
+        // Iterator stops at the first occupied slot from the current one on
+        void Settle() {
+            while (current_page_ != page_list_.End()) {
+                if (auto next = occupancy_->Next(current_page_->index_, slot_); next.has_value()) {
+                    slot_ = next.value();
+                    return;
+                }
+                ++current_page_;
+                slot_ = 0;
             }
         }
 
         void Advance() {
-            RegenerateEnd();
-            do {
-                if (GetRealOffset() >= end_offset_) {
-                    return;
-                }
-                if (GetInPageIndex() + 1 <= GetNodesInPage()) {
-                    inner_offset_ += Size();
-                } else {
-                    ++current_page_;
-                    inner_offset_ = sizeof(mem::Page);
-                }
-            } while (State() != ObjectState::kValid);
+            ++slot_;
+            Settle();
         }
 
+        // Iterator stays in place if there is no occupied slot before
         void Retreat() {
-            RegenerateEnd();
-            do {
-                if (page_list_.Front() == current_page_->index_ &&
-                    inner_offset_ == sizeof(mem::Page)) {
-                    return;
+            auto page = current_page_;
+            auto slot = slot_;
+            while (true) {
+                if (page != page_list_.End()) {
+                    if (auto previous = occupancy_->Previous(page->index_, slot);
+                        previous.has_value()) {
+                        current_page_ = page;
+                        slot_ = previous.value();
+                        return;
+                    }
                 }
-                if (GetInPageIndex() >= 1) {
-                    inner_offset_ -= Size();
-                } else {
-                    --current_page_;
-                    inner_offset_ = static_cast<mem::PageOffset>(Size() * (GetNodesInPage() - 1) +
-                                                                 sizeof(mem::Page));
+                if (page == page_list_.Begin()) {
+                    return;
                 }
-            } while (State() != ObjectState::kValid);
+                --page;
+                slot = layout_->GetCapacity();
+            }
         }
 
         void Read() {
-            curr_ = util::MakePtr<Node>(magic_, node_class_, file_, GetRealOffset());
+            curr_ = util::MakePtr<Node>(layout_->ReadNode(file_, GetRealOffset()));
         }
 
     public:
@@ -125,25 +107,17 @@ public:
         using reference = Node&;
 
         NodeIterator(mem::Magic magic, ts::Class::Ptr& node_class, mem::File::Ptr& file,
-                     mem::PageList& page_list, mem::PageList::PageIterator it,
-                     mem::PageOffset offset)
+                     const NodeLayout& layout, const Occupancy& occupancy,
+                     mem::PageList& page_list, mem::PageList::PageIterator it, size_t slot)
             : magic_(magic),
               node_class_(node_class),
               file_(file),
+              layout_(&layout),
+              occupancy_(&occupancy),
               page_list_(page_list),
-              inner_offset_(offset),
-              current_page_(it) {
-            if (!page_list_.IsEmpty()) {
-                RegenerateEnd();
-                while (State() == ObjectState::kFree) {
-                    Advance();
-                }
-                if (GetRealOffset() != end_offset_) {
-                    Read();
-                }
-            } else {
-                current_page_ = page_list_.End();
-            }
+              current_page_(it),
+              slot_(slot) {
+            Settle();
         }
         NodeIterator& operator++() {
             Advance();
@@ -178,7 +152,7 @@ public:
             if (current_page_ == page_list_.End() && current_page_ == other.current_page_) {
                 return true;
             } else {
-                return current_page_ == other.current_page_ && inner_offset_ == other.inner_offset_;
+                return current_page_ == other.current_page_ && slot_ == other.slot_;
             }
         }
         bool operator!=(const NodeIterator& other) const {
@@ -194,91 +168,119 @@ public:
     }
 
     NodeIterator Begin() {
-        return NodeIterator(GetHeader().magic_, nodes_class_, alloc_->GetFile(), data_page_list_,
-                            data_page_list_.Begin(), sizeof(mem::Page));
+        return NodeIterator(GetHeader().magic_, nodes_class_, alloc_->GetFile(), layout_,
+                            occupancy_.value(), data_page_list_, data_page_list_.Begin(), 0);
     }
 
     NodeIterator End() {
-        return NodeIterator(GetHeader().magic_, nodes_class_, alloc_->GetFile(), data_page_list_,
-                            data_page_list_.IteratorTo(GetBack().index_),
-                            GetBack().initialized_offset_);
+        return NodeIterator(GetHeader().magic_, nodes_class_, alloc_->GetFile(), layout_,
+                            occupancy_.value(), data_page_list_, data_page_list_.End(), 0);
     }
 
 private:
-    template <ts::ObjectLike O>
-    ts::ObjectId WrtiteIntoFree(mem::Page& back, mem::ClassHeader& header, Node& next_free,
-                                util::Ptr<O>& node) {
-        DEBUG("Back in free ", back);
-        auto id = header.ReadNodeId(alloc_->GetFile()).id_;
-        DEBUG("Rewrited id: ", id);
-        DEBUG("Found free space: ", next_free.NextFree());
-        auto metaobject = Node(header.ReadMagic(alloc_->GetFile()).magic_, id, node);
-        metaobject.Write(alloc_->GetFile(), mem::GetOffset(back.index_, back.free_offset_));
-        back.free_offset_ = next_free.NextFree();
-        back.actual_size_ += metaobject.Size();
-        return metaobject.Id();
+    void CheckSize() const {
+        if (layout_.GetRowSize() + sizeof(mem::Page) >= mem::kPageSize) {
+            throw error::NotImplemented("Too big Object");
+        }
     }
 
+    // Node takes the slot, the page is updated by the caller
     template <ts::ObjectLike O>
-    ts::ObjectId WriteIntoInvalid(mem::Page& back, mem::ClassHeader& header, util::Ptr<O>& node) {
-        DEBUG("Back in invalid ", back);
-        auto id = header.ReadNodeId(alloc_->GetFile()).id_;
-        auto metaobject = Node(header.ReadMagic(alloc_->GetFile()).magic_, id, node);
-        if (back.initialized_offset_ + metaobject.Size() >= mem::kPageSize) {
-            DEBUG("Allocation");
-            AllocatePage();
-            back = GetBack();
-        }
-        DEBUG("Initializing new memory on id: ", id,
-              ", offset: ", mem::GetOffset(back.index_, back.initialized_offset_));
-
-        metaobject.Write(alloc_->GetFile(), mem::GetOffset(back.index_, back.free_offset_));
-        back.free_offset_ += metaobject.Size();
-        back.initialized_offset_ += metaobject.Size();
-        back.actual_size_ += metaobject.Size();
+    ts::ObjectId WriteIntoSlot(mem::Page& page, size_t slot, const util::Ptr<O>& node) {
+        auto metaobject = Node(header_.magic_, NextId(), node);
+        auto offset = layout_.GetSlotOffset(page.index_, slot);
+        DEBUG("Writing node with id: ", metaobject.Id(), ", offset: ", offset);
+        layout_.WriteNode(alloc_->GetFile(), metaobject, offset);
+        IndexNode(metaobject, offset);
+        page.actual_size_ += metaobject.Size();
         return metaobject.Id();
     }
 
+    // Slot of the node is marked free, returns whether the page has no nodes left
+    bool FreeNode(Node node, mem::Offset offset) {
+        auto index = mem::GetIndex(offset);
+        auto page = mem::ReadPage(mem::Page(index), alloc_->GetHeaders());
+
+        UnindexNode(node);
+        page.actual_size_ -= node.Size();
+        node.Free(0);
+        layout_.WriteNode(alloc_->GetFile(), node, offset);
+        occupancy_->Reset(index, layout_.GetSlot(offset));
+        DEBUG("Node: ", node.ToString());
+        DEBUG("Page: ", page);
+        mem::WritePage(page, alloc_->GetHeaders());
+        return page.actual_size_ == 0;
+    }
+
 public:
     template <ts::ObjectLike O>
     requires(!std::is_same_v<O, ts::ClassObject>) void AddNode(util::Ptr<O>& node) {
-
-        if (node->Size() + sizeof(mem::Magic) + sizeof(ts::ObjectId) + sizeof(mem::Page) >=
-            mem::kPageSize) {
-            throw error::NotImplemented("Too big Object");
-        }
+        CheckSize();
 
         INFO("Addding node: ", node->ToString());
-        auto header = GetHeader();
         auto back = GetBack();
-        auto next_free = Node(header.ReadMagic(alloc_->GetFile()).magic_, nodes_class_,
-                              alloc_->GetFile(), mem::GetOffset(back.index_, back.free_offset_));
-        DEBUG("Free: ", next_free.ToString());
-
-        ts::ObjectId id;
-        switch (next_free.State()) {
-            case ObjectState::kFree: {
-                // if (back.initialized_offset_ == back.free_offset_) {
-                //     id = WriteIntoInvalid(back, header, node);
-                // } else {
-                // BUG: Need to generate magics for class;
-                id = WrtiteIntoFree(back, header, next_free, node);
-                // }
-            } break;
-            case ObjectState::kInvalid: {
-                id = WriteIntoInvalid(back, header, node);
-            } break;
-            case ObjectState::kValid:
-                throw error::RuntimeError("Already occupied memory");
-            default:
-                break;
+        auto slot = occupancy_->FindFree(back.index_, layout_.GetInitializedSlots(back));
+        if (!slot.has_value()) {
+            if (back.initialized_offset_ + layout_.GetRowSize() >= mem::kPageSize) {
+                DEBUG("Allocation");
+                back = AllocatePage();
+            }
+            slot = layout_.GetInitializedSlots(back);
+            back.initialized_offset_ += layout_.GetRowSize();
         }
+        auto id = WriteIntoSlot(back, slot.value(), node);
+        occupancy_->Set(back.index_, slot.value());
         INFO("Successfully added node with id: ", id);
 
-        mem::WritePage(back, alloc_->GetFile());
+        SetBack(back);
         DEBUG("Back ", back);
-        header.WriteNodeId(alloc_->GetFile(), ++header.ReadNodeId(alloc_->GetFile()).id_);
-        DEBUG("Id: ", GetHeader().id_);
+    }
+
+    // Holes of the back page are filled one by one, the rest of nodes are appended page by page:
+    // every page is filled in memory and written by a single call with its header
+    template <std::ranges::input_range R>
+    void AddNodes(R&& nodes) {
+        CheckSize();
+        auto node_size = layout_.GetRowSize();
+        auto& file = alloc_->GetFile();
+        auto it = std::ranges::begin(nodes);
+        auto end = std::ranges::end(nodes);
+        while (it != end) {
+            auto back = GetBack();
+            auto first = layout_.GetInitializedSlots(back);
+            if (occupancy_->FindFree(back.index_, first).has_value()) {
+                auto node = *it;
+                AddNode(node);
+                ++it;
+                continue;
+            }
+            if (back.initialized_offset_ + node_size >= mem::kPageSize) {
+                AllocatePage();
+                continue;
+            }
+
+            // Minipages of the columns are spread over the page, the whole body is staged with
+            // the nodes it already has
+            auto staged_from = layout_.IsColumnar() ? sizeof(mem::Page) : back.initialized_offset_;
+            auto body = layout_.IsColumnar()
+                            ? file->ReadString(mem::GetOffset(back.index_, sizeof(mem::Page)),
+                                               mem::kPageSize - sizeof(mem::Page))
+                            : std::string();
+            auto staged = mem::StagedWrite(
+                file, mem::GetOffset(back.index_, static_cast<mem::PageOffset>(staged_from)),
+                mem::kPageSize - staged_from);
+            if (!body.empty()) {
+                file->Write(body, mem::GetOffset(back.index_, sizeof(mem::Page)));
+            }
+            auto slot = first;
+            for (; it != end && back.initialized_offset_ + node_size < mem::kPageSize; ++it) {
+                WriteIntoSlot(back, slot++, *it);
+                back.initialized_offset_ += node_size;
+            }
+            staged.Commit();
+            occupancy_->Set(back.index_, first, slot - first);
+            SetBack(back);
+        }
     }
 
     template <typename Predicate, typename Functor>
@@ -297,6 +299,109 @@ public:
         }
     }
 
+    // Pages which bounds of the field miss [from, to] are skipped without reading their nodes,
+    // nodes of the other pages are checked by the functor. In columns only the minipage of the
+    // field is scanned and the functor gets just the nodes in the range
+    template <typename Functor>
+    void VisitNodesInRange(const std::string& path, uint64_t from, uint64_t to, Functor functor) {
+        auto field = zones_.has_value() ? zones_->FindField(path) : std::nullopt;
+        auto column = layout_.IsColumnar() ? layout_.FindColumn(path) : std::nullopt;
+        auto& file = alloc_->GetFile();
+        auto end = End();
+        auto skip = [this, &field, from, to](mem::PageIndex index) {
+            return field.has_value() && zones_->Misses(index, field.value(), from, to);
+        };
+        VisitDataPages(0, pages_.GetPagesCount(), skip, [&](mem::PageIndex index) {
+            if (column.has_value()) {
+                auto header = mem::ReadPage(mem::Page(index), alloc_->GetHeaders());
+                auto count = layout_.GetInitializedSlots(header);
+                auto occupied = std::vector<uint64_t>((count + 63) / 64, ~uint64_t{0});
+                occupancy_->Mask(index, occupied);
+                layout_.VisitColumnInRange(file, index, column.value(), count, occupied, from, to,
+                                           [this, &file, &functor](mem::Offset offset) {
+                                               functor(util::MakePtr<Node>(
+                                                   layout_.ReadNode(file, offset)));
+                                           });
+                return;
+            }
+            auto node_it =
+                NodeIterator(header_.magic_, nodes_class_, file, layout_, occupancy_.value(),
+                             data_page_list_, data_page_list_.IteratorTo(index), 0);
+            for (; node_it != end && node_it.Page()->index_ == index; ++node_it) {
+                functor(util::MakePtr<Node>(*node_it));
+            }
+        });
+    }
+
+    // Functor is called with the selection of the nodes with the field in [from, to] of every
+    // page the zone map doesn't skip, in the order of the pages. Values are compared a page at a
+    // time, nodes are not built. Pages may be split between several threads by the directory,
+    // the functor is called by the calling thread anyway
+    template <typename P, typename Functor>
+    void VisitSelections(const std::string& path, P from, P to, Functor functor,
+                         size_t threads = 1) {
+        auto column = layout_.FindColumn(path);
+        if (!column.has_value()) {
+            throw error::TypeError("Field can't be filtered: " + path);
+        }
+        auto field = zones_.has_value() ? zones_->FindField(path) : std::nullopt;
+        auto& file = alloc_->GetFile();
+        auto skip = [this, &field, from, to](mem::PageIndex index) {
+            return field.has_value() &&
+                   zones_->Misses(index, field.value(), EncodeKey<P>(from), EncodeKey<P>(to));
+        };
+        auto select = [this, &file, &column, from, to](const mem::Page& header) {
+            auto selection = Selection{header.index_, {}};
+            layout_.Select<P>(file, header, column.value(), from, to, selection.bits);
+            occupancy_->Mask(header.index_, selection.bits);
+            return selection;
+        };
+        if (threads <= 1) {
+            VisitDataPages(0, pages_.GetPagesCount(), skip, [&](mem::PageIndex index) {
+                functor(select(mem::ReadPage(mem::Page(index), alloc_->GetHeaders())));
+            });
+            return;
+        }
+        // Header cache is not thread safe, so the cached headers are taken beforehand. Headers
+        // out of the cache are not changed since they were written and are read from the file
+        std::vector<std::pair<mem::PageIndex, std::optional<mem::Page>>> pages;
+        for (auto index : pages_.Pages()) {
+            if (skip(index)) {
+                continue;
+            }
+            auto address = mem::GetPageAddress(index);
+            pages.emplace_back(index, alloc_->GetHeaders()->Contains(address)
+                                          ? std::optional(alloc_->GetHeaders()->Read<mem::Page>(
+                                                address))
+                                          : std::nullopt);
+        }
+        auto part = (pages.size() + threads - 1) / threads;
+        std::vector<std::future<std::vector<Selection>>> parts;
+        for (size_t first = 0; first < pages.size(); first += part) {
+            parts.push_back(std::async(std::launch::async, [&, first]() {
+                std::vector<Selection> selections;
+                for (auto i = first; i < std::min(first + part, pages.size()); ++i) {
+                    auto& [index, header] = pages[i];
+                    selections.push_back(select(header.has_value()
+                                                    ? header.value()
+                                                    : file->Read<mem::Page>(
+                                                          mem::GetPageAddress(index))));
+                }
+                return selections;
+            }));
+        }
+        for (auto& part_selections : parts) {
+            for (auto& selection : part_selections.get()) {
+                functor(selection);
+            }
+        }
+    }
+
+    [[nodiscard]] Node::Ptr ReadSlot(mem::PageIndex index, size_t slot) {
+        return util::MakePtr<Node>(
+            layout_.ReadNode(alloc_->GetFile(), layout_.GetSlotOffset(index, slot)));
+    }
+
     template <typename Predicate>
     requires std::is_invocable_r_v<bool, Predicate, NodeIterator>
     void RemoveNodesIf(Predicate predicate) {
@@ -308,21 +413,9 @@ public:
         for (auto node_it = Begin(); node_it != end; ++node_it) {
             if (predicate(node_it)) {
                 DEBUG("Removing node ", node_it.Id());
-                auto page = mem::ReadPage(*node_it.Page(), alloc_->GetFile());
-                auto node = *node_it;
-
-                page.actual_size_ -= node.Size();
-                node.Free(page.free_offset_);
-                node.Write(alloc_->GetFile(),
-                           mem::GetOffset(node_it.Page()->index_, node_it.InPageOffset()));
-                DEBUG("Node: ", node.ToString());
-                page.free_offset_ = node_it.InPageOffset();
-                DEBUG("Page: ", page);
-                mem::WritePage(page, alloc_->GetFile());
-
-                if (page.actual_size_ == 0) {
-                    INFO("Deallocated page", page);
-                    free_pages.push_back(page.index_);
+                if (FreeNode(*node_it, node_it.GetRealOffset())) {
+                    INFO("Deallocated page", node_it.Page()->index_);
+                    free_pages.push_back(node_it.Page()->index_);
                 }
                 // ++count;
             }
@@ -334,5 +427,19 @@ public:
         // auto header = GetHeader();
         // header.WriteNodeCount(alloc_->GetFile(), header.nodes_ - count);
     }
+
+    bool RemoveNode(ts::ObjectId id) {
+        auto node = GetNode(id);
+        if (node == nullptr) {
+            return false;
+        }
+        DEBUG("Removing node ", id);
+        auto offset = directory_.Get(id);
+        if (FreeNode(*node, offset)) {
+            INFO("Deallocated page", mem::GetIndex(offset));
+            FreePage(mem::GetIndex(offset));
+        }
+        return true;
+    }
 };
 }  // namespace db
\ No newline at end of file
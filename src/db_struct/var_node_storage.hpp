@@ -1,10 +1,20 @@
 #pragma once
 
+#include <algorithm>
+#include <map>
+#include <vector>
+
 #include "node.hpp"
 #include "node_storage.hpp"
 
 namespace db {
 
+// Pages of variable size nodes are slotted: the slot array grows from the page header and the
+// records grow down from the end of the page. Page keeps the end of the slot array as initialized
+// offset, the beginning of the records as free offset and the size of the records as actual size.
+// Nodes are addressed by their slots, so the records are compacted on removal and the space
+// between the slots and the records is the whole free space of the page. Nodes larger than a
+// quarter of a page are written to chains of overflow pages, their records are stubs of the chains
 class VarNodeStorage : public NodeStorage {
 
 public:
@@ -13,76 +23,57 @@ public:
         mem::Magic magic_;
         ts::Class::Ptr node_class_;
         mem::File::Ptr file_;
+        const NodeLayout* layout_;
         mem::PageList& page_list_;
 
-        mem::PageOffset inner_offset_;
         mem::PageList::PageIterator current_page_;
-
-        mem::Offset end_offset_;
+        size_t slot_;
 
         Node::Ptr curr_;
 
     public:
         [[nodiscard]] ts::ObjectId Id() {
-            return file_->Read<ts::ObjectId>(GetRealOffset() +
-                                             static_cast<mem::Offset>(sizeof(mem::Magic)));
+            return layout_->ReadId(file_, GetRealOffset());
         }
+        // Offset of the slot of the node
         [[nodiscard]] mem::Offset GetRealOffset() {
-            return mem::GetOffset(current_page_->index_, inner_offset_);
+            return mem::GetOffset(current_page_->index_, GetSlotOffset(slot_));
         }
 
     private:
-        [[nodiscard]] mem::PageOffset InPageOffset() const noexcept {
-            return inner_offset_;
-        }
         [[nodiscard]] mem::PageList::PageIterator Page() const noexcept {
             return current_page_;
         }
 
-        void RegenerateEnd() {
-            auto back = mem::ReadPage(mem::Page(page_list_.Back()), file_);
-            end_offset_ = mem::GetOffset(back.index_, back.free_offset_);
-        }
-
-        ObjectState State() {
-            auto magic = file_->Read<mem::Magic>(GetRealOffset());
-            if (magic == magic_) {
-                return ObjectState::kValid;
-            } else if (magic == ~magic_) {
-                return ObjectState::kFree;
-            } else {
-                return ObjectState::kInvalid;
-                // throw error::RuntimeError("Invalid iterator");
-            }
+        // Slots are counted by the header in the cache, the page iterator keeps a copy
+        [[nodiscard]] size_t GetSlotsCount() {
+            auto page = mem::ReadPage(mem::Page(current_page_->index_), page_list_.GetHeaders());
+            return (page.initialized_offset_ - sizeof(mem::Page)) / sizeof(mem::Slot);
         }
 
         void Read() {
-            curr_ = util::MakePtr<Node>(magic_, node_class_, file_, GetRealOffset());
+            curr_ = util::MakePtr<Node>(layout_->ReadNode(file_, GetRealOffset()));
         }
 
-        void Advance() {
-            if (State() == ObjectState::kValid) {
-                inner_offset_ += curr_->Size();
-            }
-            while (State() != ObjectState::kValid) {
-                if (GetRealOffset() >= end_offset_) {
-                    return;
-                }
-                auto offset = file_->Read<mem::PageOffset>(
-                    GetRealOffset() + static_cast<mem::PageOffset>(sizeof(mem::Magic)));
-                // offset == 0
-                if (State() == ObjectState::kInvalid) {
-                    ++current_page_;
-                    inner_offset_ = current_page_->initialized_offset_;
-                } else {
-                    inner_offset_ = offset;
+        // Iterator stops at the first valid node from the current slot on
+        void Settle() {
+            while (current_page_ != page_list_.End()) {
+                for (auto count = GetSlotsCount(); slot_ < count; ++slot_) {
+                    if (layout_->ReadMagic(file_, GetRealOffset()) == magic_) {
+                        Read();
+                        return;
+                    }
                 }
-            }
-            if (State() == ObjectState::kValid) {
-                Read();
+                ++current_page_;
+                slot_ = 0;
             }
         }
 
+        void Advance() {
+            ++slot_;
+            Settle();
+        }
+
     public:
         friend VarNodeStorage;
         using iterator_category = std::forward_iterator_tag;
@@ -92,24 +83,16 @@ public:
         using reference = Node&;
 
         NodeIterator(mem::Magic magic, ts::Class::Ptr& node_class, mem::File::Ptr& file,
-                     mem::PageList& page_list, mem::PageIndex index, mem::PageOffset inner_offset)
+                     const NodeLayout& layout, mem::PageList& page_list,
+                     mem::PageList::PageIterator it, size_t slot)
             : magic_(magic),
               node_class_(node_class),
               file_(file),
+              layout_(&layout),
               page_list_(page_list),
-              inner_offset_(inner_offset),
-              current_page_(page_list.IteratorTo(index)) {
-
-            if (!page_list_.IsEmpty()) {
-                RegenerateEnd();
-                Read();
-                while (State() == ObjectState::kFree) {
-                    Advance();
-                }
-
-            } else {
-                current_page_ = page_list_.End();
-            }
+              current_page_(it),
+              slot_(slot) {
+            Settle();
         }
 
         NodeIterator& operator++() {
@@ -133,7 +116,7 @@ public:
             if (current_page_ == page_list_.End() && current_page_ == other.current_page_) {
                 return true;
             } else {
-                return current_page_ == other.current_page_ && inner_offset_ == other.inner_offset_;
+                return current_page_ == other.current_page_ && slot_ == other.slot_;
             }
         }
         bool operator!=(const NodeIterator& other) const {
@@ -149,54 +132,235 @@ public:
     }
 
     NodeIterator Begin() {
-        return NodeIterator(GetHeader().magic_, nodes_class_, alloc_->GetFile(), data_page_list_,
-                            GetFront().index_, GetFront().initialized_offset_);
+        return NodeIterator(GetHeader().magic_, nodes_class_, alloc_->GetFile(), layout_,
+                            data_page_list_, data_page_list_.Begin(), 0);
     }
 
     NodeIterator End() {
-        return NodeIterator(GetHeader().magic_, nodes_class_, alloc_->GetFile(), data_page_list_,
-                            GetBack().index_, GetBack().free_offset_);
+        return NodeIterator(GetHeader().magic_, nodes_class_, alloc_->GetFile(), layout_,
+                            data_page_list_, data_page_list_.End(), 0);
     }
 
 private:
-    mem::Offset GetNewNodeOffset(size_t node_size) {
+    // Pages which nodes were removed during the session with their free space, they are filled
+    // before a new page is allocated. Pages with less space are forgotten
+    static constexpr size_t kMinSpareSpace = mem::kPageSize / 16;
+    std::map<mem::PageIndex, size_t> spare_pages_;
+
+    [[nodiscard]] static mem::PageOffset GetSlotOffset(size_t slot) {
+        return static_cast<mem::PageOffset>(sizeof(mem::Page) + slot * sizeof(mem::Slot));
+    }
+
+    [[nodiscard]] static size_t GetFreeSpace(const mem::Page& page) {
+        return page.free_offset_ - page.initialized_offset_;
+    }
+
+    // Larger nodes are kept in overflow pages, so a data page holds at least a few records
+    static constexpr size_t kMaxInlineRecord = mem::kPageSize / 4;
+
+    // Size of the record of a node in its data page
+    [[nodiscard]] static size_t GetRecordSize(size_t data_size) {
+        auto size = data_size + sizeof(mem::Magic) + sizeof(ts::ObjectId);
+        return size > kMaxInlineRecord ? NodeLayout::kStubSize : size;
+    }
+
+    [[nodiscard]] std::vector<mem::Slot> ReadSlots(const mem::Page& page) {
+        return alloc_->GetFile()->ReadVector<mem::Slot>(
+            mem::GetOffset(page.index_, sizeof(mem::Page)),
+            (page.initialized_offset_ - sizeof(mem::Page)) / sizeof(mem::Slot));
+    }
+
+    void UpdateSpare(const mem::Page& page) {
+        if (GetFreeSpace(page) >= kMinSpareSpace) {
+            spare_pages_[page.index_] = GetFreeSpace(page);
+        } else {
+            spare_pages_.erase(page.index_);
+        }
+    }
+
+    // Page for a record with a new slot: the back page, a spare one or a new back page
+    mem::Page FindPage(size_t record_size) {
         auto back = GetBack();
-        if (back.free_offset_ + node_size >= mem::kPageSize) {
-            DEBUG("Allocation");
-            // Maybe should think about the case | valid | new | -> | free | new |
+        if (GetFreeSpace(back) >= record_size + sizeof(mem::Slot)) {
+            return back;
+        }
+        for (auto& [index, space] : spare_pages_) {
+            if (space >= record_size + sizeof(mem::Slot)) {
+                return mem::ReadPage(mem::Page(index), alloc_->GetHeaders());
+            }
+        }
+        DEBUG("Allocation");
+        return AllocatePage();
+    }
 
-            AllocatePage();
-            back = GetBack();
+    // Node is written to a new chain of overflow pages, returns its head
+    mem::PageIndex WriteChain(const Node& node) {
+        std::vector<mem::PageIndex> pages(mem::GetOverflowPagesCount(node.Size()));
+        for (auto& index : pages) {
+            index = alloc_->AllocatePage();
+            overflow_list_.PushBack(index);
+            auto page = mem::ReadPage(mem::Page(index), alloc_->GetHeaders());
+            page.type_ = mem::PageType::kOverflow;
+            mem::WritePage(page, alloc_->GetHeaders());
         }
-        return mem::GetOffset(back.index_, back.free_offset_);
+        mem::File::Ptr chain =
+            util::MakePtr<mem::OverflowFile>(alloc_->GetFile(), pages, node.Size());
+        node.Write(chain, 0);
+        DEBUG("Overflow chain of ", pages.size(), " pages from ", pages.front());
+        return pages.front();
     }
 
-public:
-    template <ts::ObjectLike O>
-    requires(!std::is_same_v<O, ts::ClassObject>) void AddNode(util::Ptr<O>& node) {
+    void FreeChain(mem::PageIndex head) {
+        while (head != mem::kSentinelIndex) {
+            auto next =
+                alloc_->GetFile()->Read<mem::PageIndex>(mem::GetOffset(head, sizeof(mem::Page)));
+            overflow_list_.Unlink(head);
+            alloc_->FreePage(head);
+            head = next;
+        }
+    }
 
-        if (node->Size() + sizeof(mem::Magic) + sizeof(ts::ObjectId) + sizeof(mem::Page) >=
-            mem::kPageSize) {
-            throw error::NotImplemented("Too big Object");
+    // Record is put under the others, the slot is a free one of a spare page or a new one.
+    // Returns the offset of the slot
+    mem::Offset PlaceNode(mem::Page& page, const Node& node) {
+        auto slot = (page.initialized_offset_ - sizeof(mem::Page)) / sizeof(mem::Slot);
+        if (spare_pages_.contains(page.index_)) {
+            auto slots = ReadSlots(page);
+            slot = std::find_if(slots.begin(), slots.end(),
+                                [](const mem::Slot& other) { return other.size_ == 0; }) -
+                   slots.begin();
         }
+        if (GetSlotOffset(slot) == page.initialized_offset_) {
+            page.initialized_offset_ += sizeof(mem::Slot);
+        }
+        auto overflow = node.Size() > kMaxInlineRecord;
+        auto size = static_cast<mem::PageOffset>(overflow ? NodeLayout::kStubSize : node.Size());
+        page.free_offset_ -= size;
+        page.actual_size_ += size;
+        auto& file = alloc_->GetFile();
+        auto record = mem::GetOffset(page.index_, page.free_offset_);
+        if (overflow) {
+            file->WriteFields(record, header_.magic_, node.Id(), WriteChain(node), node.Size());
+        } else {
+            node.Write(file, record);
+        }
+        auto offset = mem::GetOffset(page.index_, GetSlotOffset(slot));
+        file->Write<mem::Slot>(
+            mem::Slot{page.free_offset_, overflow ? size | mem::Slot::kOverflow : size}, offset);
+        IndexNode(node, offset);
+        return offset;
+    }
 
-        INFO("Addding node: ", node->ToString());
-        auto id = GetHeader().ReadNodeId(alloc_->GetFile()).id_;
-        auto metaobject = Node(GetHeader().ReadMagic(alloc_->GetFile()).magic_, id, node);
-        auto node_offset = GetNewNodeOffset(metaobject.Size());
-        auto back = GetBack();
-        DEBUG("Initializing new memory on id: ", id, ", offset: ", node_offset);
+    // Records below the freed one move up by its size, so the free space stays in one piece.
+    // Free slots at the end of the array are dropped. Returns whether the page has no nodes left
+    bool FreeNode(Node node, mem::Offset offset) {
+        auto index = mem::GetIndex(offset);
+        auto page = mem::ReadPage(mem::Page(index), alloc_->GetHeaders());
+        auto& file = alloc_->GetFile();
+        auto slots = ReadSlots(page);
+        auto slot = (offset - mem::GetPageAddress(index) - sizeof(mem::Page)) / sizeof(mem::Slot);
+        auto freed = slots[slot];
+
+        UnindexNode(node);
+        if (freed.IsOverflow()) {
+            FreeChain(NodeLayout::ReadChain(file, mem::GetOffset(index, freed.offset_)).first);
+        }
+        if (freed.offset_ > page.free_offset_) {
+            auto moved = file->ReadString(mem::GetOffset(index, page.free_offset_),
+                                          freed.offset_ - page.free_offset_);
+            file->Write(moved, mem::GetOffset(index, page.free_offset_ + freed.Size()));
+            for (auto& other : slots) {
+                if (other.size_ != 0 && other.offset_ < freed.offset_) {
+                    other.offset_ += freed.Size();
+                }
+            }
+        }
+        slots[slot] = mem::Slot{0, 0};
+        auto used = slots.size();
+        while (used > 0 && slots[used - 1].size_ == 0) {
+            --used;
+        }
+        file->Write(slots, mem::GetOffset(index, sizeof(mem::Page)));
+        page.initialized_offset_ = GetSlotOffset(used);
+        page.free_offset_ += freed.Size();
+        page.actual_size_ -= freed.Size();
+        DEBUG("Page: ", page);
+        mem::WritePage(page, alloc_->GetHeaders());
+        UpdateSpare(page);
+        return page.actual_size_ == 0;
+    }
+
+    void ReleasePage(mem::PageIndex index) {
+        spare_pages_.erase(index);
+        FreePage(index);
+    }
+
+    // Filter of the compacted page is built again from the nodes left in it
+    void RebuildFilter(mem::PageIndex index) {
+        if (!filters_.has_value()) {
+            return;
+        }
+        std::vector<Node> nodes;
+        auto end = End();
+        auto node_it = NodeIterator(header_.magic_, nodes_class_, alloc_->GetFile(), layout_,
+                                    data_page_list_, data_page_list_.IteratorTo(index), 0);
+        for (; node_it != end && node_it.Page()->index_ == index; ++node_it) {
+            nodes.push_back(*node_it);
+        }
+        filters_->Rebuild(index, nodes);
+    }
 
-        metaobject.Write(alloc_->GetFile(), node_offset);
-        back.free_offset_ += metaobject.Size();
-        back.actual_size_ += metaobject.Size();
+public:
+    template <ts::ObjectLike O>
+    requires(!std::is_same_v<O, ts::ClassObject>) void AddNode(util::Ptr<O>& node) {
+        INFO("Addding node: ", node->ToString());
+        auto page = FindPage(GetRecordSize(node->Size()));
+        auto id = NextId();
+        auto metaobject = Node(header_.magic_, id, node);
+        auto offset = PlaceNode(page, metaobject);
+        DEBUG("Initialized new memory on id: ", id, ", slot: ", offset);
+        mem::WritePage(page, alloc_->GetHeaders());
+        if (spare_pages_.contains(page.index_)) {
+            UpdateSpare(page);
+        }
 
         INFO("Successfully added node with id: ", id);
+        DEBUG("Page ", page);
+    }
 
-        mem::WritePage(back, alloc_->GetFile());
-        DEBUG("Back ", back);
-        GetHeader().WriteNodeId(alloc_->GetFile(), ++id);
-        DEBUG("Count ", GetHeader().id_);
+    // Nodes are appended to the back page, every page is filled in memory and written by a
+    // single call with its header
+    template <std::ranges::input_range R>
+    void AddNodes(R&& nodes) {
+        auto& file = alloc_->GetFile();
+        auto it = std::ranges::begin(nodes);
+        auto end = std::ranges::end(nodes);
+        while (it != end) {
+            auto back = GetBack();
+            // Free slots are looked up in the file, so the staged page only appends them
+            auto spare = spare_pages_.erase(back.index_) != 0;
+            // Slots and records are written at both ends of the page, the whole body is staged
+            // with the nodes it already has
+            auto body_offset = mem::GetOffset(back.index_, sizeof(mem::Page));
+            auto body = file->ReadString(body_offset, mem::kPageSize - sizeof(mem::Page));
+            auto staged = mem::StagedWrite(file, body_offset, mem::kPageSize - sizeof(mem::Page));
+            file->Write(body, body_offset);
+            for (; it != end; ++it) {
+                auto& node = *it;
+                if (GetFreeSpace(back) < GetRecordSize(node->Size()) + sizeof(mem::Slot)) {
+                    break;
+                }
+                PlaceNode(back, Node(header_.magic_, NextId(), node));
+            }
+            staged.Commit();
+            SetBack(back);
+            if (spare) {
+                UpdateSpare(back);
+            }
+            if (it != end) {
+                AllocatePage();
+            }
+        }
     }
 
     template <typename Predicate, typename Functor>
@@ -215,6 +379,24 @@ public:
         }
     }
 
+    // Pages which filters rule out the value of the field are skipped without reading their
+    // nodes, nodes of the other pages are checked by the functor
+    template <typename Functor>
+    void VisitNodesWithValue(const std::string& path, std::string_view value, Functor functor) {
+        auto field = filters_.has_value() ? filters_->FindField(path) : std::nullopt;
+        auto end = End();
+        auto skip = [this, &field, value](mem::PageIndex index) {
+            return field.has_value() && !filters_->MayContain(index, field.value(), value);
+        };
+        VisitDataPages(0, pages_.GetPagesCount(), skip, [&](mem::PageIndex index) {
+            auto node_it = NodeIterator(header_.magic_, nodes_class_, alloc_->GetFile(), layout_,
+                                        data_page_list_, data_page_list_.IteratorTo(index), 0);
+            for (; node_it != end && node_it.Page()->index_ == index; ++node_it) {
+                functor(node_it);
+            }
+        });
+    }
+
     template <typename Predicate>
     requires std::is_invocable_r_v<bool, Predicate, NodeIterator>
     void RemoveNodesIf(Predicate predicate) {
@@ -225,37 +407,48 @@ public:
         // change for separate fields
         // size_t count = 0;
         std::vector<mem::PageIndex> free_pages;
+        // Filters of the compacted pages are rebuilt once all their nodes are removed
+        std::vector<mem::PageIndex> compacted_pages;
         for (auto node_it = Begin(); node_it != end;) {
             auto current_it = node_it++;
             if (predicate(current_it)) {
                 DEBUG("Node: ", current_it->ToString());
-                auto page = mem::ReadPage(*current_it.Page(), alloc_->GetFile());
-                auto node = *current_it;
-
-                page.actual_size_ -= node.Size();
-
-                // Not working as intended this should be a pointer from which we will iterate in
-                // page for some optimizations
-                page.initialized_offset_ =
-                    std::min(current_it.InPageOffset(), page.initialized_offset_);
-                node.Free(current_it.InPageOffset() + static_cast<mem::PageOffset>(node.Size()));
-                node.Write(alloc_->GetFile(),
-                           mem::GetOffset(current_it.Page()->index_, current_it.InPageOffset()));
-
-                DEBUG("Page: ", page);
-                mem::WritePage(page, alloc_->GetFile());
-                if (page.actual_size_ == 0) {
-                    INFO("Deallocated page", page);
-                    free_pages.push_back(page.index_);
+                if (FreeNode(*current_it, current_it.GetRealOffset())) {
+                    INFO("Deallocated page", current_it.Page()->index_);
+                    free_pages.push_back(current_it.Page()->index_);
+                } else if (compacted_pages.empty() ||
+                           compacted_pages.back() != current_it.Page()->index_) {
+                    compacted_pages.push_back(current_it.Page()->index_);
                 }
                 // ++count;
             }
         }
+        for (auto index : compacted_pages) {
+            if (std::find(free_pages.begin(), free_pages.end(), index) == free_pages.end()) {
+                RebuildFilter(index);
+            }
+        }
         for (auto id : free_pages) {
-            FreePage(id);
+            ReleasePage(id);
         }
         // auto header = GetHeader();
         // header.WriteNodeCount(alloc_->GetFile(), header.nodes_ - count);
     }
+
+    bool RemoveNode(ts::ObjectId id) {
+        auto node = GetNode(id);
+        if (node == nullptr) {
+            return false;
+        }
+        DEBUG("Node: ", node->ToString());
+        auto offset = directory_.Get(id);
+        if (FreeNode(*node, offset)) {
+            INFO("Deallocated page", mem::GetIndex(offset));
+            ReleasePage(mem::GetIndex(offset));
+        } else {
+            RebuildFilter(mem::GetIndex(offset));
+        }
+        return true;
+    }
 };
 }  // namespace db
\ No newline at end of file
@@ -0,0 +1,108 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "index.hpp"
+#include "page_records.hpp"
+
+namespace db {
+
+// Bounds of the primitive fields of the nodes of every data page of a fixed size class, the
+// bounds are codes of the values as in the field index. Bounds only grow while the page keeps its
+// nodes, so a page may be skipped by a range scan only if its bounds miss the range. Record of a
+// page is the minimum and the maximum of every field
+class ZoneMap {
+    std::vector<std::string> paths_;
+    std::vector<FieldPath> fields_;
+    PageRecords records_;
+
+    void CollectFields(const ts::Class::Ptr& field_class, const std::string& path) {
+        if (IsPrimitive(field_class)) {
+            paths_.push_back(path);
+        } else if (util::Is<ts::StructClass>(field_class)) {
+            for (auto& field : util::As<ts::StructClass>(field_class)->GetFields()) {
+                CollectFields(field, path.empty() ? field->Name() : path + "." + field->Name());
+            }
+        }
+    }
+
+public:
+    ZoneMap() {
+    }
+
+    // Every primitive field is tracked while the records fit in a page
+    ZoneMap(const ts::Class::Ptr& node_class, mem::PageAllocator::Ptr& alloc,
+            mem::Offset sentinel_offset, DEFAULT_LOGGER(logger)) {
+        CollectFields(node_class, util::Is<ts::StructClass>(node_class) ? "" : node_class->Name());
+        paths_.resize(std::min(paths_.size(), PageRecords::kMaxWords / 2));
+        for (auto& path : paths_) {
+            fields_.emplace_back(path);
+        }
+        records_ = PageRecords(node_class->Name() + "_Zones", alloc, sentinel_offset,
+                               2 * fields_.size(), logger);
+    }
+
+    [[nodiscard]] bool IsEmpty() const {
+        return fields_.empty();
+    }
+
+    [[nodiscard]] std::optional<size_t> FindField(const std::string& path) const {
+        auto it = std::find(paths_.begin(), paths_.end(), path);
+        if (it == paths_.end()) {
+            return std::nullopt;
+        }
+        return it - paths_.begin();
+    }
+
+    // Bounds of the page are extended by the fields of the node written into it
+    void Widen(mem::PageIndex page, const Node& node) {
+        auto record = records_.Find(page);
+        auto fresh = !record.has_value();
+        if (fresh) {
+            record = records_.Insert(page);
+        }
+        auto data = node.Data<ts::Object>();
+        auto bounds = records_.Words(record.value());
+        auto changed = fresh;
+        for (size_t i = 0; i < fields_.size(); ++i) {
+            auto key = EncodeKey(fields_[i].Extract(data));
+            if (fresh || key < bounds[2 * i]) {
+                bounds[2 * i] = key;
+                changed = true;
+            }
+            if (fresh || key > bounds[2 * i + 1]) {
+                bounds[2 * i + 1] = key;
+                changed = true;
+            }
+        }
+        if (changed) {
+            records_.Write(record.value());
+        }
+    }
+
+    void Erase(mem::PageIndex page) {
+        records_.Erase(page);
+    }
+
+    // Whether no node of the page has the field in [from, to], the page without the record is
+    // never missed
+    [[nodiscard]] bool Misses(mem::PageIndex page, size_t field, uint64_t from,
+                              uint64_t to) const {
+        auto record = records_.Find(page);
+        if (!record.has_value()) {
+            return false;
+        }
+        auto bounds = records_.Words(record.value());
+        return bounds[2 * field + 1] < from || to < bounds[2 * field];
+    }
+
+    void Drop() {
+        records_.Drop();
+    }
+};
+
+}  // namespace db
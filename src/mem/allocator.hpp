@@ -1,6 +1,12 @@
 #pragma once
 
+#include <algorithm>
+#include <bit>
 #include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <vector>
 
 #include "logger.hpp"
 #include "mem.hpp"
@@ -9,123 +15,317 @@
 
 namespace mem {
 
+// File grows by extents of pages, which are handed out from memory one by one. Extent is as large
+// as the pages already allocated up to the chosen count, so small databases stay small
+constexpr inline size_t kDefaultExtentPages = 64;
+constexpr inline size_t kMaxExtentPages = 1024;
+
+// Bitmap page of a group of pages keeps the number of the group followed by its words
+constexpr inline size_t kBitmapWords =
+    (kPageSize - sizeof(Page) - sizeof(size_t)) / sizeof(uint64_t);
+constexpr inline size_t kGroupPages = kBitmapWords * 64;
+
+// Free pages are marked in a bitmap, bit of a page is set while it is free. Bitmap of a group of
+// pages has a page of its own: the first page freed in the group, linked to the superblock. When
+// the tail of the file is cut off, its bitmap pages move to free pages of their groups or are
+// dropped with the last free pages of the groups. Bitmaps are mirrored in memory together with a
+// summary of their words, so a page is freed and taken in constant time and the lowest free one
+// is found by a few words
 class PageAllocator {
 
 private:
     DECLARE_LOGGER;
     size_t pages_count_;
+    // Pages the file has room for, the ones beyond the pages count are reserved by the last extent
+    size_t capacity_;
+    size_t extent_pages_ = kDefaultExtentPages;
+    HeaderCache::Ptr headers_;
     File::Ptr file_;
-    PageList free_list_;
+    PageList bitmap_list_;
+    // Bitmap page of every group, sentinel index while the group has no free pages yet
+    std::vector<PageIndex> bitmaps_;
+    std::vector<uint64_t> words_;
+    // Bit i is set while word i has a free page
+    std::vector<uint64_t> summary_;
+    size_t free_count_ = 0;
 
     const double load_factor_ = 0.5;
 
-    PageIndex AllocateNewPage() {
-        if ((file_->GetSize() - kPagetableOffset) % kPageSize != 0) {
-            ERROR("Filesize: ", file_->GetSize());
-            throw error::StructureError("Unaligned file");
+    [[nodiscard]] static uint64_t Bit(size_t position) {
+        return uint64_t{1} << (position % 64);
+    }
+
+    void Cover(size_t pages) {
+        auto words = (pages + 63) / 64;
+        if (words <= words_.size()) {
+            return;
         }
-        auto new_page_offset = file_->GetSize();
+        words_.resize(words, 0);
+        summary_.resize((words + 63) / 64, 0);
+        bitmaps_.resize((words + kBitmapWords - 1) / kBitmapWords, kSentinelIndex);
+    }
 
-        DEBUG("Allocating page");
-        DEBUG("Filesize: ", new_page_offset);
+    [[nodiscard]] bool IsFree(PageIndex index) const {
+        return index / 64 < words_.size() && (words_[index / 64] & Bit(index)) != 0;
+    }
 
-        file_->Extend(kPageSize);
-        file_->Write<Page>(Page(pages_count_++), new_page_offset);
-        file_->Write<size_t>(pages_count_, kPagesCountOffset);
+    void Summarize(size_t word) {
+        if (words_[word] != 0) {
+            summary_[word / 64] |= Bit(word);
+        } else {
+            summary_[word / 64] &= ~Bit(word);
+        }
+    }
 
-        DEBUG("Successful Allocation");
+    void WriteWord(size_t word) {
+        Summarize(word);
+        auto in_page = sizeof(Page) + sizeof(size_t) + word % kBitmapWords * sizeof(uint64_t);
+        file_->Write<uint64_t>(words_[word], GetOffset(bitmaps_[word / kBitmapWords],
+                                                        static_cast<PageOffset>(in_page)));
+    }
 
-        return pages_count_ - 1;
+    // Page becomes the bitmap of its group with the words the group has in memory, they are all
+    // zero when its first page is freed. Page keeps the data of its previous owner
+    void InitBitmap(PageIndex index) {
+        auto group = index / kGroupPages;
+        bitmap_list_.PushBack(index);
+        auto page = ReadPage(Page(index), headers_);
+        page.type_ = PageType::kIndex;
+        WritePage(page, headers_);
+        auto first = group * kBitmapWords;
+        auto words = std::vector<uint64_t>(kBitmapWords, 0);
+        for (auto word = first; word < std::min(words_.size(), first + kBitmapWords); ++word) {
+            words[word - first] = words_[word];
+        }
+        file_->Write<size_t>(group, GetOffset(index, sizeof(Page)));
+        file_->Write(words, GetOffset(index, sizeof(Page) + sizeof(size_t)));
+        bitmaps_[group] = index;
+        DEBUG("Bitmap page initialized: ", page, " for group ", group);
     }
 
-    void SwapPages(PageIndex first, PageIndex second) {
-        if (first > pages_count_ || second > pages_count_) {
-            throw error::BadArgument("The page index exceedes pages count: " +
-                                     std::to_string(pages_count_));
+    // Bitmap page of the group is cut off with the tail, the lowest free page of the group takes
+    // its place. Group without free pages is left without a bitmap
+    void MoveBitmap(size_t group) {
+        bitmap_list_.Unlink(bitmaps_[group]);
+        bitmaps_[group] = kSentinelIndex;
+        auto last = std::min(words_.size(), (group + 1) * kBitmapWords);
+        for (auto word = group * kBitmapWords; word < last; ++word) {
+            if (words_[word] != 0) {
+                auto index = word * 64 + std::countr_zero(words_[word]);
+                words_[word] &= ~Bit(index);
+                --free_count_;
+                Summarize(word);
+                InitBitmap(index);
+                return;
+            }
         }
+        DEBUG("Bitmap page dropped for group ", group);
+    }
 
-        DEBUG("Swapping pages with indecies ", first, " ", second);
+    [[nodiscard]] std::optional<PageIndex> FindLowestFree() const {
+        for (size_t summary = 0; summary < summary_.size(); ++summary) {
+            if (summary_[summary] != 0) {
+                auto word = summary * 64 + std::countr_zero(summary_[summary]);
+                return word * 64 + std::countr_zero(words_[word]);
+            }
+        }
+        return std::nullopt;
+    }
 
-        auto first_data = file_->Read<PageData>(GetPageAddress(first));
-        auto second_data = file_->Read<PageData>(GetPageAddress(second));
+    void ExtendFile() {
+        if ((file_->GetSize() - kPagetableOffset) % kPageSize != 0) {
+            ERROR("Filesize: ", file_->GetSize());
+            throw error::StructureError("Unaligned file");
+        }
+        auto pages = std::clamp<size_t>(pages_count_, 1, extent_pages_);
+        DEBUG("Extending file by ", pages, " pages, filesize: ", file_->GetSize());
+        file_->Extend(static_cast<Offset>(pages) * kPageSize);
+        capacity_ += pages;
+    }
 
-        std::swap(first_data.page_header.index_, second_data.page_header.index_);
-        std::swap(first_data.page_header.next_page_index_,
-                  second_data.page_header.next_page_index_);
-        std::swap(first_data.page_header.previous_page_index_,
-                  second_data.page_header.previous_page_index_);
+    PageIndex AllocateNewPage() {
+        DEBUG("Allocating page");
+        if (pages_count_ == capacity_) {
+            ExtendFile();
+        }
+        // Count is a record of the header cache, it reaches the file once per flush
+        headers_->Write<Page>(Page(pages_count_), GetPageAddress(pages_count_));
+        headers_->Write<size_t>(++pages_count_, kPagesCountOffset);
 
-        file_->Write<PageData>(first_data, GetPageAddress(second_data.page_header.index_));
-        file_->Write<PageData>(second_data, GetPageAddress(first_data.page_header.index_));
+        DEBUG("Successful Allocation");
 
-        DEBUG("Successfully swaped");
+        return pages_count_ - 1;
     }
 
-    // TODO: Need to do better compression but the problem that i need to know from which list
-    // swapping occurs, but i can't. I'm tired
+    // Free pages at the end of the file are cut off together with the reserved ones. Tail is
+    // found by the bitmap a word at a time, bitmap pages are taken for free ones in it
     void Compression() {
-        auto rbegin = free_list_.RBegin();
-        auto page_it = pages_count_ - 1;
-        size_t count = 0;
-        while (page_it != 0) {
-            DEBUG("Page: ", ReadPage(Page(page_it), file_));
-            if (ReadPage(Page(page_it), file_).type_ == PageType::kFree) {
-                --pages_count_;
-                ++count;
-                free_list_.Unlink(page_it--);
-            } else {
+        Cover(pages_count_);
+        for (auto bitmap : bitmaps_) {
+            if (bitmap != kSentinelIndex) {
+                words_[bitmap / 64] |= Bit(bitmap);
+            }
+        }
+        auto count = pages_count_;
+        while (count != 0) {
+            auto word = (count - 1) / 64;
+            auto below = (count - 1) % 64 + 1;
+            auto mask = below == 64 ? ~uint64_t{0} : (uint64_t{1} << below) - 1;
+            auto used = ~words_[word] & mask;
+            if (used != 0) {
+                count = word * 64 + 64 - std::countl_zero(used);
                 break;
             }
+            count -= below;
+        }
+        for (auto bitmap : bitmaps_) {
+            if (bitmap != kSentinelIndex) {
+                words_[bitmap / 64] &= ~Bit(bitmap);
+            }
+        }
+        DEBUG("Pages left: ", count, " of ", pages_count_);
+        std::vector<size_t> changed;
+        for (auto word = count / 64; word < (pages_count_ + 63) / 64; ++word) {
+            auto kept = word == count / 64 ? words_[word] & (Bit(count) - 1) : 0;
+            if (kept != words_[word]) {
+                free_count_ -= std::popcount(words_[word] & ~kept);
+                words_[word] = kept;
+                Summarize(word);
+                changed.push_back(word);
+            }
         }
-        DEBUG("TRUNCATE: ", count * kPageSize);
-        file_->Truncate(count * kPageSize);
+        // Moved bitmap is written whole, the other bitmaps get the changed words
+        std::vector<bool> moved(bitmaps_.size(), false);
+        for (size_t group = 0; group < bitmaps_.size(); ++group) {
+            if (bitmaps_[group] != kSentinelIndex && bitmaps_[group] >= count) {
+                MoveBitmap(group);
+                moved[group] = true;
+            }
+        }
+        for (auto word : changed) {
+            if (!moved[word / kBitmapWords] && bitmaps_[word / kBitmapWords] != kSentinelIndex) {
+                WriteWord(word);
+            }
+        }
+        pages_count_ = count;
+        headers_->Write<size_t>(pages_count_, kPagesCountOffset);
+        auto size = file_->GetSize() - GetPageAddress(pages_count_);
+        DEBUG("TRUNCATE: ", size);
+        file_->Truncate(size);
+        capacity_ = pages_count_;
+        headers_->Discard(file_->GetSize());
     }
 
 public:
     using Ptr = util::Ptr<PageAllocator>;
 
-    PageAllocator(mem::File::Ptr& file, DEFAULT_LOGGER(logger)) : LOGGER(logger), file_(file) {
+    PageAllocator(HeaderCache::Ptr& headers, DEFAULT_LOGGER(logger))
+        : LOGGER(logger), headers_(headers), file_(headers->GetFile()) {
 
-        DEBUG("Free list count: ", file->Read<size_t>(kPagesCountOffset));
-        pages_count_ = file_->Read<size_t>(kPagesCountOffset);
+        pages_count_ = headers_->Read<size_t>(kPagesCountOffset);
+        DEBUG("Pages count: ", pages_count_);
+        capacity_ = std::max<size_t>(
+            pages_count_, static_cast<size_t>(file_->GetSize() - kPagetableOffset) / kPageSize);
 
-        DEBUG("Freelist sentinel offset: ", kFreeListSentinelOffset);
-        DEBUG("Free list count: ", file->Read<size_t>(kFreePagesCountOffset));
-
-        free_list_ = PageList("Free_List", file_, kFreeListSentinelOffset, LOGGER);
+        bitmap_list_ = PageList("Free_Space", headers_, kFreeSpaceSentinelOffset, LOGGER);
+        Cover(pages_count_);
+        for (auto& page : bitmap_list_) {
+            auto group = file_->Read<size_t>(GetOffset(page.index_, sizeof(Page)));
+            Cover((group + 1) * kGroupPages);
+            bitmaps_[group] = page.index_;
+            auto words = file_->ReadVector<uint64_t>(
+                GetOffset(page.index_, sizeof(Page) + sizeof(size_t)), kBitmapWords);
+            std::copy(words.begin(), words.end(),
+                      words_.begin() + static_cast<ptrdiff_t>(group * kBitmapWords));
+        }
+        for (size_t word = 0; word < words_.size(); ++word) {
+            if (words_[word] != 0) {
+                summary_[word / 64] |= Bit(word);
+                free_count_ += std::popcount(words_[word]);
+            }
+        }
 
-        INFO("FreeList initialized");
+        INFO("Free space bitmap initialized, free pages: ", free_count_);
     }
 
     [[nodiscard]] size_t GetPagesCount() const {
         return pages_count_;
     }
 
+    [[nodiscard]] size_t GetFreePagesCount() const {
+        return free_count_;
+    }
+
+    [[nodiscard]] size_t GetCapacity() const {
+        return capacity_;
+    }
+
+    // Count of pages the file is extended by once the reserved ones run out, from 1 to 1024
+    void SetExtentPages(size_t pages) {
+        if (pages == 0 || pages > kMaxExtentPages) {
+            throw error::BadArgument("Extent must have from 1 to " +
+                                     std::to_string(kMaxExtentPages) + " pages");
+        }
+        extent_pages_ = pages;
+    }
+
     [[nodiscard]] mem::File::Ptr& GetFile() {
         return file_;
     }
 
+    [[nodiscard]] HeaderCache::Ptr& GetHeaders() {
+        return headers_;
+    }
+
+    // The lowest free page is taken, so the file stays dense
     mem::PageIndex AllocatePage() {
-        if (free_list_.IsEmpty()) {
+        auto index = FindLowestFree();
+        if (!index.has_value()) {
             return AllocateNewPage();
         }
-        auto index = free_list_.Back();
-        free_list_.PopBack();
-        return index;
+        words_[index.value() / 64] &= ~Bit(index.value());
+        --free_count_;
+        WriteWord(index.value() / 64);
+        return index.value();
+    }
+
+    // Page of the type is linked to the back of the list with its body zeroed, a reused page keeps
+    // the data of its previous owner otherwise. Returns the header of the page
+    Page AllocatePage(PageList& list, PageType type) {
+        auto index = AllocatePage();
+        list.PushBack(index);
+        auto page = ReadPage(Page(index), headers_);
+        page.type_ = type;
+        WritePage(page, headers_);
+        file_->Write(std::string(kPageSize - sizeof(Page), '\0'), GetOffset(index, sizeof(Page)));
+        return page;
     }
 
     void FreePage(mem::PageIndex index) {
-        if (free_list_.IteratorTo(index)->type_ == mem::PageType::kFree) {
+        if (index >= pages_count_) {
+            throw error::BadArgument("The page index exceedes pages count: " +
+                                     std::to_string(pages_count_));
+        }
+        Cover(index + 1);
+        if (IsFree(index) || bitmaps_[index / kGroupPages] == index) {
             throw error::RuntimeError("Double free");
         }
-        WritePage(Page(index), file_);
-        free_list_.PushBack(index);
+        // Cached records of the previous owner are dropped, they would be written over the next one
+        headers_->Invalidate(GetPageAddress(index), GetPageAddress(index + 1));
+        WritePage(Page(index), headers_);
+        if (bitmaps_[index / kGroupPages] == kSentinelIndex) {
+            InitBitmap(index);
+            return;
+        }
+        words_[index / 64] |= Bit(index);
+        ++free_count_;
+        WriteWord(index / 64);
 
-        if (static_cast<double>(free_list_.GetPagesCount()) / pages_count_ > load_factor_) {
+        if (static_cast<double>(free_count_) / pages_count_ > load_factor_) {
             DEBUG("Compression");
             Compression();
         }
     }
 };
 
-}  // namespace mem
\ No newline at end of file
+}  // namespace mem
@@ -0,0 +1,229 @@
+#pragma once
+
+#include <algorithm>
+#include <compare>
+#include <cstddef>
+#include <cstdint>
+
+#include "allocator.hpp"
+#include "logger.hpp"
+
+namespace mem {
+
+// Key is unique by the payload, so equal values of different objects are separate keys
+struct BTreeKey {
+    uint64_t value;
+    uint64_t payload;
+
+    auto operator<=>(const BTreeKey&) const = default;
+};
+
+constexpr inline size_t kBTreeFanout =
+    (kPageSize - sizeof(Page) - 2 * sizeof(uint32_t) - 2 * sizeof(PageIndex)) /
+    (sizeof(BTreeKey) + sizeof(PageIndex));
+
+// Body of a tree page: keys of a leaf are the entries, keys of an inner node separate children,
+// the child before a key has the lesser keys. Leaves are linked from left to right
+struct BTreeNode {
+    uint32_t count;
+    uint32_t leaf;
+    PageIndex next;
+    BTreeKey keys[kBTreeFanout];
+    PageIndex children[kBTreeFanout + 1];
+};
+
+static_assert(sizeof(Page) + sizeof(BTreeNode) <= kPageSize);
+
+// B+tree of pages given by the allocator. Index of the root page is kept in the file at the
+// given offset. Nodes are split on the way down, so an insertion passes the tree once; removed
+// keys leave their leaves underfilled, pages are freed only by Drop
+class BTree {
+    DECLARE_LOGGER;
+    PageAllocator::Ptr alloc_;
+    Offset root_offset_;
+    PageIndex root_;
+
+    [[nodiscard]] static Offset GetNodeOffset(PageIndex index) {
+        return GetOffset(index, sizeof(Page));
+    }
+
+    [[nodiscard]] BTreeNode ReadNode(PageIndex index) {
+        return alloc_->GetFile()->Read<BTreeNode>(GetNodeOffset(index));
+    }
+
+    // Only the used parts of the arrays are written
+    void WriteNode(PageIndex index, const BTreeNode& node) {
+        auto& file = alloc_->GetFile();
+        auto offset = GetNodeOffset(index);
+        file->Write<BTreeNode>(node, offset, 0,
+                               offsetof(BTreeNode, keys) + node.count * sizeof(BTreeKey));
+        if (!node.leaf) {
+            file->Write<BTreeNode>(node, offset + offsetof(BTreeNode, children),
+                                   offsetof(BTreeNode, children),
+                                   (node.count + 1) * sizeof(PageIndex));
+        }
+    }
+
+    PageIndex AllocateNode(const BTreeNode& node) {
+        auto index = alloc_->AllocatePage();
+        auto page = ReadPage(Page(index), alloc_->GetHeaders());
+        page.type_ = PageType::kIndex;
+        WritePage(page, alloc_->GetHeaders());
+        WriteNode(index, node);
+        return index;
+    }
+
+    void SetRoot(PageIndex root) {
+        root_ = root;
+        alloc_->GetFile()->Write<PageIndex>(root_, root_offset_);
+    }
+
+    [[nodiscard]] static uint32_t FindChild(const BTreeNode& node, const BTreeKey& key) {
+        return static_cast<uint32_t>(std::upper_bound(node.keys, node.keys + node.count, key) -
+                                     node.keys);
+    }
+
+    // Full child of the parent is split in halves, the right one gets a new page
+    void SplitChild(BTreeNode& parent, PageIndex parent_index, uint32_t position) {
+        auto left_index = parent.children[position];
+        auto left = ReadNode(left_index);
+        BTreeNode right{};
+        right.leaf = left.leaf;
+        auto middle = left.count / 2;
+        BTreeKey separator;
+        if (left.leaf) {
+            right.count = left.count - middle;
+            std::copy(left.keys + middle, left.keys + left.count, right.keys);
+            right.next = left.next;
+            separator = right.keys[0];
+        } else {
+            right.count = left.count - middle - 1;
+            std::copy(left.keys + middle + 1, left.keys + left.count, right.keys);
+            std::copy(left.children + middle + 1, left.children + left.count + 1, right.children);
+            separator = left.keys[middle];
+        }
+        left.count = middle;
+        auto right_index = AllocateNode(right);
+        if (left.leaf) {
+            left.next = right_index;
+        }
+        WriteNode(left_index, left);
+
+        std::copy_backward(parent.keys + position, parent.keys + parent.count,
+                           parent.keys + parent.count + 1);
+        std::copy_backward(parent.children + position + 1, parent.children + parent.count + 1,
+                           parent.children + parent.count + 2);
+        parent.keys[position] = separator;
+        parent.children[position + 1] = right_index;
+        ++parent.count;
+        WriteNode(parent_index, parent);
+    }
+
+    void Free(PageIndex index) {
+        auto node = ReadNode(index);
+        if (!node.leaf) {
+            for (uint32_t i = 0; i <= node.count; ++i) {
+                Free(node.children[i]);
+            }
+        }
+        alloc_->FreePage(index);
+    }
+
+public:
+    BTree() {
+    }
+
+    BTree(PageAllocator::Ptr& alloc, Offset root_offset, DEFAULT_LOGGER(logger))
+        : LOGGER(logger),
+          alloc_(alloc),
+          root_offset_(root_offset),
+          root_(alloc->GetFile()->Read<PageIndex>(root_offset)) {
+    }
+
+    // Allocates an empty tree, its root is written at the offset
+    static BTree Create(PageAllocator::Ptr& alloc, Offset root_offset, DEFAULT_LOGGER(logger)) {
+        auto tree = BTree(alloc, root_offset, logger);
+        BTreeNode root{};
+        root.leaf = true;
+        root.next = kSentinelIndex;
+        tree.SetRoot(tree.AllocateNode(root));
+        return tree;
+    }
+
+    void Insert(const BTreeKey& key) {
+        auto node = ReadNode(root_);
+        if (node.count == kBTreeFanout) {
+            BTreeNode root{};
+            root.children[0] = root_;
+            auto root_index = AllocateNode(root);
+            SetRoot(root_index);
+            DEBUG("New root of the tree: ", root_index);
+            SplitChild(root, root_index, 0);
+            node = root;
+        }
+        auto index = root_;
+        while (!node.leaf) {
+            auto position = FindChild(node, key);
+            if (ReadNode(node.children[position]).count == kBTreeFanout) {
+                SplitChild(node, index, position);
+                position = FindChild(node, key);
+            }
+            index = node.children[position];
+            node = ReadNode(index);
+        }
+        auto position = std::lower_bound(node.keys, node.keys + node.count, key) - node.keys;
+        std::copy_backward(node.keys + position, node.keys + node.count,
+                           node.keys + node.count + 1);
+        node.keys[position] = key;
+        ++node.count;
+        WriteNode(index, node);
+    }
+
+    bool Erase(const BTreeKey& key) {
+        auto index = root_;
+        auto node = ReadNode(index);
+        while (!node.leaf) {
+            index = node.children[FindChild(node, key)];
+            node = ReadNode(index);
+        }
+        auto position = std::lower_bound(node.keys, node.keys + node.count, key) - node.keys;
+        if (position == node.count || node.keys[position] != key) {
+            return false;
+        }
+        std::copy(node.keys + position + 1, node.keys + node.count, node.keys + position);
+        --node.count;
+        WriteNode(index, node);
+        return true;
+    }
+
+    // Functor is called with the payload of every key with the value in [from, to] in the order
+    // of keys
+    template <typename Functor>
+    void Visit(uint64_t from, uint64_t to, Functor functor) {
+        auto key = BTreeKey{from, 0};
+        auto node = ReadNode(root_);
+        while (!node.leaf) {
+            node = ReadNode(node.children[FindChild(node, key)]);
+        }
+        auto position = std::lower_bound(node.keys, node.keys + node.count, key) - node.keys;
+        while (true) {
+            for (; position < node.count; ++position) {
+                if (node.keys[position].value > to) {
+                    return;
+                }
+                functor(node.keys[position].payload);
+            }
+            if (node.next == kSentinelIndex) {
+                return;
+            }
+            node = ReadNode(node.next);
+            position = 0;
+        }
+    }
+
+    void Drop() {
+        Free(root_);
+    }
+};
+
+}  // namespace mem
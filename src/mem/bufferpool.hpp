@@ -0,0 +1,304 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+#include "error.hpp"
+
+namespace mem {
+
+// Size of the database pages is chosen at build time, a power of two from 4 KiB to 64 KiB
+#ifndef DDB_PAGE_SIZE
+#define DDB_PAGE_SIZE 4096
+#endif
+
+// File is cached by frames of the same size as database pages, so that page N of the page table
+// occupies exactly one frame
+constexpr inline size_t kFrameSize = DDB_PAGE_SIZE;
+static_assert(kFrameSize >= 4096 && kFrameSize <= 65536 && (kFrameSize & (kFrameSize - 1)) == 0,
+              "DDB_PAGE_SIZE must be a power of two from 4096 to 65536");
+constexpr inline size_t kDefaultCacheBudget = 64 * 1024 * 1024;
+
+using BlockIndex = uint64_t;
+// Log sequence number of the last logged change of a block
+using Lsn = uint64_t;
+
+// Pool of fixed size frames with CLOCK replacement. The pool knows nothing about the file, it only
+// decides which frame holds which block and which frame should be evicted, all the I/O is done by
+// the owner (see File). Lookup is safe to call concurrently, other methods need exclusive access
+class BufferPool {
+public:
+    class Frame {
+        friend BufferPool;
+
+        std::unique_ptr<char[]> data_;
+        BlockIndex block_ = 0;
+        // Following fields may be changed by readers holding shared lock of the file
+        std::atomic<size_t> pins_ = 0;
+        bool valid_ = false;
+        bool held_ = false;
+        // First and last logged changes since the frame became dirty
+        Lsn rec_lsn_ = 0;
+        Lsn lsn_ = 0;
+        std::atomic<bool> dirty_ = false;
+        std::atomic<bool> referenced_ = false;
+
+    public:
+        Frame() : data_(new char[kFrameSize]) {
+        }
+
+        [[nodiscard]] char* Data() noexcept {
+            return data_.get();
+        }
+        [[nodiscard]] const char* Data() const noexcept {
+            return data_.get();
+        }
+        [[nodiscard]] BlockIndex Block() const noexcept {
+            return block_;
+        }
+        [[nodiscard]] bool IsDirty() const noexcept {
+            return dirty_;
+        }
+        [[nodiscard]] bool IsPinned() const noexcept {
+            return pins_ != 0;
+        }
+        [[nodiscard]] bool IsHeld() const noexcept {
+            return held_;
+        }
+        [[nodiscard]] Lsn GetRecLsn() const noexcept {
+            return rec_lsn_;
+        }
+        [[nodiscard]] Lsn GetLsn() const noexcept {
+            return lsn_;
+        }
+        void MarkDirty() noexcept {
+            dirty_ = true;
+        }
+        void MarkDirty(Lsn lsn) noexcept {
+            dirty_ = true;
+            if (rec_lsn_ == 0) {
+                rec_lsn_ = lsn;
+            }
+            lsn_ = std::max(lsn_, lsn);
+        }
+        void MarkClean() noexcept {
+            dirty_ = false;
+            rec_lsn_ = 0;
+            lsn_ = 0;
+        }
+    };
+
+private:
+    size_t capacity_;
+    std::vector<std::unique_ptr<Frame>> frames_;
+    std::unordered_map<BlockIndex, Frame*> table_;
+    std::vector<Frame*> held_;
+    size_t hand_ = 0;
+
+    std::atomic<size_t> hits_ = 0;
+    std::atomic<size_t> misses_ = 0;
+
+public:
+    explicit BufferPool(size_t budget = kDefaultCacheBudget) : capacity_(budget / kFrameSize) {
+    }
+
+    BufferPool(const BufferPool&) = delete;
+    BufferPool& operator=(const BufferPool&) = delete;
+
+    [[nodiscard]] bool IsEnabled() const noexcept {
+        return capacity_ != 0;
+    }
+
+    [[nodiscard]] size_t GetCapacity() const noexcept {
+        return capacity_;
+    }
+
+    [[nodiscard]] size_t GetBudget() const noexcept {
+        return capacity_ * kFrameSize;
+    }
+
+    [[nodiscard]] size_t GetHits() const noexcept {
+        return hits_;
+    }
+
+    [[nodiscard]] size_t GetMisses() const noexcept {
+        return misses_;
+    }
+
+    // Frames that were already evicted must be written back by the caller before budget shrinks
+    void SetBudget(size_t budget) {
+        capacity_ = budget / kFrameSize;
+    }
+
+    [[nodiscard]] Frame* Lookup(BlockIndex block) {
+        auto it = table_.find(block);
+        if (it == table_.end()) {
+            ++misses_;
+            return nullptr;
+        }
+        ++hits_;
+        it->second->referenced_ = true;
+        return it->second;
+    }
+
+    // Same as Lookup but does not touch statistics and replacement state
+    [[nodiscard]] bool Contains(BlockIndex block) const {
+        return table_.contains(block);
+    }
+
+    // Returns frame that can hold a new block, dirty victims must be written back by the caller
+    // before Install. Returns nullptr if all the frames are pinned. Frames are allocated over
+    // capacity if the held ones do not leave any victim
+    [[nodiscard]] Frame* Victim() {
+        if (frames_.size() < capacity_) {
+            frames_.push_back(std::make_unique<Frame>());
+            return frames_.back().get();
+        }
+        for (size_t step = 0; step < 2 * frames_.size(); ++step) {
+            auto& frame = frames_[hand_];
+            hand_ = (hand_ + 1) % frames_.size();
+            if (frame->IsPinned()) {
+                continue;
+            }
+            if (frame->referenced_) {
+                frame->referenced_ = false;
+                continue;
+            }
+            return frame.get();
+        }
+        if (!held_.empty()) {
+            frames_.push_back(std::make_unique<Frame>());
+            return frames_.back().get();
+        }
+        return nullptr;
+    }
+
+    void Install(Frame* frame, BlockIndex block) {
+        if (frame->valid_) {
+            table_.erase(frame->block_);
+        }
+        frame->block_ = block;
+        frame->valid_ = true;
+        frame->MarkClean();
+        frame->referenced_ = true;
+        table_.emplace(block, frame);
+    }
+
+    void Pin(Frame* frame) noexcept {
+        ++frame->pins_;
+    }
+
+    void Unpin(Frame* frame) noexcept {
+        --frame->pins_;
+    }
+
+    // Forgets the block held by frame, e.g. when its loading has failed
+    void Invalidate(Frame* frame) {
+        if (frame->valid_) {
+            table_.erase(frame->block_);
+        }
+        frame->valid_ = false;
+        frame->MarkClean();
+    }
+
+    // Frame stays pinned until ReleaseHeld, used to keep uncommitted changes off the disk
+    void Hold(Frame* frame) {
+        if (!frame->held_) {
+            frame->held_ = true;
+            ++frame->pins_;
+            held_.push_back(frame);
+        }
+    }
+
+    void ReleaseHeld() {
+        for (auto frame : held_) {
+            frame->held_ = false;
+            --frame->pins_;
+        }
+        held_.clear();
+    }
+
+    [[nodiscard]] bool HasHeld() const noexcept {
+        return !held_.empty();
+    }
+
+    [[nodiscard]] size_t GetSize() const noexcept {
+        return frames_.size();
+    }
+
+    template <typename Functor>
+    void VisitHeld(Functor functor) {
+        for (auto frame : held_) {
+            functor(*frame);
+        }
+    }
+
+    template <typename Functor>
+    void VisitDirty(Functor functor) {
+        for (auto& frame : frames_) {
+            if (frame->valid_ && frame->dirty_) {
+                functor(*frame);
+            }
+        }
+    }
+
+    // Drops cached blocks starting from the given one without writing them back
+    void Discard(BlockIndex from) {
+        for (auto& frame : frames_) {
+            if (frame->valid_ && frame->block_ >= from) {
+                if (frame->held_) {
+                    frame->held_ = false;
+                    --frame->pins_;
+                    std::erase(held_, frame.get());
+                }
+                if (frame->IsPinned()) {
+                    throw error::RuntimeError("Discarding pinned frame");
+                }
+                table_.erase(frame->block_);
+                frame->valid_ = false;
+                frame->dirty_ = false;
+            }
+        }
+    }
+
+    // Releases the memory of frames above current capacity, they must be clean
+    void Shrink() {
+        while (frames_.size() > capacity_) {
+            auto it = std::find_if(frames_.begin(), frames_.end(),
+                                   [](auto& frame) { return !frame->IsPinned(); });
+            if (it == frames_.end() || (*it)->dirty_) {
+                throw error::RuntimeError("Shrinking pinned or dirty frame");
+            }
+            if ((*it)->valid_) {
+                table_.erase((*it)->block_);
+            }
+            frames_.erase(it);
+        }
+        hand_ = 0;
+    }
+
+    // Same as Shrink, but pinned and dirty frames are kept over capacity
+    void Trim() {
+        if (frames_.size() <= capacity_) {
+            return;
+        }
+        auto excess = frames_.size() - capacity_;
+        std::erase_if(frames_, [this, &excess](auto& frame) {
+            if (excess == 0 || frame->IsPinned() || frame->dirty_) {
+                return false;
+            }
+            --excess;
+            if (frame->valid_) {
+                table_.erase(frame->block_);
+            }
+            return true;
+        });
+        hand_ = 0;
+    }
+};
+
+}  // namespace mem
@@ -2,13 +2,27 @@
 #include <fcntl.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 #include <unistd.h>
 
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstring>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <shared_mutex>
 #include <string>
+#include <string_view>
 #include <type_traits>
+#include <utility>
 #include <vector>
 
+#include "bufferpool.hpp"
 #include "logger.hpp"
+#include "uring.hpp"
 
 namespace mem {
 
@@ -16,35 +30,444 @@ using FileDescriptor = int32_t;
 using Offset = off64_t;
 using StructOffset = size_t;
 
+// Expected access pattern, passed to the kernel as fadvise/madvise hint
+enum class Access { kNormal, kSequential, kRandom };
+
+// Log of the file changes, it receives every write before the write reaches the cache
+class Journal {
+public:
+    using Ptr = util::Ptr<Journal>;
+
+    virtual ~Journal() = default;
+
+    // Returns LSN of the record
+    virtual Lsn LogWrite(Offset offset, const char* data, size_t count) = 0;
+    // Makes the log durable up to the LSN, called before a changed block reaches the disk
+    virtual void Force(Lsn lsn) = 0;
+    [[nodiscard]] virtual bool InTransaction() const = 0;
+};
+
+// All the I/O is positional so the file has no shared cursor. Any number of threads may read the
+// file concurrently, writes take the file exclusively
 class File {
 
+protected:
     DECLARE_LOGGER;
     FileDescriptor fd_;
     std::string fileName_;
+    // Logical size of the file, it can be ahead of the real one while dirty frames are not flushed
+    std::atomic<Offset> size_;
+    mutable BufferPool pool_;
+    mutable std::shared_mutex mutex_;
+    Access access_ = Access::kNormal;
+    size_t io_depth_ = kDefaultIoDepth;
+    mutable std::unique_ptr<IoRing> ring_;
+    mutable bool ring_failed_ = false;
+    Journal::Ptr journal_;
+    // Shrinking of a journaled file is applied to the disk after commit, until then the bytes on
+    // the disk starting from this offset are stale
+    Offset stale_from_ = std::numeric_limits<Offset>::max();
+
+    [[nodiscard]] Offset GetRealSize() const {
+
+        // TODO: Adapt for Windows
+        struct stat64 file_stat;
+        if (fstat64(fd_, &file_stat) != 0) {
+            throw error::BadArgument("Failed to get file " + fileName_ + "size.");
+        }
+
+        return file_stat.st_size;
+    }
+
+    void GrowSize(Offset end) {
+        auto size = size_.load();
+        while (size < end && !size_.compare_exchange_weak(size, end)) {
+        }
+    }
+
+private:
+    size_t ReadRaw(char* data, size_t count, Offset offset) const {
+        size_t done = 0;
+        while (done != count) {
+            auto result = pread64(fd_, data + done, count - done, offset + done);
+            if (result == -1) {
+                throw error::IoError("Failed to read from file " + fileName_);
+            }
+            if (result == 0) {
+                break;
+            }
+            done += result;
+        }
+        return done;
+    }
+
+    void WriteRaw(const char* data, size_t count, Offset offset) const {
+        size_t done = 0;
+        while (done != count) {
+            auto result = pwrite64(fd_, data + done, count - done, offset + done);
+            if (result == -1) {
+                throw error::IoError("Failed to write to file " + fileName_);
+            }
+            done += result;
+        }
+    }
+
+    [[nodiscard]] static Offset GetBlockAddress(BlockIndex block) {
+        return static_cast<Offset>(block * kFrameSize);
+    }
+
+    // Following methods must be called under exclusive lock
+
+    [[nodiscard]] Offset GetLoadableSize() const {
+        return std::min(size_.load(), stale_from_);
+    }
+
+    void WriteBack(BufferPool::Frame& frame) const {
+        if (journal_ != nullptr && frame.GetLsn() != 0) {
+            journal_->Force(frame.GetLsn());
+        }
+        auto address = GetBlockAddress(frame.Block());
+        if (address < size_) {
+            WriteRaw(frame.Data(), std::min<size_t>(kFrameSize, size_ - address), address);
+        }
+        frame.MarkClean();
+    }
+
+    BufferPool::Frame* FetchFrame(BlockIndex block, bool load = true) const {
+        auto frame = pool_.Lookup(block);
+        if (frame != nullptr) {
+            return frame;
+        }
+        frame = pool_.Victim();
+        if (frame == nullptr) {
+            throw error::RuntimeError("All frames of " + fileName_ + " cache are pinned");
+        }
+        if (frame->IsDirty()) {
+            WriteBack(*frame);
+        }
+        auto address = GetBlockAddress(block);
+        auto loadable = GetLoadableSize();
+        size_t loaded = 0;
+        if (load && address < loadable) {
+            auto count = std::min<size_t>(kFrameSize, loadable - address);
+            loaded = ReadRaw(frame->Data(), count, address);
+        }
+        std::fill(frame->Data() + loaded, frame->Data() + kFrameSize, 0);
+        pool_.Install(frame, block);
+        return frame;
+    }
+
+    // Returns nullptr if batches have to be done synchronously
+    IoRing* Ring() const {
+        if (ring_ == nullptr && !ring_failed_ && io_depth_ > 1) {
+            try {
+                ring_ = std::make_unique<IoRing>(static_cast<unsigned>(io_depth_));
+            } catch (const error::IoError& e) {
+                WARN("Falling back to synchronous I/O for ", fileName_, ": ", e.what());
+                ring_failed_ = true;
+            }
+        }
+        return ring_.get();
+    }
+
+    void Transfer(std::vector<IoRequest>& requests, bool write) const {
+        if (auto ring = Ring(); ring != nullptr) {
+            ring->Run(fd_, requests, write);
+            return;
+        }
+        for (auto& request : requests) {
+            if (write) {
+                WriteRaw(request.data, request.count, request.offset);
+                request.done = request.count;
+            } else {
+                request.done = ReadRaw(request.data, request.count, request.offset);
+            }
+        }
+    }
+
+    void FlushFrames() {
+        std::vector<IoRequest> requests;
+        std::vector<BufferPool::Frame*> frames;
+        Lsn lsn = 0;
+        pool_.VisitDirty([this, &requests, &frames, &lsn](BufferPool::Frame& frame) {
+            if (frame.IsHeld()) {
+                return;
+            }
+            lsn = std::max(lsn, frame.GetLsn());
+            auto address = GetBlockAddress(frame.Block());
+            if (address < size_) {
+                auto count = std::min<size_t>(kFrameSize, size_ - address);
+                requests.push_back({frame.Data(), count, address});
+            }
+            frames.push_back(&frame);
+        });
+        if (journal_ != nullptr && lsn != 0) {
+            journal_->Force(lsn);
+        }
+        Transfer(requests, true);
+        for (auto frame : frames) {
+            frame->MarkClean();
+        }
+    }
+
+    bool ReadCached(char* data, size_t count, BlockIndex block, size_t in_frame) const {
+        std::shared_lock lock(mutex_);
+        auto frame = pool_.Lookup(block);
+        if (frame == nullptr) {
+            return false;
+        }
+        std::memcpy(data, frame->Data() + in_frame, count);
+        return true;
+    }
 
-    Offset Seek(Offset offset) const {
-        Offset new_offset = lseek64(fd_, offset, SEEK_SET);
-        if (new_offset == offset - 1) {
-            throw error::BadArgument("Wrong arguments");
+    template <typename T>
+    [[nodiscard]] static iovec ToIovec(const T& field) {
+        return {const_cast<T*>(&field), sizeof(T)};
+    }
+    [[nodiscard]] static iovec ToIovec(std::string_view field) {
+        return {const_cast<char*>(field.data()), field.size()};
+    }
+    [[nodiscard]] static iovec ToIovec(const std::string& field) {
+        return ToIovec(std::string_view(field));
+    }
+
+    // Writes into the staged range are collected in memory, see Stage
+    struct Staging {
+        Offset offset;
+        std::string data;
+        size_t end = 0;
+    };
+    std::optional<Staging> staging_;
+
+    bool WriteStaged(const iovec* vec, size_t count, Offset offset) {
+        if (!staging_.has_value() || offset < staging_->offset) {
+            return false;
+        }
+        auto position = static_cast<size_t>(offset - staging_->offset);
+        size_t total = 0;
+        for (size_t i = 0; i < count; ++i) {
+            total += vec[i].iov_len;
+        }
+        if (position + total > staging_->data.size()) {
+            return false;
+        }
+        for (size_t i = 0; i < count; ++i) {
+            std::memcpy(staging_->data.data() + position, vec[i].iov_base, vec[i].iov_len);
+            position += vec[i].iov_len;
+        }
+        staging_->end = std::max(staging_->end, position);
+        return true;
+    }
+
+    bool WriteStaged(const char* data, size_t count, Offset offset) {
+        iovec vec{const_cast<char*>(data), count};
+        return WriteStaged(&vec, 1, offset);
+    }
+
+protected:
+    virtual void ReadBytes(char* data, size_t count, Offset offset) const {
+        if (count == 0) {
+            return;
+        }
+        if (offset >= size_) {
+            throw error::IoError("Reached EOF");
+        }
+        if (!pool_.IsEnabled()) {
+            ReadRaw(data, count, offset);
+            return;
+        }
+        while (count != 0) {
+            auto block = static_cast<BlockIndex>(offset) / kFrameSize;
+            auto in_frame = static_cast<size_t>(offset) % kFrameSize;
+            auto chunk = std::min(count, kFrameSize - in_frame);
+            // Hits are served under shared lock, only misses serialize readers
+            if (!ReadCached(data, chunk, block, in_frame)) {
+                std::unique_lock lock(mutex_);
+                std::memcpy(data, FetchFrame(block)->Data() + in_frame, chunk);
+            }
+            data += chunk;
+            offset += static_cast<Offset>(chunk);
+            count -= chunk;
+        }
+    }
+
+    virtual void WriteBytes(const char* data, size_t count, Offset offset) {
+        std::unique_lock lock(mutex_);
+        if (!pool_.IsEnabled()) {
+            WriteRaw(data, count, offset);
+            GrowSize(offset + static_cast<Offset>(count));
+            return;
+        }
+        Lsn lsn = 0;
+        if (journal_ != nullptr) {
+            lsn = journal_->LogWrite(offset, data, count);
+        }
+        while (count != 0) {
+            auto block = static_cast<BlockIndex>(offset) / kFrameSize;
+            auto in_frame = static_cast<size_t>(offset) % kFrameSize;
+            auto chunk = std::min(count, kFrameSize - in_frame);
+            // Frame that is overwritten completely has not to be read from disk
+            auto frame = FetchFrame(block, chunk != kFrameSize);
+            std::memcpy(frame->Data() + in_frame, data, chunk);
+            if (journal_ != nullptr) {
+                // No-steal: the block can't be written back until the transaction commits
+                frame->MarkDirty(lsn);
+                pool_.Hold(frame);
+            } else {
+                frame->MarkDirty();
+            }
+            data += chunk;
+            offset += static_cast<Offset>(chunk);
+            count -= chunk;
+            GrowSize(offset);
+        }
+    }
+
+    // Scattered read into several buffers, single preadv when the file is not cached
+    virtual void ReadBytes(const iovec* vec, size_t count, Offset offset) const {
+        if (pool_.IsEnabled()) {
+            for (size_t i = 0; i < count; ++i) {
+                ReadBytes(static_cast<char*>(vec[i].iov_base), vec[i].iov_len, offset);
+                offset += static_cast<Offset>(vec[i].iov_len);
+            }
+            return;
+        }
+        if (offset >= size_) {
+            throw error::IoError("Reached EOF");
+        }
+        auto result = preadv64(fd_, vec, static_cast<int>(count), offset);
+        if (result == -1) {
+            throw error::IoError("Failed to read from file " + fileName_);
+        }
+        for (size_t i = 0; i < count; ++i) {
+            auto read = std::min(static_cast<size_t>(result), vec[i].iov_len);
+            std::fill(static_cast<char*>(vec[i].iov_base) + read,
+                      static_cast<char*>(vec[i].iov_base) + vec[i].iov_len, 0);
+            result -= static_cast<ssize_t>(read);
+        }
+    }
+
+    // Gathered write of several buffers, single pwritev when the file is not cached
+    virtual void WriteBytes(const iovec* vec, size_t count, Offset offset) {
+        if (pool_.IsEnabled()) {
+            for (size_t i = 0; i < count; ++i) {
+                WriteBytes(static_cast<const char*>(vec[i].iov_base), vec[i].iov_len, offset);
+                offset += static_cast<Offset>(vec[i].iov_len);
+            }
+            return;
+        }
+        std::unique_lock lock(mutex_);
+        size_t total = 0;
+        for (size_t i = 0; i < count; ++i) {
+            total += vec[i].iov_len;
+        }
+        if (pwritev64(fd_, vec, static_cast<int>(count), offset) != static_cast<ssize_t>(total)) {
+            throw error::IoError("Failed to write to file " + fileName_);
         }
-        return new_offset;
+        GrowSize(offset + static_cast<Offset>(total));
+    }
+
+    // Called under exclusive lock
+    virtual void Resize(Offset size) {
+        if (journal_ != nullptr && size < size_) {
+            // Committed blocks must stay on the disk until the transaction commits
+            stale_from_ = std::min(stale_from_, size);
+        } else if (journal_ == nullptr || size > GetRealSize()) {
+            // Blocks of the grown range are reserved on the disk at once, so the file is less
+            // fragmented. Truncation is left for shrinking and for file systems without fallocate
+            if ((size <= size_ || fallocate64(fd_, 0, size_, size - size_) != 0) &&
+                ftruncate64(fd_, size) != 0) {
+                throw error::IoError("Can't resize file " + fileName_);
+            }
+        }
+        if (size < size_) {
+            auto block = static_cast<BlockIndex>(size) / kFrameSize;
+            auto in_frame = static_cast<size_t>(size) % kFrameSize;
+            if (in_frame != 0) {
+                if (auto frame = pool_.Lookup(block); frame != nullptr) {
+                    std::fill(frame->Data() + in_frame, frame->Data() + kFrameSize, 0);
+                }
+                ++block;
+            }
+            pool_.Discard(block);
+        }
+        size_ = size;
+    }
+
+    // File without a descriptor of its own, the subclass serves its bytes
+    File(std::string fileName, Offset size, DEFAULT_LOGGER(logger))
+        : LOGGER(logger), fd_(-1), fileName_(std::move(fileName)) {
+        size_ = size;
+        pool_.SetBudget(0);
     }
 
 public:
     using Ptr = util::Ptr<mem::File>;
 
+    // Direct read access to the file memory, cached frame stays in the pool while the handle is
+    // alive. Changes go through Write, so the journal sees them
+    class Pin {
+        BufferPool* pool_;
+        BufferPool::Frame* frame_;
+        const char* data_;
+        size_t size_;
+
+    public:
+        Pin(BufferPool* pool, BufferPool::Frame* frame, size_t in_frame)
+            : pool_(pool),
+              frame_(frame),
+              data_(frame->Data() + in_frame),
+              size_(kFrameSize - in_frame) {
+            pool_->Pin(frame_);
+        }
+        // Memory that is not owned by the cache, e.g. mapped file
+        Pin(const char* data, size_t size)
+            : pool_(nullptr), frame_(nullptr), data_(data), size_(size) {
+        }
+        Pin(Pin&& other) noexcept
+            : pool_(other.pool_),
+              frame_(std::exchange(other.frame_, nullptr)),
+              data_(other.data_),
+              size_(other.size_) {
+        }
+        Pin(const Pin&) = delete;
+        Pin& operator=(const Pin&) = delete;
+        Pin& operator=(Pin&&) = delete;
+        ~Pin() {
+            if (frame_ != nullptr) {
+                pool_->Unpin(frame_);
+            }
+        }
+
+        [[nodiscard]] const char* Data() const noexcept {
+            return data_;
+        }
+        // Bytes available until the end of the frame or mapping
+        [[nodiscard]] size_t Size() const noexcept {
+            return size_;
+        }
+    };
+
     explicit File(std::string&& fileName, DEFAULT_LOGGER(logger))
         : LOGGER(logger), fileName_(std::move(fileName)) {
         fd_ = open(fileName_.c_str(), O_RDWR | O_CREAT, S_IRWXU | S_IRGRP | S_IROTH);
         if (fd_ == -1) {
             throw error::IoError("File could not be opened");
         }
+        size_ = GetRealSize();
     }
     explicit File(const std::string& fileName, DEFAULT_LOGGER(logger))
         : File(std::string(fileName), logger) {
     }
-    ~File() {
-        close(fd_);
+    virtual ~File() {
+        try {
+            Flush();
+        } catch (const error::Error& e) {
+            ERROR("Can't flush file ", fileName_, " on close: ", e.what());
+        }
+        if (fd_ != -1) {
+            close(fd_);
+        }
     }
 
     [[nodiscard]] std::string GetFilename() const {
@@ -52,67 +475,306 @@ public:
     }
 
     [[nodiscard]] Offset GetSize() const {
+        return size_;
+    }
 
-        // TODO: Adapt for Windows
-        struct stat64 file_stat;
-        if (fstat64(fd_, &file_stat) != 0) {
-            throw error::BadArgument("Failed to get file " + fileName_ + "size.");
+    [[nodiscard]] size_t GetCacheBudget() const {
+        return pool_.GetBudget();
+    }
+
+    [[nodiscard]] const BufferPool& GetCache() const {
+        return pool_;
+    }
+
+    // Zero budget turns the cache off, so every access becomes a syscall
+    virtual void SetCacheBudget(size_t budget) {
+        DEBUG("Cache budget: ", budget);
+        std::unique_lock lock(mutex_);
+        if (journal_ != nullptr && budget == 0) {
+            throw error::BadArgument("Journaled file " + fileName_ + " must be cached");
         }
+        FlushFrames();
+        pool_.SetBudget(budget);
+        pool_.Shrink();
+    }
 
-        return file_stat.st_size;
+    // Frames held by an open transaction are not written
+    virtual void Flush() {
+        std::unique_lock lock(mutex_);
+        FlushFrames();
+    }
+
+    virtual void Sync() {
+        Flush();
+        if (fdatasync(fd_) != 0) {
+            throw error::IoError("Can't sync file " + fileName_);
+        }
+    }
+
+    // Syncs the file for a checkpoint. Returns the oldest LSN of the changes that are left in the
+    // cache by an open transaction
+    Lsn SyncCommitted() {
+        auto oldest = std::numeric_limits<Lsn>::max();
+        {
+            std::unique_lock lock(mutex_);
+            FlushFrames();
+            pool_.VisitHeld([&oldest](BufferPool::Frame& frame) {
+                if (frame.IsDirty() && frame.GetRecLsn() != 0) {
+                    oldest = std::min(oldest, frame.GetRecLsn());
+                }
+            });
+        }
+        if (fdatasync(fd_) != 0) {
+            throw error::IoError("Can't sync file " + fileName_);
+        }
+        return oldest;
+    }
+
+    // Writes the bytes to the disk at once, the cached copy is updated but stays as dirty as it
+    // was. The range must be inside the file and must not be journaled
+    template <typename T>
+    void WriteThrough(const T& data, Offset offset) {
+        std::unique_lock lock(mutex_);
+        if (offset + static_cast<Offset>(sizeof(T)) > size_) {
+            throw error::IoError("Reached EOF");
+        }
+        WriteRaw(reinterpret_cast<const char*>(&data), sizeof(T), offset);
+        for (size_t done = 0; done != sizeof(T);) {
+            auto address = offset + static_cast<Offset>(done);
+            auto in_frame = static_cast<size_t>(address) % kFrameSize;
+            auto chunk = std::min(sizeof(T) - done, kFrameSize - in_frame);
+            auto block = static_cast<BlockIndex>(address) / kFrameSize;
+            if (pool_.Contains(block)) {
+                std::memcpy(pool_.Lookup(block)->Data() + in_frame,
+                            reinterpret_cast<const char*>(&data) + done, chunk);
+            }
+            done += chunk;
+        }
+    }
+
+    // Returns previous access pattern
+    virtual Access Advise(Access access) {
+        if (access == access_) {
+            return access_;
+        }
+        auto advice = POSIX_FADV_NORMAL;
+        switch (access) {
+            case Access::kSequential:
+                advice = POSIX_FADV_SEQUENTIAL;
+                break;
+            case Access::kRandom:
+                advice = POSIX_FADV_RANDOM;
+                break;
+            default:
+                break;
+        }
+        if (posix_fadvise(fd_, 0, 0, advice) != 0) {
+            WARN("Can't advise access pattern for file ", fileName_);
+        }
+        return std::exchange(access_, access);
+    }
+
+    [[nodiscard]] Access GetAccess() const {
+        return access_;
+    }
+
+    [[nodiscard]] virtual Pin PinBlock(Offset offset) {
+        if (!pool_.IsEnabled()) {
+            throw error::RuntimeError("Cache of " + fileName_ + " is disabled");
+        }
+        if (offset >= size_) {
+            throw error::IoError("Reached EOF");
+        }
+        std::unique_lock lock(mutex_);
+        return Pin(&pool_, FetchFrame(static_cast<BlockIndex>(offset) / kFrameSize),
+                   static_cast<size_t>(offset) % kFrameSize);
+    }
+
+    // Journal sees every write of the file, blocks changed by a transaction are held in the cache
+    // until ReleaseHeldFrames, so the file has to be cached
+    virtual void SetJournal(Journal::Ptr journal) {
+        std::unique_lock lock(mutex_);
+        if (journal != nullptr && !pool_.IsEnabled()) {
+            throw error::BadArgument("Journaled file " + fileName_ + " must be cached");
+        }
+        journal_ = std::move(journal);
+    }
+
+    [[nodiscard]] const Journal::Ptr& GetJournal() const {
+        return journal_;
+    }
+
+    // Called after commit, blocks changed by the transaction can be written back since then
+    void ReleaseHeldFrames() {
+        std::unique_lock lock(mutex_);
+        if (stale_from_ != std::numeric_limits<Offset>::max()) {
+            // Commit must be durable before committed blocks are cut off
+            journal_->Force(std::numeric_limits<Lsn>::max());
+            if (ftruncate64(fd_, stale_from_) != 0 || ftruncate64(fd_, size_) != 0) {
+                throw error::IoError("Can't resize file " + fileName_);
+            }
+            stale_from_ = std::numeric_limits<Offset>::max();
+        }
+        pool_.ReleaseHeld();
+        if (pool_.GetSize() > pool_.GetCapacity()) {
+            FlushFrames();
+            pool_.Trim();
+        }
+    }
+
+    // Called after abort, changes of the transaction are lost
+    void DropHeldFrames() {
+        std::unique_lock lock(mutex_);
+        pool_.VisitHeld([this](BufferPool::Frame& frame) { pool_.Invalidate(&frame); });
+        pool_.ReleaseHeld();
+        pool_.Trim();
+        stale_from_ = std::numeric_limits<Offset>::max();
+    }
+
+    [[nodiscard]] size_t GetIoDepth() const {
+        return io_depth_;
+    }
+
+    // Number of requests kept in flight by batched I/O, also used as readahead window in pages.
+    // Depth of 0 or 1 makes batches synchronous
+    void SetIoDepth(size_t depth) {
+        DEBUG("I/O depth: ", depth);
+        std::unique_lock lock(mutex_);
+        io_depth_ = depth;
+        ring_.reset();
+        ring_failed_ = false;
+    }
+
+    [[nodiscard]] virtual bool IsCached(Offset offset) const {
+        std::shared_lock lock(mutex_);
+        return pool_.Contains(static_cast<BlockIndex>(offset) / kFrameSize);
+    }
+
+    // Loads the blocks of the range into the cache by a single batch. It is only a hint: blocks out
+    // of the file are skipped and at most half of the cache is filled
+    virtual void Prefetch(Offset offset, size_t count) {
+        if (!pool_.IsEnabled() || count == 0) {
+            return;
+        }
+        std::unique_lock lock(mutex_);
+        auto loadable = GetLoadableSize();
+        auto end = std::min(offset + static_cast<Offset>(count), loadable);
+        auto limit = std::max<size_t>(pool_.GetCapacity() / 2, 1);
+        std::vector<IoRequest> requests;
+        std::vector<BufferPool::Frame*> frames;
+        for (auto block = static_cast<BlockIndex>(std::max<Offset>(offset, 0)) / kFrameSize;
+             GetBlockAddress(block) < end && frames.size() < limit; ++block) {
+            if (pool_.Contains(block)) {
+                continue;
+            }
+            auto frame = pool_.Victim();
+            if (frame == nullptr) {
+                break;
+            }
+            if (frame->IsDirty()) {
+                WriteBack(*frame);
+            }
+            pool_.Install(frame, block);
+            pool_.Pin(frame);
+            frames.push_back(frame);
+            auto address = GetBlockAddress(block);
+            requests.push_back(
+                {frame->Data(), std::min<size_t>(kFrameSize, loadable - address), address});
+        }
+        DEBUG("Prefetching ", frames.size(), " blocks");
+        try {
+            Transfer(requests, false);
+        } catch (...) {
+            for (auto frame : frames) {
+                pool_.Unpin(frame);
+                pool_.Invalidate(frame);
+            }
+            throw;
+        }
+        for (size_t i = 0; i < frames.size(); ++i) {
+            std::fill(frames[i]->Data() + requests[i].done, frames[i]->Data() + kFrameSize, 0);
+            pool_.Unpin(frames[i]);
+        }
+    }
+
+    // Following writes inside the range are collected in memory and written by Unstage with a
+    // single call, from the beginning of the range up to the last staged byte. Reads don't see
+    // the staged bytes, the range is owned by the writer until Unstage
+    void Stage(Offset offset, size_t count) {
+        if (staging_.has_value()) {
+            throw error::RuntimeError("Range is already staged");
+        }
+        staging_ = Staging{offset, std::string(count, '\0')};
+    }
+
+    // Staged bytes are dropped if write is false
+    void Unstage(bool write = true) {
+        if (!staging_.has_value()) {
+            return;
+        }
+        auto staging = std::move(staging_.value());
+        staging_.reset();
+        if (write && staging.end != 0) {
+            WriteBytes(staging.data.data(), staging.end, staging.offset);
+        }
     }
 
     void Truncate(Offset size) {
         DEBUG("Truncating, current size: ", GetSize());
-        if (ftruncate64(fd_, GetSize() - size) != 0) {
-            throw error::IoError("Can't truncate file " + fileName_);
-        }
+        std::unique_lock lock(mutex_);
+        Resize(GetSize() - size);
         DEBUG("Truncating, current size: ", GetSize());
     }
 
     void Extend(Offset size) {
         DEBUG("Extending, current size: ", GetSize());
-        if (ftruncate64(fd_, GetSize() + size) != 0) {
-            throw error::IoError("Can't extend file " + fileName_);
-        }
+        std::unique_lock lock(mutex_);
+        Resize(GetSize() + size);
     }
     void Clear() {
         DEBUG("Clear");
-        if (ftruncate64(fd_, 0) != 0) {
-            throw error::IoError("Can't clear file " + fileName_);
-        }
+        std::unique_lock lock(mutex_);
+        Resize(0);
     }
 
     template <typename T>
     Offset Write(const T& data, Offset offset = 0, StructOffset struct_offset = 0,
                  StructOffset count = sizeof(T)) {
         count = std::min(count, sizeof(T) - struct_offset);
-        auto new_offset = Seek(offset);
-        if (write(fd_, reinterpret_cast<const char*>(&data) + struct_offset, count) == -1) {
-            throw error::IoError("Failed to write to file " + fileName_);
+        if (!WriteStaged(reinterpret_cast<const char*>(&data) + struct_offset, count, offset)) {
+            WriteBytes(reinterpret_cast<const char*>(&data) + struct_offset, count, offset);
         }
-        return new_offset;
+        return offset;
     }
 
     Offset Write(std::string str, Offset offset = 0, size_t from = 0,
                  size_t count = std::string::npos) {
         count = std::min(count, str.size() - from);
-        auto new_offset = Seek(offset);
-        if (write(fd_, str.data() + from, count) == -1) {
-            throw error::IoError("Failed to write to file " + fileName_);
+        if (!WriteStaged(str.data() + from, count, offset)) {
+            WriteBytes(str.data() + from, count, offset);
         }
-        return new_offset;
+        return offset;
     }
 
     template <typename T>
     Offset Write(const std::vector<T>& vec, Offset offset = 0, size_t from = 0,
                  StructOffset count = SIZE_MAX) {
         count = std::min(count, vec.size() - from);
-        auto new_offset = Seek(offset);
-        if (write(fd_, vec.data(), count * sizeof(T)) == -1) {
-            throw error::IoError("Failed to write to file " + fileName_);
+        auto data = reinterpret_cast<const char*>(vec.data() + from);
+        if (!WriteStaged(data, count * sizeof(T), offset)) {
+            WriteBytes(data, count * sizeof(T), offset);
         }
-        return new_offset;
+        return offset;
+    }
+
+    // Writes fields one after another by a single call, strings are written without size
+    template <typename... Ts>
+    Offset WriteFields(Offset offset, const Ts&... fields) {
+        std::array<iovec, sizeof...(Ts)> vec{ToIovec(fields)...};
+        if (!WriteStaged(vec.data(), vec.size(), offset)) {
+            WriteBytes(vec.data(), vec.size(), offset);
+        }
+        return offset;
     }
 
     template <typename T>
@@ -120,46 +782,69 @@ public:
         Offset offset = 0, StructOffset struct_offset = 0,
         StructOffset count = sizeof(T)) const requires std::is_default_constructible_v<T> {
         count = std::min(count, sizeof(T) - struct_offset);
-        Seek(offset);
         T data{};
-        auto result = read(fd_, reinterpret_cast<char*>(&data) + struct_offset, count);
-        if (result == -1) {
-            throw error::IoError("Failed to read from file " + fileName_);
-        }
-        if (result == 0) {
-            throw error::IoError("Reached EOF");
-        }
+        ReadBytes(reinterpret_cast<char*>(&data) + struct_offset, count, offset);
         return data;
     }
 
     [[nodiscard]] std::string ReadString(Offset offset = 0, size_t count = 0) const {
-        Seek(offset);
         std::string str;
         str.resize(count);
-        auto result = read(fd_, str.data(), count);
-        if (result == -1) {
-            throw error::IoError("Failed to read from file " + fileName_);
-        }
-        if (result == 0) {
-            throw error::IoError("Reached EOF");
-        }
+        ReadBytes(str.data(), count, offset);
         return str;
     }
 
     template <typename T>
     [[nodiscard]] std::vector<T> ReadVector(
         Offset offset = 0, size_t count = 0) const requires std::is_default_constructible_v<T> {
-        Seek(offset);
         std::vector<T> vec(count);
-        auto result = read(fd_, vec.data(), count * sizeof(T));
-        if (result == -1) {
-            throw error::IoError("Failed to read from file " + fileName_);
-        }
-        if (result == 0) {
-            throw error::IoError("Reached EOF");
-        }
+        ReadBytes(reinterpret_cast<char*>(vec.data()), count * sizeof(T), offset);
         return vec;
     }
+
+    // Reads consecutive fields by a single call
+    template <typename... Ts>
+    requires(std::is_trivially_copyable_v<Ts>&&...) void ReadFields(Offset offset,
+                                                                     Ts&... fields) const {
+        std::array<iovec, sizeof...(Ts)> vec{ToIovec(fields)...};
+        ReadBytes(vec.data(), vec.size(), offset);
+    }
+};
+
+// Stages the range of the file for the scope lifetime, staged bytes are written by Commit and
+// dropped if the scope is left by exception
+class StagedWrite {
+    File::Ptr file_;
+
+public:
+    StagedWrite(const File::Ptr& file, Offset offset, size_t count) : file_(file) {
+        file_->Stage(offset, count);
+    }
+    StagedWrite(const StagedWrite&) = delete;
+    StagedWrite& operator=(const StagedWrite&) = delete;
+    ~StagedWrite() {
+        file_->Unstage(false);
+    }
+
+    void Commit() {
+        file_->Unstage();
+    }
+};
+
+// Sets access pattern of the file for the scope lifetime
+class ScopedAccess {
+    File::Ptr file_;
+    Access previous_;
+
+public:
+    ScopedAccess(const File::Ptr& file, Access access)
+        : file_(file), previous_(file_->Advise(access)) {
+    }
+    ScopedAccess(const ScopedAccess&) = delete;
+    ScopedAccess& operator=(const ScopedAccess&) = delete;
+    ~ScopedAccess() {
+        file_->Advise(previous_);
+    }
 };
 
-}  // namespace mem
\ No newline at end of file
+}  // namespace mem
@@ -0,0 +1,141 @@
+#pragma once
+
+#include <cstring>
+#include <limits>
+#include <map>
+#include <string>
+#include <type_traits>
+
+#include "file.hpp"
+
+namespace mem {
+
+constexpr inline size_t kDefaultHeaderCacheCapacity = 1 << 16;
+
+// Metadata of the file: page headers, list sentinels and counters, fields of class headers. The
+// records are kept in memory after the first read, changes of them are written back by Flush, so
+// a record changed many times by a transaction is written once at commit.
+//
+// Every metadata record must be accessed through the cache, always by the same type at the same
+// offset. Records are ordered by their offsets, so the ones of a page are dropped together when it
+// is freed. The cache is not thread safe, it is owned by the database together with the allocator
+class HeaderCache {
+    struct Entry {
+        std::string data;
+        bool dirty = false;
+    };
+
+    File::Ptr file_;
+    std::map<Offset, Entry> entries_;
+    size_t dirty_count_ = 0;
+    size_t capacity_;
+
+    template <typename T>
+    Entry& Find(Offset offset) {
+        auto it = entries_.find(offset);
+        if (it == entries_.end()) {
+            if (entries_.size() >= capacity_) {
+                Shrink();
+            }
+            it = entries_.emplace(offset, Entry{file_->ReadString(offset, sizeof(T))}).first;
+        } else if (it->second.data.size() != sizeof(T)) {
+            throw error::RuntimeError("Header of other type is cached at offset " +
+                                      std::to_string(offset));
+        }
+        return it->second;
+    }
+
+    // Clean records are dropped, the dirty ones stay until Flush
+    void Shrink() {
+        std::erase_if(entries_, [](const auto& entry) { return !entry.second.dirty; });
+    }
+
+public:
+    using Ptr = util::Ptr<HeaderCache>;
+
+    explicit HeaderCache(const File::Ptr& file, size_t capacity = kDefaultHeaderCacheCapacity)
+        : file_(file), capacity_(capacity) {
+    }
+
+    [[nodiscard]] File::Ptr& GetFile() {
+        return file_;
+    }
+
+    [[nodiscard]] bool Contains(Offset offset) const {
+        return entries_.contains(offset);
+    }
+
+    [[nodiscard]] size_t GetDirtyCount() const {
+        return dirty_count_;
+    }
+
+    template <typename T>
+    requires std::is_trivially_copyable_v<T>
+    [[nodiscard]] T Read(Offset offset) {
+        auto& entry = Find<T>(offset);
+        T value;
+        std::memcpy(&value, entry.data.data(), sizeof(T));
+        return value;
+    }
+
+    template <typename T>
+    requires std::is_trivially_copyable_v<T>
+    void Write(const T& value, Offset offset) {
+        auto it = entries_.find(offset);
+        if (it == entries_.end()) {
+            if (entries_.size() >= capacity_) {
+                Shrink();
+            }
+            it = entries_.emplace(offset, Entry{std::string(sizeof(T), '\0')}).first;
+        } else if (it->second.data.size() != sizeof(T)) {
+            throw error::RuntimeError("Header of other type is cached at offset " +
+                                      std::to_string(offset));
+        }
+        std::memcpy(it->second.data.data(), &value, sizeof(T));
+        if (!it->second.dirty) {
+            it->second.dirty = true;
+            ++dirty_count_;
+        }
+    }
+
+    // Writes changed records in the order of offsets
+    void Flush() {
+        if (dirty_count_ == 0) {
+            return;
+        }
+        for (auto& [offset, entry] : entries_) {
+            if (entry.dirty) {
+                file_->Write(entry.data, offset);
+                entry.dirty = false;
+                --dirty_count_;
+            }
+        }
+    }
+
+    // Drops the record, its changes are lost
+    void Invalidate(Offset offset) {
+        auto it = entries_.find(offset);
+        if (it != entries_.end()) {
+            dirty_count_ -= it->second.dirty ? 1 : 0;
+            entries_.erase(it);
+        }
+    }
+
+    // Drops the records in [from, to), their changes are lost. Records of a freed page must not
+    // be written over its next owner
+    void Invalidate(Offset from, Offset to) {
+        auto first = entries_.lower_bound(from);
+        auto last = entries_.lower_bound(to);
+        for (auto it = first; it != last; ++it) {
+            dirty_count_ -= it->second.dirty ? 1 : 0;
+        }
+        entries_.erase(first, last);
+    }
+
+    // Drops the records starting from the offset, the file is truncated
+    void Discard(Offset from) {
+        Invalidate(from, std::numeric_limits<Offset>::max());
+    }
+};
+
+}  // namespace mem
@@ -0,0 +1,195 @@
+#pragma once
+
+#include <sys/mman.h>
+
+#include <string_view>
+
+#include "file.hpp"
+
+namespace mem {
+
+// Address space reserved for the mapping, so the file can grow without moving it
+constexpr inline size_t kDefaultMappingReserve = size_t{1} << 36;
+
+// File that is mapped to the memory: reads and writes are bounds-checked memcpy and no syscalls
+// are made unless the file changes its size. Not cached by the buffer pool, the kernel page cache
+// is used instead
+class MappedFile : public File {
+    char* base_ = nullptr;
+    size_t reserved_;
+    size_t mapped_ = 0;
+
+    [[nodiscard]] static size_t AlignUp(size_t size) {
+        return (size + kFrameSize - 1) / kFrameSize * kFrameSize;
+    }
+
+    void Reserve(size_t reserve) {
+        auto base = mmap(nullptr, reserve, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE,
+                         -1, 0);
+        if (base == MAP_FAILED) {
+            throw error::IoError("Can't reserve address space for file " + fileName_);
+        }
+        base_ = static_cast<char*>(base);
+        reserved_ = reserve;
+        mapped_ = 0;
+    }
+
+    void Map(size_t size) {
+        auto aligned = AlignUp(size);
+        if (aligned > reserved_) {
+            // Out of reserved range, the whole mapping is moved so pinned memory becomes invalid
+            WARN("Mapping of ", fileName_, " is out of reserved range, remapping");
+            munmap(base_, reserved_);
+            Reserve(std::max(aligned, 2 * reserved_));
+        }
+        if (aligned > mapped_) {
+            auto result = mmap(base_ + mapped_, aligned - mapped_, PROT_READ | PROT_WRITE,
+                               MAP_SHARED | MAP_FIXED, fd_, static_cast<Offset>(mapped_));
+            if (result == MAP_FAILED) {
+                throw error::IoError("Can't map file " + fileName_);
+            }
+        } else if (aligned < mapped_) {
+            auto result = mmap(base_ + aligned, mapped_ - aligned, PROT_NONE,
+                               MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED | MAP_NORESERVE, -1, 0);
+            if (result == MAP_FAILED) {
+                throw error::IoError("Can't unmap file " + fileName_);
+            }
+        }
+        mapped_ = aligned;
+        if (access_ != Access::kNormal) {
+            Apply(access_);
+        }
+    }
+
+    void Apply(Access access) {
+        if (mapped_ == 0) {
+            return;
+        }
+        auto advice = MADV_NORMAL;
+        switch (access) {
+            case Access::kSequential:
+                advice = MADV_SEQUENTIAL;
+                break;
+            case Access::kRandom:
+                advice = MADV_RANDOM;
+                break;
+            default:
+                break;
+        }
+        if (madvise(base_, mapped_, advice) != 0) {
+            WARN("Can't advise access pattern for file ", fileName_);
+        }
+    }
+
+    void CheckBounds(Offset offset, size_t count) const {
+        if (offset < 0 || offset + static_cast<Offset>(count) > size_) {
+            throw error::IoError("Access out of file " + fileName_ + " bounds");
+        }
+    }
+
+protected:
+    void ReadBytes(char* data, size_t count, Offset offset) const override {
+        if (count == 0) {
+            return;
+        }
+        // Mapping can be moved by resize
+        std::shared_lock lock(mutex_);
+        if (offset >= size_) {
+            throw error::IoError("Reached EOF");
+        }
+        auto available = std::min(count, static_cast<size_t>(size_ - offset));
+        std::memcpy(data, base_ + offset, available);
+        std::fill(data + available, data + count, 0);
+    }
+
+    void WriteBytes(const char* data, size_t count, Offset offset) override {
+        std::unique_lock lock(mutex_);
+        if (offset + static_cast<Offset>(count) > size_) {
+            Resize(offset + static_cast<Offset>(count));
+        }
+        std::memcpy(base_ + offset, data, count);
+    }
+
+    void ReadBytes(const iovec* vec, size_t count, Offset offset) const override {
+        for (size_t i = 0; i < count; ++i) {
+            ReadBytes(static_cast<char*>(vec[i].iov_base), vec[i].iov_len, offset);
+            offset += static_cast<Offset>(vec[i].iov_len);
+        }
+    }
+
+    void WriteBytes(const iovec* vec, size_t count, Offset offset) override {
+        for (size_t i = 0; i < count; ++i) {
+            WriteBytes(static_cast<const char*>(vec[i].iov_base), vec[i].iov_len, offset);
+            offset += static_cast<Offset>(vec[i].iov_len);
+        }
+    }
+
+    void Resize(Offset size) override {
+        if (ftruncate64(fd_, size) != 0) {
+            throw error::IoError("Can't resize file " + fileName_);
+        }
+        Map(static_cast<size_t>(size));
+        size_ = size;
+    }
+
+public:
+    using Ptr = util::Ptr<MappedFile>;
+
+    explicit MappedFile(const std::string& fileName, DEFAULT_LOGGER(logger),
+                        size_t reserve = kDefaultMappingReserve)
+        : File(fileName, logger) {
+        pool_.SetBudget(0);
+        Reserve(std::max(reserve, AlignUp(static_cast<size_t>(size_))));
+        Map(static_cast<size_t>(size_));
+    }
+
+    ~MappedFile() override {
+        munmap(base_, reserved_);
+    }
+
+    void SetCacheBudget([[maybe_unused]] size_t budget) override {
+        WARN("Mapped file ", fileName_, " is not cached");
+    }
+
+    void Flush() override {
+    }
+
+    void Sync() override {
+        if (mapped_ != 0 && msync(base_, mapped_, MS_SYNC) != 0) {
+            throw error::IoError("Can't sync file " + fileName_);
+        }
+    }
+
+    Access Advise(Access access) override {
+        std::shared_lock lock(mutex_);
+        Apply(access);
+        return std::exchange(access_, access);
+    }
+
+    // Page cache of the mapping is managed by the kernel
+    [[nodiscard]] bool IsCached([[maybe_unused]] Offset offset) const override {
+        return true;
+    }
+
+    void Prefetch(Offset offset, size_t count) override {
+        std::shared_lock lock(mutex_);
+        auto begin = static_cast<size_t>(offset) / kFrameSize * kFrameSize;
+        auto end = std::min(static_cast<size_t>(offset) + count, mapped_);
+        if (begin < end && madvise(base_ + begin, end - begin, MADV_WILLNEED) != 0) {
+            WARN("Can't prefetch file ", fileName_);
+        }
+    }
+
+    [[nodiscard]] Pin PinBlock(Offset offset) override {
+        CheckBounds(offset, 1);
+        return Pin(base_ + offset, static_cast<size_t>(size_ - offset));
+    }
+
+    // Zero-copy view of the file bytes, valid until the file is resized over reserved range
+    [[nodiscard]] std::string_view View(Offset offset, size_t count) const {
+        CheckBounds(offset, count);
+        return {base_ + offset, count};
+    }
+};
+
+}  // namespace mem
@@ -1,7 +1,9 @@
 #pragma once
 #include <cstddef>
+#include <string>
 
 #include "file.hpp"
+#include "headercache.hpp"
 #include "page.hpp"
 
 namespace mem {
@@ -10,24 +12,37 @@ using GlobalMagic = uint64_t;
 constexpr inline GlobalMagic kMagic = 0xDEADBEEF;
 
 // Constant offsets of some data in superblock for more precise changes
-constexpr Offset kFreeListSentinelOffset = sizeof(GlobalMagic);
-constexpr Offset kFreePagesCountOffset =
-    kFreeListSentinelOffset + static_cast<Offset>(sizeof(Page));
-constexpr Offset kPagesCountOffset = kFreePagesCountOffset + static_cast<Offset>(sizeof(Offset));
+// Bitmap pages of the free space are linked to the superblock, see PageAllocator
+constexpr Offset kFreeSpaceSentinelOffset = sizeof(GlobalMagic);
+constexpr Offset kFreeSpacePagesOffset =
+    kFreeSpaceSentinelOffset + static_cast<Offset>(sizeof(Page));
+constexpr Offset kPagesCountOffset = kFreeSpacePagesOffset + static_cast<Offset>(sizeof(Offset));
 constexpr Offset kClassListSentinelOffset = kPagesCountOffset + static_cast<Offset>(sizeof(size_t));
 constexpr Offset kClassListCount = kClassListSentinelOffset + static_cast<Offset>(sizeof(Page));
 
-constexpr Offset kPagetableOffset = kClassListCount + static_cast<Offset>(sizeof(size_t));
+// LSN of the log record that recovery starts from, written by checkpoint only
+constexpr Offset kCheckpointLsnOffset = kClassListCount + static_cast<Offset>(sizeof(size_t));
+
+// Page size of the build that created the file, zero in files created before it was recorded
+constexpr Offset kPageSizeOffset = kCheckpointLsnOffset + static_cast<Offset>(sizeof(Lsn));
+
+constexpr Offset kSuperblockEnd = kPageSizeOffset + static_cast<Offset>(sizeof(size_t));
+
+// Page table starts from the next frame after superblock, so every page is cached as a whole frame
+constexpr Offset kPagetableOffset = kPageSize;
+static_assert(kSuperblockEnd <= kPagetableOffset);
 
 constexpr PageIndex kSentinelIndex = SIZE_MAX;
 
 class Superblock {
 public:
-    Page free_list_sentinel_;
-    size_t free_pages_count_;
+    Page free_space_sentinel_;
+    size_t free_space_pages_;
     size_t pages_count;
     Page class_list_sentinel_;
     size_t class_list_count_;
+    Lsn checkpoint_lsn_;
+    size_t page_size_;
 
     void CheckConsistency(File::Ptr& file) {
         try {
@@ -46,21 +61,35 @@ public:
     Superblock& ReadSuperblock(File::Ptr& file) {
         CheckConsistency(file);
         auto header = file->Read<Superblock>(sizeof(kMagic));
+        // Files created before the page size was recorded have 4 KiB pages
+        auto page_size = header.page_size_ == 0 ? 4096 : header.page_size_;
+        // Database of another build is valid, so it is not a structure error that lets the
+        // default open mode rewrite the file
+        if (page_size != static_cast<size_t>(kPageSize)) {
+            throw error::RuntimeError("Database file " + file->GetFilename() + " has pages of " +
+                                      std::to_string(page_size) + " bytes, build has " +
+                                      std::to_string(kPageSize));
+        }
         std::swap(header, *this);
         return *this;
     }
 
     Superblock& InitSuperblock(File::Ptr& file) {
         file->Write<GlobalMagic>(kMagic);
-        free_list_sentinel_ = Page(kSentinelIndex);
-        free_list_sentinel_.type_ = PageType::kSentinel;
-        free_pages_count_ = 0;
+        free_space_sentinel_ = Page(kSentinelIndex);
+        free_space_sentinel_.type_ = PageType::kSentinel;
+        free_space_pages_ = 0;
         pages_count = 0;
         class_list_sentinel_ = Page(kSentinelIndex);
         class_list_count_ = 0;
         class_list_sentinel_.type_ = PageType::kSentinel;
+        checkpoint_lsn_ = 0;
+        page_size_ = static_cast<size_t>(kPageSize);
 
         file->Write<Superblock>(*this, sizeof(kMagic));
+        if (file->GetSize() < kPagetableOffset) {
+            file->Extend(kPagetableOffset - file->GetSize());
+        }
         return *this;
     }
     Superblock& WriteSuperblock(File::Ptr& file) {
@@ -70,6 +99,8 @@ public:
     }
 };
 
+static_assert(sizeof(GlobalMagic) + sizeof(Superblock) == kSuperblockEnd);
+
 constexpr inline Offset GetCountFromSentinel(Offset sentinel) {
     return sentinel + static_cast<Offset>(sizeof(Page));
 }
@@ -95,12 +126,53 @@ constexpr inline Offset GetPageAddress(PageIndex index) {
 
 using Magic = uint64_t;
 
+// Page lists of a class besides its node list
+enum class ClassList : size_t {
+    kDirectory,
+    kOutgoingHeads,
+    kOutgoingEdges,
+    kIncomingHeads,
+    kIncomingEdges,
+    kIndexes,
+    kHashIndexes,
+    kZones,
+    kFilters,
+    kOccupancy,
+    kOverflow,
+    kPages,
+    kCount
+};
+
+constexpr inline size_t kClassListsCount = static_cast<size_t>(ClassList::kCount);
+
+// Placement of the nodes in the data pages of a fixed size class, see db::NodeLayout
+enum class PageLayout : uint64_t { kRows, kColumns };
+
+// Sentinel of a page list followed by the count of its pages
+struct ListHead {
+    Page sentinel_;
+    size_t pages_count_;
+};
+
+// Fields of class header are separate records of the header cache, sentinels and counts of the
+// lists are shared with the lists
 class ClassHeader : public Page {
+    static constexpr size_t kIdOffset = 2 * sizeof(Page) + sizeof(size_t);
+    static constexpr size_t kMagicOffset = 2 * sizeof(Page) + 2 * sizeof(size_t);
+    static constexpr size_t kListsOffset = kMagicOffset + sizeof(Magic);
+    static constexpr size_t kLayoutOffset = kListsOffset + kClassListsCount * sizeof(ListHead);
+
+    [[nodiscard]] Offset GetFieldOffset(size_t offset) const {
+        return GetOffset(index_, static_cast<PageOffset>(offset));
+    }
+
 public:
     Page node_list_sentinel_;
     size_t node_pages_count_;
     size_t id_;
     Magic magic_;
+    ListHead lists_[kClassListsCount];
+    PageLayout layout_;
 
     ClassHeader() : Page() {
         this->type_ = PageType::kClassHeader;
@@ -114,36 +186,54 @@ public:
         return GetOffset(index_, sizeof(Page));
     }
 
-    // Should think about structure alignment in 4 following methods
+    Offset GetListSentinelOffset(ClassList list) {
+        return GetFieldOffset(kListsOffset + static_cast<size_t>(list) * sizeof(ListHead));
+    }
 
-    ClassHeader& WriteNodeId(File::Ptr& file, size_t count) {
+    ClassHeader& WriteNodeId(HeaderCache::Ptr& headers, size_t count) {
         id_ = count;
-        file->Write<size_t>(id_, GetOffset(index_, 2 * sizeof(Page) + sizeof(size_t)));
+        headers->Write<size_t>(id_, GetFieldOffset(kIdOffset));
         return *this;
     }
 
-    ClassHeader& WriteMagic(File::Ptr& file, Magic magic) {
+    ClassHeader& WriteMagic(HeaderCache::Ptr& headers, Magic magic) {
         magic_ = magic;
-        file->Write<Magic>(magic_, GetOffset(index_, 2 * sizeof(Page) + 2 * sizeof(size_t)));
+        headers->Write<Magic>(magic_, GetFieldOffset(kMagicOffset));
         return *this;
     }
 
-    ClassHeader& ReadNodeId(File::Ptr& file) {
-        id_ = file->Read<size_t>(GetOffset(index_, 2 * sizeof(Page) + sizeof(size_t)));
+    ClassHeader& WriteLayout(HeaderCache::Ptr& headers, PageLayout layout) {
+        layout_ = layout;
+        headers->Write<PageLayout>(layout_, GetFieldOffset(kLayoutOffset));
         return *this;
     }
 
-    ClassHeader& ReadMagic(File::Ptr& file) {
-        magic_ = file->Read<Magic>(GetOffset(index_, 2 * sizeof(Page) + 2 * sizeof(size_t)));
+    ClassHeader& ReadNodeId(HeaderCache::Ptr& headers) {
+        id_ = headers->Read<size_t>(GetFieldOffset(kIdOffset));
         return *this;
     }
 
-    ClassHeader& ReadClassHeader(File::Ptr& file) {
-        auto header = file->Read<ClassHeader>(GetPageAddress(index_));
-        std::swap(header, *this);
+    ClassHeader& ReadMagic(HeaderCache::Ptr& headers) {
+        magic_ = headers->Read<Magic>(GetFieldOffset(kMagicOffset));
         return *this;
     }
-    ClassHeader& InitClassHeader(File::Ptr& file, size_t size = 0) {
+
+    ClassHeader& ReadClassHeader(HeaderCache::Ptr& headers) {
+        static_cast<Page&>(*this) = headers->Read<Page>(GetPageAddress(index_));
+        node_list_sentinel_ = headers->Read<Page>(GetNodeListSentinelOffset());
+        node_pages_count_ =
+            headers->Read<size_t>(GetCountFromSentinel(GetNodeListSentinelOffset()));
+        ReadNodeId(headers);
+        ReadMagic(headers);
+        for (size_t i = 0; i < kClassListsCount; ++i) {
+            auto sentinel = GetListSentinelOffset(static_cast<ClassList>(i));
+            lists_[i].sentinel_ = headers->Read<Page>(sentinel);
+            lists_[i].pages_count_ = headers->Read<size_t>(GetCountFromSentinel(sentinel));
+        }
+        layout_ = headers->Read<PageLayout>(GetFieldOffset(kLayoutOffset));
+        return *this;
+    }
+    ClassHeader& InitClassHeader(HeaderCache::Ptr& headers, size_t size = 0) {
         this->type_ = PageType::kClassHeader;
         this->initialized_offset_ = static_cast<PageOffset>(sizeof(ClassHeader) + size);
         this->free_offset_ = sizeof(ClassHeader);
@@ -153,23 +243,41 @@ public:
         node_pages_count_ = 0;
         id_ = 0;
         magic_ = 0;
-        file->Write<ClassHeader>(*this, GetPageAddress(index_));
-        return *this;
+        for (auto& list : lists_) {
+            list.sentinel_ = Page(kSentinelIndex);
+            list.sentinel_.type_ = PageType::kSentinel;
+            list.pages_count_ = 0;
+        }
+        layout_ = PageLayout::kRows;
+        return WriteClassHeader(headers);
     }
-    ClassHeader& WriteClassHeader(File::Ptr& file) {
-        file->Write<ClassHeader>(*this, GetPageAddress(index_));
+    ClassHeader& WriteClassHeader(HeaderCache::Ptr& headers) {
+        headers->Write<Page>(*this, GetPageAddress(index_));
+        headers->Write<Page>(node_list_sentinel_, GetNodeListSentinelOffset());
+        headers->Write<size_t>(node_pages_count_,
+                               GetCountFromSentinel(GetNodeListSentinelOffset()));
+        WriteNodeId(headers, id_);
+        WriteMagic(headers, magic_);
+        for (size_t i = 0; i < kClassListsCount; ++i) {
+            auto sentinel = GetListSentinelOffset(static_cast<ClassList>(i));
+            headers->Write<Page>(lists_[i].sentinel_, sentinel);
+            headers->Write<size_t>(lists_[i].pages_count_, GetCountFromSentinel(sentinel));
+        }
+        WriteLayout(headers, layout_);
         return *this;
     }
 };
 
-inline Page ReadPage(Page other, File::Ptr& file) {
-    auto page = file->Read<Page>(GetPageAddress(other.index_));
-    std::swap(page, other);
-    return other;
+static_assert(sizeof(ClassHeader) == 2 * sizeof(Page) + 2 * sizeof(size_t) + sizeof(Magic) +
+                                         kClassListsCount * sizeof(ListHead) +
+                                         sizeof(PageLayout));
+
+inline Page ReadPage(Page other, HeaderCache::Ptr& headers) {
+    return headers->Read<Page>(GetPageAddress(other.index_));
 }
 
-inline Page WritePage(Page other, File::Ptr& file) {
-    file->Write<Page>(other, GetPageAddress(other.index_));
+inline Page WritePage(Page other, HeaderCache::Ptr& headers) {
+    headers->Write<Page>(other, GetPageAddress(other.index_));
     return other;
 }
 
@@ -0,0 +1,117 @@
+#pragma once
+
+#include <algorithm>
+#include <cstring>
+#include <string_view>
+#include <vector>
+
+#include "mem.hpp"
+
+namespace mem {
+
+// Overflow page keeps the index of the next page of its chain before the bytes
+constexpr inline size_t kOverflowPayload = kPageSize - sizeof(Page) - sizeof(PageIndex);
+
+[[nodiscard]] inline size_t GetOverflowPagesCount(size_t size) {
+    return (size + kOverflowPayload - 1) / kOverflowPayload;
+}
+
+// Bytes of an object too large for a page, spread over a chain of overflow pages, seen as a file
+// of their own. Object is written and read by its own methods, and only the pages of the bytes
+// that are accessed are read: reading the size of a long string touches just the first page
+class OverflowFile : public File {
+    File::Ptr file_;
+    // Pages of the chain known so far, the rest are found by the links
+    mutable std::vector<PageIndex> pages_;
+
+    [[nodiscard]] PageIndex GetPage(size_t number) const {
+        while (pages_.size() <= number) {
+            auto next = file_->Read<PageIndex>(GetOffset(pages_.back(), sizeof(Page)));
+            if (next == kSentinelIndex) {
+                throw error::StructureError("Overflow chain is broken");
+            }
+            pages_.push_back(next);
+        }
+        return pages_[number];
+    }
+
+    // Functor is called with the offset in the database file, the position in the range and the
+    // count of bytes of every piece of the range that lies in one page
+    template <typename Functor>
+    void VisitPieces(Offset offset, size_t count, Functor functor) const {
+        if (offset < 0 || offset + static_cast<Offset>(count) > size_) {
+            throw error::IoError("Access out of overflow chain");
+        }
+        size_t done = 0;
+        while (done != count) {
+            auto position = static_cast<size_t>(offset) + done;
+            auto in_page = position % kOverflowPayload;
+            auto piece = std::min(count - done, kOverflowPayload - in_page);
+            functor(GetOffset(GetPage(position / kOverflowPayload),
+                              static_cast<PageOffset>(sizeof(Page) + sizeof(PageIndex) + in_page)),
+                    done, piece);
+            done += piece;
+        }
+    }
+
+protected:
+    void ReadBytes(char* data, size_t count, Offset offset) const override {
+        VisitPieces(offset, count, [this, data](Offset real, size_t done, size_t piece) {
+            auto bytes = file_->ReadString(real, piece);
+            std::memcpy(data + done, bytes.data(), piece);
+        });
+    }
+
+    void WriteBytes(const char* data, size_t count, Offset offset) override {
+        VisitPieces(offset, count, [this, data](Offset real, size_t done, size_t piece) {
+            file_->WriteFields(real, std::string_view(data + done, piece));
+        });
+    }
+
+    void ReadBytes(const iovec* vec, size_t count, Offset offset) const override {
+        for (size_t i = 0; i < count; ++i) {
+            ReadBytes(static_cast<char*>(vec[i].iov_base), vec[i].iov_len, offset);
+            offset += static_cast<Offset>(vec[i].iov_len);
+        }
+    }
+
+    void WriteBytes(const iovec* vec, size_t count, Offset offset) override {
+        for (size_t i = 0; i < count; ++i) {
+            WriteBytes(static_cast<const char*>(vec[i].iov_base), vec[i].iov_len, offset);
+            offset += static_cast<Offset>(vec[i].iov_len);
+        }
+    }
+
+    void Resize([[maybe_unused]] Offset size) override {
+        throw error::NotImplemented("Overflow chain can't be resized");
+    }
+
+public:
+    // Chain of the given head and size in bytes
+    OverflowFile(const File::Ptr& file, PageIndex head, size_t size, DEFAULT_LOGGER(logger))
+        : File(file->GetFilename(), static_cast<Offset>(size), logger),
+          file_(file),
+          pages_{head} {
+    }
+
+    // Chain of the given pages, their links are written
+    OverflowFile(const File::Ptr& file, std::vector<PageIndex> pages, size_t size,
+                 DEFAULT_LOGGER(logger))
+        : File(file->GetFilename(), static_cast<Offset>(size), logger),
+          file_(file),
+          pages_(std::move(pages)) {
+        for (size_t i = 0; i < pages_.size(); ++i) {
+            file_->Write<PageIndex>(i + 1 < pages_.size() ? pages_[i + 1] : kSentinelIndex,
+                                    GetOffset(pages_[i], sizeof(Page)));
+        }
+    }
+
+    void Flush() override {
+    }
+
+    void Sync() override {
+        file_->Sync();
+    }
+};
+
+}  // namespace mem
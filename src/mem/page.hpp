@@ -5,9 +5,10 @@
 #include "file.hpp"
 
 namespace mem {
-inline const Offset kPageSize = 4096;
+inline const Offset kPageSize = DDB_PAGE_SIZE;
+static_assert(kPageSize == kFrameSize);
 
-enum class PageType { kClassHeader, kData, kFree, kSentinel };
+enum class PageType { kClassHeader, kData, kFree, kSentinel, kDirectory, kIndex, kOverflow };
 
 constexpr inline std::string_view PageTypeToString(PageType type) {
     switch (type) {
@@ -19,6 +20,12 @@ constexpr inline std::string_view PageTypeToString(PageType type) {
             return "Free";
         case PageType::kSentinel:
             return "Sentinel";
+        case PageType::kDirectory:
+            return "Directory";
+        case PageType::kIndex:
+            return "Index";
+        case PageType::kOverflow:
+            return "Overflow";
         default:
             return "";
     }
@@ -57,9 +64,22 @@ public:
     }
 };
 
-struct PageData {
-    Page page_header;
-    char bytes[kPageSize - sizeof(Page)];
+// Entry of the slot array of a page of variable size records, records are placed from the end of
+// the page down to the slots. Free slot has zero size, record of a large object is a stub of its
+// overflow chain and has the highest bit of the size set
+struct Slot {
+    static constexpr PageOffset kOverflow = PageOffset{1} << 31;
+
+    PageOffset offset_;
+    PageOffset size_;
+
+    [[nodiscard]] PageOffset Size() const {
+        return size_ & ~kOverflow;
+    }
+
+    [[nodiscard]] bool IsOverflow() const {
+        return (size_ & kOverflow) != 0;
+    }
 };
 
 }  // namespace mem
\ No newline at end of file
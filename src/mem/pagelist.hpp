@@ -7,16 +7,16 @@ class PageList {
 
     DECLARE_LOGGER;
     std::string name_;
-    File::Ptr file_;
+    HeaderCache::Ptr headers_;
     Offset sentinel_offset_;
     size_t pages_count_;
 
     void DecrementCount() {
-        file_->Write<size_t>(--pages_count_, GetCountFromSentinel(sentinel_offset_));
+        headers_->Write<size_t>(--pages_count_, GetCountFromSentinel(sentinel_offset_));
         DEBUG(name_, " Decremented page count, current: ", pages_count_);
     }
     void IncrementCount() {
-        file_->Write<size_t>(++pages_count_, GetCountFromSentinel(sentinel_offset_));
+        headers_->Write<size_t>(++pages_count_, GetCountFromSentinel(sentinel_offset_));
         DEBUG(name_, " Incremented page count, current: ", pages_count_);
     }
 
@@ -26,10 +26,32 @@ public:
     }
 
     class PageIterator {
-        File::Ptr file_;
+        HeaderCache::Ptr headers_;
         Offset sentinel_offset_;
         Page curr_;
 
+        // Pages of a list are mostly allocated one after another, so on a miss the pages next by
+        // index in the direction of the walk are loaded by a single batch
+        void Readahead(PageIndex index) {
+            auto& file = headers_->GetFile();
+            auto window = file->GetIoDepth();
+            auto address = GetPageAddress(index);
+            if (index >= kSentinelIndex || window <= 1 || headers_->Contains(address) ||
+                file->IsCached(address)) {
+                return;
+            }
+            auto from = index;
+            if (curr_.index_ != kSentinelIndex && curr_.index_ > index) {
+                from = index + 1 > window ? index + 1 - window : 0;
+            }
+            file->Prefetch(GetPageAddress(from), window * kPageSize);
+        }
+
+        void Step(PageIndex index) {
+            Readahead(index);
+            curr_ = ReadPage(index);
+        }
+
     public:
         using iterator_category = std::bidirectional_iterator_tag;
         using value_type = Page;
@@ -37,27 +59,27 @@ public:
         using pointer = Page*;
         using reference = Page&;
 
-        PageIterator(File::Ptr& file, PageIndex index, Offset sentinel_offset)
-            : file_(file), sentinel_offset_(sentinel_offset) {
+        PageIterator(HeaderCache::Ptr& headers, PageIndex index, Offset sentinel_offset)
+            : headers_(headers), sentinel_offset_(sentinel_offset) {
             curr_ = ReadPage(index);
         }
         PageIterator& operator++() {
-            curr_ = ReadPage(curr_.previous_page_index_);
+            Step(curr_.previous_page_index_);
             return *this;
         }
         PageIterator operator++(int) {
             auto temp = *this;
-            curr_ = ReadPage(curr_.previous_page_index_);
+            Step(curr_.previous_page_index_);
             return temp;
         }
 
         PageIterator& operator--() {
-            curr_ = ReadPage(curr_.next_page_index_);
+            Step(curr_.next_page_index_);
             return *this;
         }
         PageIterator operator--(int) {
             auto temp = *this;
-            curr_ = ReadPage(curr_.next_page_index_);
+            Step(curr_.next_page_index_);
             return temp;
         }
 
@@ -81,17 +103,17 @@ public:
 
         [[nodiscard]] Page ReadPage(PageIndex index) {
             if (index < kSentinelIndex) {
-                return mem::ReadPage(Page(index), file_);
+                return mem::ReadPage(Page(index), headers_);
             } else {
-                return file_->Read<Page>(sentinel_offset_);
+                return headers_->Read<Page>(sentinel_offset_);
             }
         }
 
         void WritePage() {
             if (curr_.index_ < kSentinelIndex) {
-                mem::WritePage(curr_, file_);
+                mem::WritePage(curr_, headers_);
             } else {
-                file_->Write<Page>(curr_, sentinel_offset_);
+                headers_->Write<Page>(curr_, sentinel_offset_);
             }
         }
     };
@@ -99,21 +121,29 @@ public:
     PageList() {
     }
 
-    PageList(std::string name, File::Ptr& file, Offset sentinel_offset, DEFAULT_LOGGER(logger))
-        : LOGGER(logger), name_(std::move(name)), file_(file), sentinel_offset_(sentinel_offset) {
-        pages_count_ = file_->Read<size_t>(GetCountFromSentinel(sentinel_offset));
+    PageList(std::string name, HeaderCache::Ptr& headers, Offset sentinel_offset,
+             DEFAULT_LOGGER(logger))
+        : LOGGER(logger),
+          name_(std::move(name)),
+          headers_(headers),
+          sentinel_offset_(sentinel_offset) {
+        pages_count_ = headers_->Read<size_t>(GetCountFromSentinel(sentinel_offset));
+    }
+
+    [[nodiscard]] HeaderCache::Ptr& GetHeaders() {
+        return headers_;
     }
 
     void Unlink(PageIndex index) {
-        auto it = PageIterator(file_, index, sentinel_offset_);
+        auto it = PageIterator(headers_, index, sentinel_offset_);
         if (it->next_page_index_ == it->index_ && it->previous_page_index_ == it->index_) {
             return;
         }
 
         DEBUG(name_, " Unlinking page ", index);
 
-        auto prev = PageIterator(file_, it->previous_page_index_, sentinel_offset_);
-        auto next = PageIterator(file_, it->next_page_index_, sentinel_offset_);
+        auto prev = PageIterator(headers_, it->previous_page_index_, sentinel_offset_);
+        auto next = PageIterator(headers_, it->next_page_index_, sentinel_offset_);
         prev->next_page_index_ = next->index_;
         next->previous_page_index_ = prev->index_;
         it->previous_page_index_ = it->index_;
@@ -134,9 +164,9 @@ public:
         // other_index must be from list, index must not be from list
         DEBUG(name_, " Linking page ", index, " before ", other_index);
 
-        auto it = PageIterator(file_, index, sentinel_offset_);
-        auto other = PageIterator(file_, other_index, sentinel_offset_);
-        auto prev = PageIterator(file_, other->previous_page_index_, sentinel_offset_);
+        auto it = PageIterator(headers_, index, sentinel_offset_);
+        auto other = PageIterator(headers_, other_index, sentinel_offset_);
+        auto prev = PageIterator(headers_, other->previous_page_index_, sentinel_offset_);
 
         it->next_page_index_ = other->index_;
         it->previous_page_index_ = prev->index_;
@@ -156,7 +186,7 @@ public:
 
     // Index must be in the list
     PageIterator IteratorTo(PageIndex index) {
-        return PageIterator(file_, index, sentinel_offset_);
+        return PageIterator(headers_, index, sentinel_offset_);
     }
 
     void PushBack(PageIndex index) {
@@ -183,23 +213,24 @@ public:
     }
 
     PageIterator Begin() {
-        return PageIterator(file_, file_->Read<Page>(sentinel_offset_).previous_page_index_,
+        return PageIterator(headers_, headers_->Read<Page>(sentinel_offset_).previous_page_index_,
                             sentinel_offset_);
     }
     PageIterator End() {
-        return PageIterator(file_, file_->Read<Page>(sentinel_offset_).index_, sentinel_offset_);
+        return PageIterator(headers_, headers_->Read<Page>(sentinel_offset_).index_,
+                            sentinel_offset_);
     }
     PageIterator RBegin() {
-        return PageIterator(file_, file_->Read<Page>(sentinel_offset_).next_page_index_,
+        return PageIterator(headers_, headers_->Read<Page>(sentinel_offset_).next_page_index_,
                             sentinel_offset_);
     }
 
     PageIndex Front() {
-        return file_->Read<Page>(sentinel_offset_).previous_page_index_;
+        return headers_->Read<Page>(sentinel_offset_).previous_page_index_;
     }
 
     PageIndex Back() {
-        return file_->Read<Page>(sentinel_offset_).next_page_index_;
+        return headers_->Read<Page>(sentinel_offset_).next_page_index_;
     }
 };
 
@@ -0,0 +1,200 @@
+#pragma once
+
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "error.hpp"
+
+namespace mem {
+
+constexpr inline size_t kDefaultIoDepth = 32;
+
+// Single read or write of a batch, done is filled by the engine
+struct IoRequest {
+    char* data;
+    size_t count;
+    off64_t offset;
+    size_t done = 0;
+};
+
+// Minimal io_uring engine built on raw syscalls. Keeps up to depth requests of a batch in flight
+// and waits until the whole batch is completed. The ring is not thread safe, the owner serializes
+// the batches
+class IoRing {
+    int ring_fd_ = -1;
+    unsigned depth_;
+
+    void* sq_ring_ = MAP_FAILED;
+    size_t sq_ring_size_ = 0;
+    void* cq_ring_ = MAP_FAILED;
+    size_t cq_ring_size_ = 0;
+    io_uring_sqe* sqes_ = static_cast<io_uring_sqe*>(MAP_FAILED);
+    size_t sqes_size_ = 0;
+
+    unsigned* sq_tail_;
+    unsigned* sq_mask_;
+    unsigned* sq_array_;
+    unsigned* cq_head_;
+    unsigned* cq_tail_;
+    unsigned* cq_mask_;
+    io_uring_cqe* cqes_;
+
+    template <typename T>
+    static T* At(void* ring, uint32_t offset) {
+        return reinterpret_cast<T*>(static_cast<char*>(ring) + offset);
+    }
+
+    static void* Map(int fd, size_t size, off64_t offset) {
+        return mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, offset);
+    }
+
+    void Release() {
+        if (sqes_ != MAP_FAILED) {
+            munmap(sqes_, sqes_size_);
+        }
+        if (cq_ring_ != MAP_FAILED && cq_ring_ != sq_ring_) {
+            munmap(cq_ring_, cq_ring_size_);
+        }
+        if (sq_ring_ != MAP_FAILED) {
+            munmap(sq_ring_, sq_ring_size_);
+        }
+        if (ring_fd_ != -1) {
+            close(ring_fd_);
+        }
+    }
+
+    int Enter(unsigned to_submit, unsigned min_complete) {
+        auto result = syscall(__NR_io_uring_enter, ring_fd_, to_submit, min_complete,
+                              IORING_ENTER_GETEVENTS, nullptr, 0);
+        return static_cast<int>(result);
+    }
+
+    void Push(int fd, IoRequest& request, size_t tag, bool write) {
+        auto tail = *sq_tail_;
+        auto index = tail & *sq_mask_;
+        auto& sqe = sqes_[index];
+        std::memset(&sqe, 0, sizeof(sqe));
+        sqe.opcode = write ? IORING_OP_WRITE : IORING_OP_READ;
+        sqe.fd = fd;
+        sqe.off = static_cast<uint64_t>(request.offset + static_cast<off64_t>(request.done));
+        sqe.addr = reinterpret_cast<uint64_t>(request.data + request.done);
+        sqe.len = static_cast<uint32_t>(request.count - request.done);
+        sqe.user_data = tag;
+        sq_array_[index] = index;
+        __atomic_store_n(sq_tail_, tail + 1, __ATOMIC_RELEASE);
+    }
+
+public:
+    // Throws IoError if io_uring is not supported by the kernel or forbidden in the sandbox
+    explicit IoRing(unsigned depth = kDefaultIoDepth) : depth_(depth) {
+        io_uring_params params;
+        std::memset(&params, 0, sizeof(params));
+        ring_fd_ = static_cast<int>(syscall(__NR_io_uring_setup, depth, &params));
+        if (ring_fd_ < 0) {
+            ring_fd_ = -1;
+            throw error::IoError("io_uring setup failed: " + std::string(std::strerror(errno)));
+        }
+        depth_ = std::min(depth_, params.sq_entries);
+
+        sq_ring_size_ = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        cq_ring_size_ = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+        if (params.features & IORING_FEAT_SINGLE_MMAP) {
+            sq_ring_size_ = cq_ring_size_ = std::max(sq_ring_size_, cq_ring_size_);
+        }
+        sq_ring_ = Map(ring_fd_, sq_ring_size_, IORING_OFF_SQ_RING);
+        if (sq_ring_ == MAP_FAILED) {
+            Release();
+            throw error::IoError("Can't map io_uring submission ring");
+        }
+        cq_ring_ = (params.features & IORING_FEAT_SINGLE_MMAP)
+                       ? sq_ring_
+                       : Map(ring_fd_, cq_ring_size_, IORING_OFF_CQ_RING);
+        sqes_size_ = params.sq_entries * sizeof(io_uring_sqe);
+        sqes_ = static_cast<io_uring_sqe*>(Map(ring_fd_, sqes_size_, IORING_OFF_SQES));
+        if (cq_ring_ == MAP_FAILED || sqes_ == MAP_FAILED) {
+            Release();
+            throw error::IoError("Can't map io_uring completion ring");
+        }
+
+        sq_tail_ = At<unsigned>(sq_ring_, params.sq_off.tail);
+        sq_mask_ = At<unsigned>(sq_ring_, params.sq_off.ring_mask);
+        sq_array_ = At<unsigned>(sq_ring_, params.sq_off.array);
+        cq_head_ = At<unsigned>(cq_ring_, params.cq_off.head);
+        cq_tail_ = At<unsigned>(cq_ring_, params.cq_off.tail);
+        cq_mask_ = At<unsigned>(cq_ring_, params.cq_off.ring_mask);
+        cqes_ = At<io_uring_cqe>(cq_ring_, params.cq_off.cqes);
+    }
+
+    IoRing(const IoRing&) = delete;
+    IoRing& operator=(const IoRing&) = delete;
+
+    ~IoRing() {
+        Release();
+    }
+
+    [[nodiscard]] unsigned GetDepth() const noexcept {
+        return depth_;
+    }
+
+    // Runs the whole batch. Short transfers are resubmitted, read that reaches EOF is completed
+    // with done < count. On failure requests in flight are drained before throwing, so the buffers
+    // can be released by the caller
+    void Run(int fd, std::vector<IoRequest>& requests, bool write) {
+        size_t next = 0;
+        size_t in_flight = 0;
+        std::vector<size_t> retry;
+        std::string failure;
+        while (in_flight != 0 || (failure.empty() && (next < requests.size() || !retry.empty()))) {
+            unsigned to_submit = 0;
+            while (failure.empty() && in_flight + to_submit < depth_ &&
+                   (!retry.empty() || next < requests.size())) {
+                size_t tag = next;
+                if (!retry.empty()) {
+                    tag = retry.back();
+                    retry.pop_back();
+                } else {
+                    ++next;
+                }
+                Push(fd, requests[tag], tag, write);
+                ++to_submit;
+            }
+            if (Enter(to_submit, 1) < 0 && errno != EINTR) {
+                throw error::IoError("io_uring submission failed: " +
+                                     std::string(std::strerror(errno)));
+            }
+            in_flight += to_submit;
+
+            auto head = *cq_head_;
+            auto tail = __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE);
+            for (; head != tail; ++head) {
+                auto& cqe = cqes_[head & *cq_mask_];
+                auto& request = requests[cqe.user_data];
+                --in_flight;
+                if (cqe.res < 0) {
+                    failure = std::strerror(-cqe.res);
+                    continue;
+                }
+                request.done += static_cast<size_t>(cqe.res);
+                if (cqe.res != 0 && request.done != request.count) {
+                    retry.push_back(cqe.user_data);
+                } else if (cqe.res == 0 && write) {
+                    failure = "no progress";
+                }
+            }
+            __atomic_store_n(cq_head_, head, __ATOMIC_RELEASE);
+        }
+        if (!failure.empty()) {
+            throw error::IoError("io_uring request failed: " + failure);
+        }
+    }
+};
+
+}  // namespace mem
@@ -0,0 +1,612 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <limits>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "mem.hpp"
+
+namespace mem {
+
+// When committed transactions reach the disk
+enum class SyncPolicy {
+    // Log is written when its buffer is full and synced only by checkpoint
+    kNone,
+    // Every commit is written and synced before it returns
+    kPerOperation,
+    // Commits are buffered and synced together every interval or as soon as the buffer is full,
+    // a crash loses at most the last group
+    kGroup
+};
+
+struct WalOptions {
+    SyncPolicy policy = SyncPolicy::kGroup;
+    std::chrono::milliseconds group_interval{10};
+    size_t group_bytes = 1 << 20;
+    // Checkpoint is made every interval or as soon as the log grows by the volume, so they bound
+    // the log replayed by recovery. Zero disables the trigger
+    std::chrono::milliseconds checkpoint_interval{1000};
+    size_t checkpoint_bytes = 64 << 20;
+    // Log is split into segments, the ones older than checkpoint are deleted
+    size_t segment_bytes = 16 << 20;
+};
+
+namespace detail {
+
+constexpr inline std::array<uint32_t, 256> kCrcTable = [] {
+    std::array<uint32_t, 256> table{};
+    for (uint32_t i = 0; i < 256; ++i) {
+        uint32_t crc = i;
+        for (size_t bit = 0; bit < 8; ++bit) {
+            crc = (crc & 1) ? (crc >> 1) ^ 0xEDB88320 : crc >> 1;
+        }
+        table[i] = crc;
+    }
+    return table;
+}();
+
+inline uint32_t Crc32(const char* data, size_t count, uint32_t crc = 0) {
+    crc = ~crc;
+    for (size_t i = 0; i < count; ++i) {
+        crc = kCrcTable[(crc ^ static_cast<uint8_t>(data[i])) & 0xFF] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+}  // namespace detail
+
+// Write-ahead log of physical redo records. Every write of the journaled file is logged with its
+// after-image, records of a transaction are applied by recovery only if its commit record is in
+// the log. Together with the no-steal cache of the file (see File::SetJournal) it guarantees that
+// after a crash the file holds exactly the committed transactions.
+//
+// Checkpoints are fuzzy: they run concurrently with transactions, write back committed frames and
+// store the LSN recovery starts from in the superblock. Log segments older than it are deleted
+class Wal : public Journal {
+    enum class RecordType : uint32_t { kWrite, kCommit, kAbort, kCheckpoint };
+
+    struct RecordHeader {
+        uint32_t crc_;
+        RecordType type_;
+        Lsn lsn_;
+        // Offset of the write or committed file size for commit and checkpoint
+        Offset offset_;
+        uint64_t size_;
+    };
+
+    // Log file named <wal name>.<seq>
+    struct Segment {
+        uint64_t seq;
+        Lsn first;
+        Offset size;
+    };
+
+    DECLARE_LOGGER;
+    std::string fileName_;
+    FileDescriptor fd_ = -1;
+    WalOptions options_;
+
+    mutable std::mutex mutex_;
+    std::condition_variable flusher_wakeup_;
+    std::thread flusher_;
+    bool stop_ = false;
+
+    std::mutex checkpoint_mutex_;
+    std::condition_variable checkpointer_wakeup_;
+    std::thread checkpointer_;
+    bool stop_checkpointer_ = false;
+    File::Ptr checkpoint_file_;
+
+    std::vector<Segment> segments_;
+    // Records that are not written to the log file yet
+    std::string buffer_;
+    Lsn next_lsn_ = 1;
+    Lsn written_lsn_ = 0;
+    Lsn durable_lsn_ = 0;
+    Lsn checkpoint_lsn_ = 0;
+    Lsn begin_lsn_ = 0;
+    bool in_transaction_ = false;
+    Offset committed_size_ = 0;
+    size_t since_checkpoint_ = 0;
+
+    [[nodiscard]] std::string GetSegmentName(uint64_t seq) const {
+        return fileName_ + "." + std::to_string(seq);
+    }
+
+    static std::vector<uint64_t> FindSegments(const std::string& fileName) {
+        auto path = std::filesystem::path(fileName);
+        auto directory = path.has_parent_path() ? path.parent_path() : std::filesystem::path(".");
+        auto prefix = path.filename().string() + ".";
+        std::vector<uint64_t> result;
+        for (auto& entry : std::filesystem::directory_iterator(directory)) {
+            auto name = entry.path().filename().string();
+            if (name.size() > prefix.size() && name.starts_with(prefix) &&
+                name.find_first_not_of("0123456789", prefix.size()) == std::string::npos) {
+                result.push_back(std::stoull(name.substr(prefix.size())));
+            }
+        }
+        std::sort(result.begin(), result.end());
+        return result;
+    }
+
+    void OpenSegment(uint64_t seq) {
+        if (fd_ != -1) {
+            close(fd_);
+        }
+        fd_ = open(GetSegmentName(seq).c_str(), O_RDWR | O_CREAT, S_IRWXU | S_IRGRP | S_IROTH);
+        if (fd_ == -1) {
+            throw error::IoError("Log could not be opened");
+        }
+    }
+
+    [[nodiscard]] std::string ReadSegment(const Segment& segment) const {
+        auto fd = open(GetSegmentName(segment.seq).c_str(), O_RDONLY);
+        if (fd == -1) {
+            throw error::IoError("Log segment could not be opened");
+        }
+        struct stat64 file_stat;
+        if (fstat64(fd, &file_stat) != 0) {
+            close(fd);
+            throw error::IoError("Failed to get log " + fileName_ + " size");
+        }
+        std::string log(static_cast<size_t>(file_stat.st_size), '\0');
+        size_t done = 0;
+        while (done != log.size()) {
+            auto result = pread64(fd, log.data() + done, log.size() - done,
+                                  static_cast<Offset>(done));
+            if (result <= 0) {
+                close(fd);
+                throw error::IoError("Failed to read log " + fileName_);
+            }
+            done += result;
+        }
+        close(fd);
+        return log;
+    }
+
+    // Returns nullopt if the record is torn or corrupted
+    static std::optional<RecordHeader> ParseRecord(const std::string& log, size_t position) {
+        if (position + sizeof(RecordHeader) > log.size()) {
+            return std::nullopt;
+        }
+        RecordHeader header;
+        std::memcpy(&header, log.data() + position, sizeof(header));
+        auto payload = position + sizeof(header);
+        if (header.size_ > log.size() - payload) {
+            return std::nullopt;
+        }
+        auto crc = detail::Crc32(log.data() + position + sizeof(header.crc_),
+                                 sizeof(header) - sizeof(header.crc_));
+        if (detail::Crc32(log.data() + payload, header.size_, crc) != header.crc_) {
+            return std::nullopt;
+        }
+        return header;
+    }
+
+    Lsn Append(RecordType type, Offset offset, const char* data, size_t count) {
+        RecordHeader header{0, type, next_lsn_++, offset, count};
+        header.crc_ = detail::Crc32(reinterpret_cast<const char*>(&header.type_),
+                                    sizeof(header) - sizeof(header.crc_));
+        header.crc_ = detail::Crc32(data, count, header.crc_);
+        buffer_.append(reinterpret_cast<const char*>(&header), sizeof(header));
+        buffer_.append(data, count);
+        since_checkpoint_ += sizeof(header) + count;
+        return header.lsn_;
+    }
+
+    // Following methods are called under the lock
+
+    void WriteOut() {
+        auto& segment = segments_.back();
+        if (segment.size == 0 && !buffer_.empty()) {
+            std::memcpy(&segment.first, buffer_.data() + offsetof(RecordHeader, lsn_), sizeof(Lsn));
+        }
+        size_t done = 0;
+        while (done != buffer_.size()) {
+            auto result = pwrite64(fd_, buffer_.data() + done, buffer_.size() - done,
+                                   segment.size + static_cast<Offset>(done));
+            if (result == -1) {
+                throw error::IoError("Failed to write to log " + fileName_);
+            }
+            done += result;
+        }
+        segment.size += static_cast<Offset>(buffer_.size());
+        buffer_.clear();
+        written_lsn_ = next_lsn_ - 1;
+        if (segment.size >= static_cast<Offset>(options_.segment_bytes)) {
+            Rotate();
+        }
+    }
+
+    // Starts a new segment, the current one is synced
+    void Rotate() {
+        if (!buffer_.empty()) {
+            WriteOut();
+        }
+        if (segments_.back().size == 0) {
+            return;
+        }
+        if (fdatasync(fd_) != 0) {
+            throw error::IoError("Can't sync log " + fileName_);
+        }
+        durable_lsn_ = written_lsn_;
+        auto seq = segments_.back().seq + 1;
+        OpenSegment(seq);
+        segments_.push_back({seq, next_lsn_, 0});
+    }
+
+    // Sync itself is done without the lock, so the transactions can be logged meanwhile
+    void SyncOut(std::unique_lock<std::mutex>& lock) {
+        WriteOut();
+        auto target = written_lsn_;
+        if (target <= durable_lsn_) {
+            return;
+        }
+        // Segment can be rotated meanwhile
+        auto fd = dup(fd_);
+        lock.unlock();
+        auto result = fd == -1 ? -1 : fdatasync(fd);
+        close(fd);
+        lock.lock();
+        if (result != 0) {
+            throw error::IoError("Can't sync log " + fileName_);
+        }
+        durable_lsn_ = std::max(durable_lsn_, target);
+    }
+
+    void RunFlusher() {
+        std::unique_lock lock(mutex_);
+        while (!stop_) {
+            flusher_wakeup_.wait_for(lock, options_.group_interval);
+            if (written_lsn_ != next_lsn_ - 1 || durable_lsn_ != written_lsn_) {
+                try {
+                    SyncOut(lock);
+                } catch (const error::Error& e) {
+                    ERROR("Group commit failed: ", e.what());
+                }
+            }
+        }
+    }
+
+    void RunCheckpointer() {
+        std::unique_lock lock(mutex_);
+        while (!stop_checkpointer_) {
+            auto triggered = [this] {
+                return stop_checkpointer_ || (options_.checkpoint_bytes != 0 &&
+                                              since_checkpoint_ >= options_.checkpoint_bytes);
+            };
+            if (options_.checkpoint_interval.count() != 0) {
+                checkpointer_wakeup_.wait_for(lock, options_.checkpoint_interval, triggered);
+            } else {
+                checkpointer_wakeup_.wait(lock, triggered);
+            }
+            if (stop_checkpointer_ || since_checkpoint_ == 0) {
+                continue;
+            }
+            auto file = checkpoint_file_;
+            lock.unlock();
+            try {
+                Checkpoint(file);
+            } catch (const error::Error& e) {
+                ERROR("Checkpoint failed: ", e.what());
+            }
+            lock.lock();
+        }
+    }
+
+    // Applies committed transactions of the log starting from checkpoint to the file and sets its
+    // committed size, the file must not be journaled. Returns the number of applied transactions
+    size_t Redo(File::Ptr& file) {
+        struct Write {
+            Offset offset;
+            std::string_view data;
+        };
+        std::vector<Write> pending;
+        std::vector<std::string> logs;
+        size_t applied = 0;
+        std::optional<Offset> size;
+        Lsn last = 0;
+
+        // Segments that entirely precede checkpoint are skipped
+        size_t first = 0;
+        while (first + 1 < segments_.size() && segments_[first + 1].first <= checkpoint_lsn_) {
+            ++first;
+        }
+        for (auto segment = first; segment < segments_.size(); ++segment) {
+            auto& log = logs.emplace_back(ReadSegment(segments_[segment]));
+            size_t position = 0;
+            while (auto header = ParseRecord(log, position)) {
+                if (header->lsn_ <= last) {
+                    break;
+                }
+                last = header->lsn_;
+                auto payload = std::string_view(log).substr(position + sizeof(RecordHeader),
+                                                            header->size_);
+                position += sizeof(RecordHeader) + header->size_;
+                if (header->lsn_ < checkpoint_lsn_) {
+                    continue;
+                }
+
+                switch (header->type_) {
+                    case RecordType::kWrite:
+                        pending.push_back({header->offset_, payload});
+                        break;
+                    case RecordType::kCommit:
+                        for (auto& write : pending) {
+                            file->WriteFields(write.offset, write.data);
+                        }
+                        pending.clear();
+                        size = header->offset_;
+                        ++applied;
+                        break;
+                    case RecordType::kAbort:
+                        pending.clear();
+                        break;
+                    case RecordType::kCheckpoint:
+                        size = header->offset_;
+                        break;
+                }
+            }
+            if (position != log.size()) {
+                WARN("Log ", fileName_, " has torn tail of ", log.size() - position, " bytes");
+                break;
+            }
+        }
+        if (size.has_value()) {
+            committed_size_ = size.value();
+        }
+        if (file->GetSize() > committed_size_) {
+            file->Truncate(file->GetSize() - committed_size_);
+        } else if (file->GetSize() < committed_size_) {
+            file->Extend(committed_size_ - file->GetSize());
+        }
+        next_lsn_ = std::max(next_lsn_, last + 1);
+        return applied;
+    }
+
+public:
+    using Ptr = util::Ptr<Wal>;
+
+    explicit Wal(std::string fileName, WalOptions options = {}, DEFAULT_LOGGER(logger))
+        : LOGGER(logger), fileName_(std::move(fileName)), options_(options) {
+        for (auto seq : FindSegments(fileName_)) {
+            segments_.push_back({seq, 0, 0});
+            auto log = ReadSegment(segments_.back());
+            segments_.back().size = static_cast<Offset>(log.size());
+            if (auto header = ParseRecord(log, 0)) {
+                segments_.back().first = header->lsn_;
+            }
+        }
+        if (segments_.empty()) {
+            segments_.push_back({1, next_lsn_, 0});
+        }
+        OpenSegment(segments_.back().seq);
+        if (options_.policy == SyncPolicy::kGroup) {
+            flusher_ = std::thread([this] { RunFlusher(); });
+        }
+    }
+
+    Wal(const Wal&) = delete;
+    Wal& operator=(const Wal&) = delete;
+
+    ~Wal() override {
+        StopCheckpointer();
+        {
+            std::unique_lock lock(mutex_);
+            stop_ = true;
+            try {
+                SyncOut(lock);
+            } catch (const error::Error& e) {
+                ERROR("Can't sync log ", fileName_, " on close: ", e.what());
+            }
+        }
+        flusher_wakeup_.notify_all();
+        if (flusher_.joinable()) {
+            flusher_.join();
+        }
+        close(fd_);
+    }
+
+    // Deletes all the segments of the log
+    static void Remove(const std::string& fileName) {
+        for (auto seq : FindSegments(fileName)) {
+            std::filesystem::remove(fileName + "." + std::to_string(seq));
+        }
+    }
+
+    [[nodiscard]] std::string GetFilename() const {
+        return fileName_;
+    }
+
+    [[nodiscard]] const WalOptions& GetOptions() const {
+        return options_;
+    }
+
+    // Size of all the segments including not written records
+    [[nodiscard]] Offset GetSize() const {
+        std::unique_lock lock(mutex_);
+        auto size = static_cast<Offset>(buffer_.size());
+        for (auto& segment : segments_) {
+            size += segment.size;
+        }
+        return size;
+    }
+
+    [[nodiscard]] size_t GetSegmentsCount() const {
+        std::unique_lock lock(mutex_);
+        return segments_.size();
+    }
+
+    [[nodiscard]] Lsn GetDurableLsn() const {
+        std::unique_lock lock(mutex_);
+        return durable_lsn_;
+    }
+
+    [[nodiscard]] Lsn GetCheckpointLsn() const {
+        std::unique_lock lock(mutex_);
+        return checkpoint_lsn_;
+    }
+
+    Lsn LogWrite(Offset offset, const char* data, size_t count) override {
+        std::unique_lock lock(mutex_);
+        if (!in_transaction_) {
+            throw error::RuntimeError("Journaled write out of transaction");
+        }
+        return Append(RecordType::kWrite, offset, data, count);
+    }
+
+    void Force(Lsn lsn) override {
+        std::unique_lock lock(mutex_);
+        if (durable_lsn_ < std::min(lsn, next_lsn_ - 1)) {
+            SyncOut(lock);
+        }
+    }
+
+    [[nodiscard]] bool InTransaction() const override {
+        std::unique_lock lock(mutex_);
+        return in_transaction_;
+    }
+
+    void Begin() {
+        std::unique_lock lock(mutex_);
+        if (in_transaction_) {
+            throw error::RuntimeError("Nested transaction");
+        }
+        in_transaction_ = true;
+        begin_lsn_ = next_lsn_;
+    }
+
+    // Size of the file is logged with commit, so that recovery cuts off the pages allocated by
+    // unfinished transactions
+    void Commit(File::Ptr& file) {
+        {
+            std::unique_lock lock(mutex_);
+            Append(RecordType::kCommit, file->GetSize(), nullptr, 0);
+            in_transaction_ = false;
+            committed_size_ = file->GetSize();
+            switch (options_.policy) {
+                case SyncPolicy::kPerOperation:
+                    SyncOut(lock);
+                    break;
+                case SyncPolicy::kGroup:
+                    if (buffer_.size() >= options_.group_bytes) {
+                        SyncOut(lock);
+                    }
+                    break;
+                case SyncPolicy::kNone:
+                    if (buffer_.size() >= options_.group_bytes) {
+                        WriteOut();
+                    }
+                    break;
+            }
+            if (options_.checkpoint_bytes != 0 && since_checkpoint_ >= options_.checkpoint_bytes) {
+                checkpointer_wakeup_.notify_all();
+            }
+        }
+        file->ReleaseHeldFrames();
+    }
+
+    // Brings the file back to the last committed state: changed blocks are dropped from the cache
+    // and the committed records of the log are applied again
+    void Rollback(File::Ptr& file) {
+        std::unique_lock checkpoint_lock(checkpoint_mutex_);
+        {
+            std::unique_lock lock(mutex_);
+            Append(RecordType::kAbort, 0, nullptr, 0);
+            in_transaction_ = false;
+            SyncOut(lock);
+        }
+        file->DropHeldFrames();
+        auto journal = file->GetJournal();
+        file->SetJournal(nullptr);
+        std::unique_lock lock(mutex_);
+        Redo(file);
+        lock.unlock();
+        file->SetJournal(journal);
+    }
+
+    // Applies the log left by a crash starting from the checkpoint of the superblock, must be
+    // called before the file is opened by database
+    void Recover(File::Ptr& file) {
+        std::unique_lock lock(mutex_);
+        committed_size_ = file->GetSize();
+        if (file->GetSize() >= kSuperblockEnd && file->Read<GlobalMagic>(0) == kMagic) {
+            checkpoint_lsn_ = file->Read<Lsn>(kCheckpointLsnOffset);
+        }
+        next_lsn_ = std::max(next_lsn_, checkpoint_lsn_ + 1);
+        auto applied = Redo(file);
+        if (applied != 0) {
+            INFO("Recovered ", applied, " commits from ", fileName_, " since LSN ",
+                 checkpoint_lsn_);
+        }
+        lock.unlock();
+        Checkpoint(file);
+    }
+
+    // Writes back committed frames and stores in the superblock the LSN recovery starts from:
+    // the beginning of open transaction or the oldest change held by it, or checkpoint record
+    // itself. The log is restarted from a new segment, so the older ones can be deleted
+    void Checkpoint(File::Ptr& file) {
+        std::unique_lock checkpoint_lock(checkpoint_mutex_);
+        Lsn record = 0;
+        Lsn checkpoint = 0;
+        {
+            std::unique_lock lock(mutex_);
+            Rotate();
+            record = Append(RecordType::kCheckpoint, committed_size_, nullptr, 0);
+            checkpoint = in_transaction_ ? begin_lsn_ : record;
+            since_checkpoint_ = 0;
+        }
+        checkpoint = std::min(checkpoint, file->SyncCommitted());
+        Force(record);
+        if (file->GetSize() >= kSuperblockEnd && file->Read<GlobalMagic>(0) == kMagic) {
+            file->WriteThrough(checkpoint, kCheckpointLsnOffset);
+            file->Sync();
+        }
+
+        std::unique_lock lock(mutex_);
+        checkpoint_lsn_ = checkpoint;
+        while (segments_.size() > 1 && segments_[1].size != 0 && segments_[1].first <= checkpoint) {
+            std::filesystem::remove(GetSegmentName(segments_.front().seq));
+            segments_.erase(segments_.begin());
+        }
+        DEBUG("Checkpoint of ", file->GetFilename(), " at LSN ", checkpoint);
+    }
+
+    // Background checkpoints by time and log volume, see WalOptions
+    void StartCheckpointer(const File::Ptr& file) {
+        if (options_.checkpoint_interval.count() == 0 && options_.checkpoint_bytes == 0) {
+            return;
+        }
+        StopCheckpointer();
+        std::unique_lock lock(mutex_);
+        checkpoint_file_ = file;
+        stop_checkpointer_ = false;
+        checkpointer_ = std::thread([this] { RunCheckpointer(); });
+    }
+
+    void StopCheckpointer() {
+        {
+            std::unique_lock lock(mutex_);
+            stop_checkpointer_ = true;
+        }
+        checkpointer_wakeup_.notify_all();
+        if (checkpointer_.joinable()) {
+            checkpointer_.join();
+        }
+        std::unique_lock lock(mutex_);
+        checkpoint_file_ = nullptr;
+    }
+};
+
+}  // namespace mem
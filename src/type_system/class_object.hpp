@@ -104,9 +104,8 @@ public:
         return serialized_.size() + sizeof(SizeType);
     }
     mem::Offset Write(mem::File::Ptr& file, mem::Offset offset) const override {
-        auto new_offset = file->Write<SizeType>(static_cast<SizeType>(serialized_.size()), offset) +
-                          static_cast<mem::Offset>(sizeof(SizeType));
-        return file->Write(serialized_, new_offset);
+        return file->WriteFields(offset, static_cast<SizeType>(serialized_.size()), serialized_) +
+               static_cast<mem::Offset>(sizeof(SizeType));
     }
     void Read(mem::File::Ptr& file, mem::Offset offset) override {
         SizeType size = file->Read<SizeType>(offset);
@@ -37,10 +37,8 @@ public:
                (attributes_object_.has_value() ? attributes_object_.value()->Size() : 0);
     }
     mem::Offset Write(mem::File::Ptr& file, mem::Offset offset) const override {
-        file->Write(from_id_, offset);
-        offset += sizeof(Id);
-        file->Write(to_id_, offset);
-        offset += sizeof(Id);
+        file->WriteFields(offset, from_id_, to_id_);
+        offset += 2 * sizeof(Id);
         if (attributes_object_.has_value()) {
             return attributes_object_.value()->Write(file, offset);
         } else {
@@ -48,10 +46,8 @@ public:
         }
     }
     void Read(mem::File::Ptr& file, mem::Offset offset) override {
-        from_id_ = file->Read<Id>(offset);
-        offset += sizeof(Id);
-        to_id_ = file->Read<Id>(offset);
-        offset += sizeof(Id);
+        file->ReadFields(offset, from_id_, to_id_);
+        offset += 2 * sizeof(Id);
         if (attributes_object_.has_value()) {
             attributes_object_.value()->Read(file, offset);
         }
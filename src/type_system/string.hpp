@@ -29,9 +29,8 @@ public:
         return str_;
     }
     mem::Offset Write(mem::File::Ptr& file, mem::Offset offset) const override {
-        auto new_offset = file->Write<SizeType>(static_cast<SizeType>(str_.size()), offset) +
-                          static_cast<mem::Offset>(sizeof(SizeType));
-        return file->Write(str_, new_offset);
+        return file->WriteFields(offset, static_cast<SizeType>(str_.size()), str_) +
+               static_cast<mem::Offset>(sizeof(SizeType));
     }
     void Read(mem::File::Ptr& file, mem::Offset offset) override {
         SizeType size = file->Read<SizeType>(offset);
@@ -1,8 +1,10 @@
+#include <algorithm>
 #include <cstddef>
 #include <format>
 #include <iterator>
 #include <list>
 #include <string>
+#include <vector>
 
 #include "class.hpp"
 #include "object.hpp"
@@ -57,3 +59,377 @@ TEST(Database, Drop) {
     database->RemoveClass(address_class);
     ASSERT_FALSE(database->Contains(address_class));
 }
+
+TEST(Database, ReuseRemovedClassPages) {
+    auto empty = ts::NewClass<ts::PrimitiveClass<int>>("empty");
+    auto point = ts::NewClass<ts::StructClass>("point", ts::NewClass<ts::PrimitiveClass<int>>("x"));
+    auto name = ts::NewClass<ts::StringClass>("name");
+    {
+        auto database = db::Database(util::MakePtr<mem::File>("test.data"), db::OpenMode::kWrite);
+        database.AddClass(empty);
+        database.AddClass(point);
+        database.AddClass(name);
+        for (int i = 0; i < 1000; ++i) {
+            database.AddNode(ts::New<ts::Struct>(point, i));
+        }
+        // Cached records of the class headers must not be written over the next owners of their
+        // pages: the free space bitmap and a data page
+        database.RemoveClass(empty);
+        database.RemoveClass(point);
+        for (int i = 0; i < 2000; ++i) {
+            database.AddNode(ts::New<ts::String>(name, std::format("name {}", i)));
+        }
+    }
+
+    auto database = db::Database(util::MakePtr<mem::File>("test.data"), db::OpenMode::kRead);
+    database.AddNode(ts::New<ts::String>(name, "name 2000"));
+    std::vector<ts::String::Ptr> names;
+    database.CollectNodesIf<ts::String>(name, std::back_inserter(names), db::kAll);
+    ASSERT_EQ(names.size(), 2001);
+    for (size_t i = 0; i < names.size(); ++i) {
+        ASSERT_EQ(names[i]->Value(), std::format("name {}", i));
+    }
+}
+
+TEST(Database, StorageStateOnReopen) {
+    auto make_point = [] {
+        return ts::NewClass<ts::StructClass>("point", ts::NewClass<ts::PrimitiveClass<int>>("x"));
+    };
+    auto point = make_point();
+    {
+        auto database = db::Database(util::MakePtr<mem::File>("test.data"), db::OpenMode::kWrite);
+        database.AddClass(point);
+        for (int i = 0; i < 1000; ++i) {
+            database.AddNode(ts::New<ts::Struct>(point, i));
+        }
+        // Equal class object shares the storage state of the class
+        database.AddNode(ts::New<ts::Struct>(make_point(), 1000));
+    }
+    auto database = db::Database(util::MakePtr<mem::File>("test.data"), db::OpenMode::kRead);
+    database.AddNode(ts::New<ts::Struct>(point, 1001));
+
+    std::vector<ts::ObjectId> ids;
+    database.VisitNodes(point, db::kAll,
+                        [&ids](auto it) { ids.push_back(it.Id()); });
+    ASSERT_EQ(ids.size(), 1002);
+    for (size_t i = 0; i < ids.size(); ++i) {
+        ASSERT_EQ(ids[i], i);
+    }
+}
+
+TEST(Database, AddNodes) {
+    auto point = ts::NewClass<ts::StructClass>("point", ts::NewClass<ts::PrimitiveClass<int>>("x"));
+    auto name = ts::NewClass<ts::StringClass>("name");
+    auto database = db::Database(util::MakePtr<mem::File>("test.data"), db::OpenMode::kWrite);
+    database.AddClass(point);
+    database.AddClass(name);
+
+    std::vector<ts::Struct::Ptr> points;
+    for (int i = 0; i < 1000; ++i) {
+        points.push_back(ts::New<ts::Struct>(point, i));
+    }
+    database.AddNodes(points);
+    database.RemoveNodesIf(point, [](db::ValNodeIterator it) { return it.Id() % 2 == 0; });
+    // Freed slots are reused before the pages are appended
+    database.AddNodes(points);
+
+    {
+        auto loader = db::Database::BulkLoader<ts::String>(database, 1);
+        for (int i = 0; i < 1000; ++i) {
+            loader.Add(ts::New<ts::String>(name, std::format("name {}", i)));
+        }
+    }
+
+    std::vector<ts::ObjectId> ids;
+    database.VisitNodes(point, db::kAll, [&ids](auto it) { ids.push_back(it.Id()); });
+    std::sort(ids.begin(), ids.end());
+    ASSERT_EQ(ids.size(), 1500);
+    ASSERT_EQ(ids.back(), 1999);
+
+    std::vector<ts::String::Ptr> names;
+    database.CollectNodesIf<ts::String>(name, std::back_inserter(names), db::kAll);
+    ASSERT_EQ(names.size(), 1000);
+    for (size_t i = 0; i < names.size(); ++i) {
+        ASSERT_EQ(names[i]->Value(), std::format("name {}", i));
+    }
+}
+
+TEST(Database, NodeById) {
+    auto point = ts::NewClass<ts::StructClass>("point", ts::NewClass<ts::PrimitiveClass<int>>("x"));
+    auto name = ts::NewClass<ts::StringClass>("name");
+    {
+        auto database = db::Database(util::MakePtr<mem::File>("test.data"), db::OpenMode::kWrite);
+        database.AddClass(point);
+        database.AddClass(name);
+        // Directory of the classes takes several pages
+        for (int i = 0; i < 2000; ++i) {
+            database.AddNode(ts::New<ts::Struct>(point, i));
+            database.AddNode(ts::New<ts::String>(name, std::format("name {}", i)));
+        }
+        database.RemoveNodesIf(point, [](db::ValNodeIterator it) { return it.Id() % 3 == 0; });
+        for (int i = 0; i < 2000; i += 2) {
+            ASSERT_TRUE(database.RemoveNode(name, ID(i)));
+        }
+        ASSERT_FALSE(database.RemoveNode(name, ID(0)));
+        ASSERT_FALSE(database.RemoveNode(name, ID(5000)));
+    }
+
+    auto database = db::Database(util::MakePtr<mem::File>("test.data"), db::OpenMode::kRead);
+    for (int i = 0; i < 2000; ++i) {
+        ASSERT_EQ(database.ContainsNode(point, ID(i)), i % 3 != 0);
+        auto node = database.GetNode(name, ID(i));
+        if (i % 2 == 0) {
+            ASSERT_EQ(node, nullptr);
+        } else {
+            ASSERT_EQ(node->Data<ts::String>()->Value(), std::format("name {}", i));
+        }
+    }
+    auto x = database.GetNode(point, ID(4))->Data<ts::Struct>()->GetField<ts::Primitive<int>>("x");
+    ASSERT_EQ(x->Value(), 4);
+
+    // Slots freed by removal are reused by new nodes with new ids
+    database.AddNode(ts::New<ts::Struct>(point, 2000));
+    ASSERT_TRUE(database.ContainsNode(point, ID(2000)));
+    ASSERT_FALSE(database.ContainsNode(point, ID(1998)));
+}
+
+TEST(Database, FieldIndex) {
+    auto address = ts::NewClass<ts::StructClass>("address", ts::NewClass<ts::StringClass>("city"),
+                                                 ts::NewClass<ts::PrimitiveClass<size_t>>("house"));
+    auto person = ts::NewClass<ts::StructClass>("person", ts::NewClass<ts::StringClass>("name"),
+                                                ts::NewClass<ts::PrimitiveClass<int>>("age"),
+                                                ts::NewClass<ts::PrimitiveClass<double>>("height"),
+                                                address);
+    auto make_person = [&person](int i) {
+        return ts::New<ts::Struct>(person, std::format("name {}", i), (i * 37) % 100 - 50,
+                                   1.5 + i % 7 * 0.1, "city", static_cast<size_t>(i));
+    };
+    auto age_of = [](const db::Node::Ptr& node) {
+        return node->Data<ts::Struct>()->GetField<ts::Primitive<int>>("age")->Value();
+    };
+    auto collect_ages = [&age_of, &person](db::Database& database, const auto& range) {
+        std::vector<int> ages;
+        database.VisitNodes(person, range,
+                            [&](const db::Node::Ptr& node) { ages.push_back(age_of(node)); });
+        return ages;
+    };
+    {
+        auto database = db::Database(util::MakePtr<mem::File>("test.data"), db::OpenMode::kWrite);
+        database.AddClass(person);
+        // Existing nodes are put into the index on creation
+        for (int i = 0; i < 1000; ++i) {
+            database.AddNode(make_person(i));
+        }
+        database.CreateIndex(person, "age");
+        database.CreateIndex(person, "address.house");
+        ASSERT_THROW(database.CreateIndex(person, "address"), error::TypeError);
+        ASSERT_THROW(database.CreateIndex(person, "address.street"), error::BadArgument);
+        for (int i = 1000; i < 5000; ++i) {
+            database.AddNode(make_person(i));
+        }
+        database.RemoveNodesIf(person, [](db::VarNodeIterator it) { return it.Id() % 10 == 0; });
+    }
+
+    auto database = db::Database(util::MakePtr<mem::File>("test.data"), db::OpenMode::kRead);
+    ASSERT_TRUE(database.HasIndex(person, "age"));
+    auto ages = collect_ages(database, db::Range<int>{"age", -5, 5});
+    ASSERT_TRUE(std::is_sorted(ages.begin(), ages.end()));
+    // Age 0 is only of the removed nodes
+    ASSERT_EQ(ages.size(), 10 * 50);
+    ASSERT_EQ(ages.front(), -5);
+    ASSERT_EQ(ages.back(), 5);
+    // Fractional bounds of the int field are rounded inwards
+    auto inner = collect_ages(database, db::Range<double>{"age", 1.5, 3.5});
+    ASSERT_EQ(inner.front(), 2);
+    ASSERT_EQ(inner.back(), 3);
+    inner = collect_ages(database, db::Range<double>{"age", -3.5, -1.5});
+    ASSERT_EQ(inner.front(), -3);
+    ASSERT_EQ(inner.back(), -2);
+    // Bounds beyond the int field are clamped, age 40 is only of the removed nodes
+    auto upper = collect_ages(database, db::Range<long>{"age", 40, 1l << 40});
+    ASSERT_EQ(upper.size(), 9 * 50);
+    ASSERT_EQ(upper.front(), 41);
+    ASSERT_EQ(upper.back(), 49);
+
+    // Scan gives the same nodes without the index
+    database.DropIndex(person, "age");
+    ASSERT_FALSE(database.HasIndex(person, "age"));
+    auto scanned = collect_ages(database, db::Range<int>{"age", -5, 5});
+    std::sort(scanned.begin(), scanned.end());
+    ASSERT_EQ(scanned, ages);
+    scanned = collect_ages(database, db::Range<long>{"age", 40, 1l << 40});
+    std::sort(scanned.begin(), scanned.end());
+    ASSERT_EQ(scanned, upper);
+
+    std::vector<ts::Struct::Ptr> houses;
+    database.CollectNodesIf<ts::Struct>(person, std::back_inserter(houses),
+                                        db::Range<size_t>{"address.house", 4000, 4099});
+    ASSERT_EQ(houses.size(), 90);
+
+    std::vector<ts::Struct::Ptr> heights;
+    database.CollectNodesIf<ts::Struct>(person, std::back_inserter(heights),
+                                        db::Range<double>{"height", 1.75, 2.});
+    ASSERT_EQ(heights.size(), 1928);
+}
+
+TEST(Database, HashIndex) {
+    auto name = ts::NewClass<ts::StringClass>("name");
+    auto person = ts::NewClass<ts::StructClass>("person", name,
+                                                ts::NewClass<ts::PrimitiveClass<int>>("age"));
+    auto count = [](db::Database& database, const auto& node_class, const db::Equals& equals) {
+        size_t found = 0;
+        database.VisitNodes(node_class, equals, [&found](const db::Node::Ptr&) { ++found; });
+        return found;
+    };
+    {
+        auto database = db::Database(util::MakePtr<mem::File>("test.data"), db::OpenMode::kWrite);
+        database.AddClass(name);
+        database.AddClass(person);
+        for (int i = 0; i < 1000; ++i) {
+            database.AddNode(ts::New<ts::Struct>(person, std::format("Greg {}", i % 500), i));
+        }
+        database.CreateIndex(person, "name");
+        database.CreateIndex(name, "name");
+        ASSERT_THROW(database.CreateIndex(person, "name"), error::RuntimeError);
+        // Buckets are split and overflow while the nodes are added
+        for (int i = 1000; i < 20000; ++i) {
+            database.AddNode(ts::New<ts::Struct>(person, std::format("Greg {}", i % 500), i));
+            database.AddNode(ts::New<ts::String>(name, std::format("Greg {}", i % 7)));
+        }
+        database.RemoveNodesIf(person, [](db::VarNodeIterator it) { return it.Id() % 2 == 0; });
+    }
+
+    auto database = db::Database(util::MakePtr<mem::File>("test.data"), db::OpenMode::kRead);
+    ASSERT_TRUE(database.HasIndex(person, "name"));
+    ASSERT_EQ(count(database, person, db::Equals{"name", "Greg 1"}), 40);
+    ASSERT_EQ(count(database, person, db::Equals{"name", "Greg 2"}), 0);
+    ASSERT_EQ(count(database, person, db::Equals{"name", "Greg 500"}), 0);
+    ASSERT_EQ(count(database, name, db::Equals{"name", "Greg 3"}), 2714);
+    ASSERT_THROW(count(database, person, db::Equals{"age", "1"}), error::TypeError);
+
+    std::vector<ts::Struct::Ptr> gregs;
+    database.CollectNodesIf<ts::Struct>(person, std::back_inserter(gregs),
+                                        db::Equals{"name", "Greg 499"});
+    ASSERT_EQ(gregs.size(), 40);
+    for (auto& greg : gregs) {
+        ASSERT_EQ(greg->GetField<ts::Primitive<int>>("age")->Value() % 500, 499);
+    }
+
+    // Scan gives the same nodes without the index
+    database.DropIndex(person, "name");
+    ASSERT_FALSE(database.HasIndex(person, "name"));
+    ASSERT_EQ(count(database, person, db::Equals{"name", "Greg 1"}), 40);
+}
+
+TEST(Database, ZoneMap) {
+    auto event = ts::NewClass<ts::StructClass>("event",
+                                               ts::NewClass<ts::PrimitiveClass<uint64_t>>("time"),
+                                               ts::NewClass<ts::PrimitiveClass<int>>("value"));
+    auto level = ts::NewClass<ts::PrimitiveClass<double>>("level");
+    auto count = [](db::Database& database, const auto& node_class, const auto& range) {
+        size_t found = 0;
+        database.VisitNodes(node_class, range, [&found](const db::Node::Ptr&) { ++found; });
+        return found;
+    };
+    {
+        auto database = db::Database(util::MakePtr<mem::File>("test.data"), db::OpenMode::kWrite);
+        database.AddClass(event);
+        database.AddClass(level);
+        for (uint64_t i = 0; i < 20000; ++i) {
+            database.AddNode(ts::New<ts::Struct>(event, i, static_cast<int>(i % 100) - 50));
+            database.AddNode(ts::New<ts::Primitive<double>>(level, static_cast<double>(i) / 10));
+        }
+        database.RemoveNodesIf(event, [](db::ValNodeIterator it) { return it.Id() % 3 == 0; });
+        database.RemoveNodesIf(event, [](db::ValNodeIterator it) {
+            return 5000 <= it.Id() && it.Id() < 15000;
+        });
+        // Freed slots of the back page get the nodes out of order
+        for (uint64_t i = 0; i < 100; ++i) {
+            database.AddNode(ts::New<ts::Struct>(event, 10000 + i, 0));
+        }
+    }
+
+    auto database = db::Database(util::MakePtr<mem::File>("test.data"), db::OpenMode::kRead);
+    ASSERT_EQ(count(database, event, db::Range<uint64_t>{"time", 4000, 4999}), 667);
+    ASSERT_EQ(count(database, event, db::Range<uint64_t>{"time", 5000, 9999}), 0);
+    ASSERT_EQ(count(database, event, db::Range<uint64_t>{"time", 10000, 10099}), 100);
+    ASSERT_EQ(count(database, event, db::Range<int>{"value", -50, -50}), 66);
+    ASSERT_EQ(count(database, level, db::Range<double>{"level", 100, 199.95}), 1000);
+}
+
+TEST(Database, BloomFilter) {
+    auto person = ts::NewClass<ts::StructClass>(
+        "person", ts::NewClass<ts::StringClass>("name"),
+        ts::NewClass<ts::StructClass>("address", ts::NewClass<ts::StringClass>("city")));
+    auto count = [&person](db::Database& database, const db::Equals& equals) {
+        size_t found = 0;
+        database.VisitNodes(person, equals, [&found](const db::Node::Ptr&) { ++found; });
+        return found;
+    };
+    {
+        auto database = db::Database(util::MakePtr<mem::File>("test.data"), db::OpenMode::kWrite);
+        database.AddClass(person);
+        for (int i = 0; i < 5000; ++i) {
+            database.AddNode(ts::New<ts::Struct>(person, std::format("Greg {}", i),
+                                                 std::format("City {}", i % 10)));
+        }
+        ASSERT_EQ(count(database, db::Equals{"name", "Greg 1234"}), 1);
+        database.RemoveNodesIf(person, [](db::VarNodeIterator it) { return it.Id() % 2 == 0; });
+        // Filters of the compacted pages are rebuilt, the removed values are not found
+        ASSERT_EQ(count(database, db::Equals{"name", "Greg 1234"}), 0);
+        ASSERT_EQ(count(database, db::Equals{"address.city", "City 3"}), 500);
+        ASSERT_EQ(count(database, db::Equals{"address.city", "City 4"}), 0);
+        database.AddNode(ts::New<ts::Struct>(person, "Greg 1234", "City 4"));
+    }
+
+    auto database = db::Database(util::MakePtr<mem::File>("test.data"), db::OpenMode::kRead);
+    ASSERT_EQ(count(database, db::Equals{"name", "Greg 1234"}), 1);
+    ASSERT_EQ(count(database, db::Equals{"name", "Greg 1235"}), 1);
+    ASSERT_EQ(count(database, db::Equals{"name", "Greg 5000"}), 0);
+    ASSERT_EQ(count(database, db::Equals{"address.city", "City 4"}), 1);
+    ASSERT_THROW(count(database, db::Equals{"address", "City 4"}), error::TypeError);
+}
+
+TEST(Database, ColumnLayout) {
+    auto sample = ts::NewClass<ts::StructClass>(
+        "sample", ts::NewClass<ts::PrimitiveClass<int>>("value"),
+        ts::NewClass<ts::StructClass>("pos", ts::NewClass<ts::PrimitiveClass<double>>("x"),
+                                      ts::NewClass<ts::PrimitiveClass<bool>>("even")));
+    auto count = [&sample](db::Database& database, const auto& range) {
+        size_t found = 0;
+        database.VisitNodes(sample, range, [&found](const db::Node::Ptr&) { ++found; });
+        return found;
+    };
+    {
+        auto database = db::Database(util::MakePtr<mem::File>("test.data"), db::OpenMode::kWrite);
+        ASSERT_THROW(database.AddClass(ts::NewClass<ts::StructClass>(
+                                           "named", ts::NewClass<ts::StringClass>("name")),
+                                       mem::PageLayout::kColumns),
+                     error::TypeError);
+        database.AddClass(sample, mem::PageLayout::kColumns);
+        std::vector<ts::Struct::Ptr> samples;
+        for (int i = 0; i < 5000; ++i) {
+            samples.push_back(ts::New<ts::Struct>(sample, i, i / 2.0, i % 2 == 0));
+        }
+        database.AddNodes(samples);
+        database.RemoveNodesIf(sample, [](db::ValNodeIterator it) { return it.Id() % 4 == 0; });
+        // Freed slots are taken one by one
+        for (int i = 0; i < 10; ++i) {
+            database.AddNode(ts::New<ts::Struct>(sample, 10000 + i, 0.0, true));
+        }
+    }
+
+    auto database = db::Database(util::MakePtr<mem::File>("test.data"), db::OpenMode::kRead);
+    ASSERT_EQ(count(database, db::Range<int>{"value", 0, 99}), 75);
+    ASSERT_EQ(count(database, db::Range<int>{"value", 10000, 10009}), 10);
+    ASSERT_EQ(count(database, db::Range<double>{"pos.x", 100, 149.5}), 75);
+    ASSERT_EQ(count(database, db::Range<int>{"pos.even", 1, 1}), 1260);
+    auto node = database.GetNode(sample, ID(1234));
+    ASSERT_EQ(node->Data<ts::Struct>()->GetField<ts::Primitive<int>>("value")->Value(), 1234);
+    auto pos = node->Data<ts::Struct>()->GetField<ts::Struct>("pos");
+    ASSERT_EQ(pos->GetField<ts::Primitive<double>>("x")->Value(), 617);
+    ASSERT_EQ(database.GetNode(sample, ID(1236)), nullptr);
+    size_t total = 0;
+    database.VisitNodes(sample, db::kAll, [&total](auto) { ++total; });
+    ASSERT_EQ(total, 3760);
+}
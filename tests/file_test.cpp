@@ -0,0 +1,358 @@
+#include <atomic>
+#include <string_view>
+#include <thread>
+#include <tuple>
+
+#include "test.hpp"
+
+TEST(File, CachedReadWrite) {
+    auto file = util::MakePtr<mem::File>("test.data");
+    file->Clear();
+
+    for (size_t i = 0; i < 10'000; ++i) {
+        file->Write<size_t>(i, static_cast<mem::Offset>(i * sizeof(size_t)));
+    }
+    ASSERT_EQ(file->GetSize(), static_cast<mem::Offset>(10'000 * sizeof(size_t)));
+    for (size_t i = 0; i < 10'000; ++i) {
+        ASSERT_EQ(file->Read<size_t>(static_cast<mem::Offset>(i * sizeof(size_t))), i);
+    }
+    ASSERT_GT(file->GetCache().GetHits(), 0);
+    ASSERT_THROW(static_cast<void>(file->Read<size_t>(file->GetSize())), error::IoError);
+}
+
+TEST(File, Eviction) {
+    auto file = util::MakePtr<mem::File>("test.data");
+    file->Clear();
+    file->SetCacheBudget(4 * mem::kFrameSize);
+
+    std::string block(mem::kFrameSize, 'a');
+    for (size_t i = 0; i < 16; ++i) {
+        block[0] = static_cast<char>('a' + i);
+        file->Write(block, static_cast<mem::Offset>(i * mem::kFrameSize));
+    }
+    for (size_t i = 0; i < 16; ++i) {
+        ASSERT_EQ(file->Read<char>(static_cast<mem::Offset>(i * mem::kFrameSize)),
+                  static_cast<char>('a' + i));
+    }
+
+    file->SetCacheBudget(0);
+    ASSERT_EQ(file->Read<char>(static_cast<mem::Offset>(15 * mem::kFrameSize)), 'p');
+}
+
+TEST(File, PersistsAfterReopen) {
+    {
+        auto file = util::MakePtr<mem::File>("test.data");
+        file->Clear();
+        file->Write("persistent"s, 5000);
+    }
+    auto file = util::MakePtr<mem::File>("test.data");
+    ASSERT_EQ(file->GetSize(), 5010);
+    ASSERT_EQ(file->ReadString(5000, 10), "persistent");
+}
+
+TEST(File, TruncateDropsCachedTail) {
+    auto file = util::MakePtr<mem::File>("test.data");
+    file->Clear();
+    file->Write<size_t>(42, 2 * mem::kFrameSize - sizeof(size_t));
+    file->Truncate(mem::kFrameSize);
+    ASSERT_EQ(file->GetSize(), static_cast<mem::Offset>(mem::kFrameSize));
+    file->Extend(mem::kFrameSize);
+    ASSERT_EQ(file->Read<size_t>(2 * mem::kFrameSize - sizeof(size_t)), 0);
+}
+
+TEST(File, PinBlock) {
+    auto file = util::MakePtr<mem::File>("test.data");
+    file->Clear();
+    file->Extend(mem::kFrameSize);
+    file->Write("direct"s, 16);
+    auto pin = file->PinBlock(16);
+    ASSERT_EQ(pin.Size(), mem::kFrameSize - 16);
+    ASSERT_EQ(std::string_view(pin.Data(), 6), "direct");
+}
+
+TEST(File, WriteFields) {
+    auto file = util::MakePtr<mem::File>("test.data");
+    file->Clear();
+    file->WriteFields(8, uint64_t{1}, uint32_t{2}, "fields"s);
+
+    uint64_t first;
+    uint32_t second;
+    file->ReadFields(8, first, second);
+    ASSERT_EQ(first, 1);
+    ASSERT_EQ(second, 2);
+    ASSERT_EQ(file->ReadString(20, 6), "fields");
+
+    file->SetCacheBudget(0);
+    auto offset = file->WriteFields(file->GetSize(), uint64_t{3}, uint32_t{4});
+    file->ReadFields(offset, first, second);
+    ASSERT_EQ(first, 3);
+    ASSERT_EQ(second, 4);
+}
+
+TEST(File, HeaderCache) {
+    auto file = util::MakePtr<mem::File>("test.data");
+    file->Clear();
+    file->Extend(2 * mem::kPageSize);
+    auto headers = util::MakePtr<mem::HeaderCache>(file);
+
+    auto page = mem::Page(1);
+    page.type_ = mem::PageType::kData;
+    mem::WritePage(page, headers);
+    headers->Write<size_t>(42, 8);
+    ASSERT_EQ(mem::ReadPage(mem::Page(1), headers).type_, mem::PageType::kData);
+    ASSERT_EQ(file->Read<size_t>(8), 0);
+    ASSERT_THROW(std::ignore = headers->Read<uint32_t>(8), error::RuntimeError);
+
+    headers->Flush();
+    ASSERT_EQ(headers->GetDirtyCount(), 0);
+    ASSERT_EQ(file->Read<size_t>(8), 42);
+    ASSERT_EQ(file->Read<mem::Page>(mem::GetPageAddress(1)).type_, mem::PageType::kData);
+
+    headers->Write<size_t>(7, mem::GetPageAddress(0));
+    headers->Discard(mem::GetPageAddress(0));
+    headers->Flush();
+    ASSERT_EQ(file->Read<size_t>(mem::GetPageAddress(0)), 0);
+}
+
+TEST(File, ConcurrentReaders) {
+    auto file = util::MakePtr<mem::File>("test.data");
+    file->Clear();
+    file->SetCacheBudget(8 * mem::kFrameSize);
+    constexpr size_t kCount = 64 * mem::kFrameSize / sizeof(size_t);
+    for (size_t i = 0; i < kCount; ++i) {
+        file->Write<size_t>(i, static_cast<mem::Offset>(i * sizeof(size_t)));
+    }
+
+    std::atomic<size_t> mismatches = 0;
+    std::vector<std::thread> readers;
+    for (size_t t = 0; t < 4; ++t) {
+        readers.emplace_back([&file, &mismatches, t] {
+            for (size_t i = t; i < kCount; i += 3) {
+                if (file->Read<size_t>(static_cast<mem::Offset>(i * sizeof(size_t))) != i) {
+                    ++mismatches;
+                }
+            }
+        });
+    }
+    for (auto& reader : readers) {
+        reader.join();
+    }
+    ASSERT_EQ(mismatches, 0);
+}
+
+TEST(File, Prefetch) {
+    auto file = util::MakePtr<mem::File>("test.data");
+    file->Clear();
+    std::string block(mem::kFrameSize, 'a');
+    for (size_t i = 0; i < 32; ++i) {
+        block[0] = static_cast<char>('a' + i);
+        file->Write(block, static_cast<mem::Offset>(i * mem::kFrameSize));
+    }
+    file->Flush();
+    file->SetCacheBudget(0);
+    file->SetCacheBudget(mem::kDefaultCacheBudget);
+
+    file->Prefetch(mem::kFrameSize, 64 * mem::kFrameSize);
+    ASSERT_FALSE(file->IsCached(0));
+    ASSERT_TRUE(file->IsCached(31 * mem::kFrameSize));
+    auto misses = file->GetCache().GetMisses();
+    for (size_t i = 1; i < 32; ++i) {
+        ASSERT_EQ(file->Read<char>(static_cast<mem::Offset>(i * mem::kFrameSize)),
+                  static_cast<char>('a' + i));
+    }
+    ASSERT_EQ(file->GetCache().GetMisses(), misses);
+}
+
+TEST(File, IoRing) {
+    std::unique_ptr<mem::IoRing> ring;
+    try {
+        ring = std::make_unique<mem::IoRing>(4);
+    } catch (const error::IoError&) {
+        GTEST_SKIP() << "io_uring is not available";
+    }
+    auto file = util::MakePtr<mem::File>("test.data");
+    file->Clear();
+    file->Flush();
+
+    std::vector<std::string> blocks;
+    std::vector<mem::IoRequest> requests;
+    for (size_t i = 0; i < 10; ++i) {
+        blocks.emplace_back(mem::kFrameSize, static_cast<char>('a' + i));
+        requests.push_back({blocks.back().data(), blocks.back().size(),
+                            static_cast<mem::Offset>(i * mem::kFrameSize)});
+    }
+    auto fd = open("test.data", O_RDWR);
+    ring->Run(fd, requests, true);
+
+    std::string tail(2 * mem::kFrameSize, 'z');
+    std::vector<mem::IoRequest> reads{{tail.data(), tail.size(), 9 * mem::kFrameSize}};
+    ring->Run(fd, reads, false);
+    close(fd);
+    ASSERT_EQ(reads[0].done, mem::kFrameSize);
+    ASSERT_EQ(tail[0], 'j');
+}
+
+TEST(MappedFile, ReadWrite) {
+    auto file = util::MakePtr<mem::MappedFile>("test.data");
+    file->Clear();
+
+    for (size_t i = 0; i < 10'000; ++i) {
+        file->Write<size_t>(i, static_cast<mem::Offset>(i * sizeof(size_t)));
+    }
+    for (size_t i = 0; i < 10'000; ++i) {
+        ASSERT_EQ(file->Read<size_t>(static_cast<mem::Offset>(i * sizeof(size_t))), i);
+    }
+    file->Write("zero-copy"s, 100);
+    ASSERT_EQ(file->View(100, 9), "zero-copy");
+    ASSERT_THROW(static_cast<void>(file->View(file->GetSize(), 1)), error::IoError);
+
+    file->Truncate(file->GetSize() - 8);
+    ASSERT_EQ(file->GetSize(), 8);
+    ASSERT_EQ(file->Read<size_t>(0), 0);
+}
+
+TEST(MappedFile, GrowsOutOfReservedRange) {
+    auto file = util::MakePtr<mem::MappedFile>("test.data", EMPTY_LOGGER, mem::kFrameSize);
+    file->Clear();
+    file->Write<size_t>(1, 0);
+    file->Extend(10 * mem::kFrameSize);
+    file->Write<size_t>(2, 10 * mem::kFrameSize);
+    ASSERT_EQ(file->Read<size_t>(0), 1);
+    ASSERT_EQ(file->Read<size_t>(10 * mem::kFrameSize), 2);
+}
+
+TEST(MappedFile, Database) {
+    auto coords =
+        ts::NewClass<ts::StructClass>("coords", ts::NewClass<ts::PrimitiveClass<double>>("lat"),
+                                      ts::NewClass<ts::PrimitiveClass<double>>("lon"));
+    {
+        auto database = db::Database(util::MakePtr<mem::MappedFile>("test.data"),
+                                     db::OpenMode::kWrite, CONSOLE_LOGGER);
+        database.AddClass(coords);
+        for (size_t i = 0; i < 1000; ++i) {
+            database.AddNode(ts::New<ts::Struct>(coords, 1. * i, 0.));
+        }
+        database.RemoveNodesIf(coords, [](db::ValNodeIterator it) { return it.Id() % 2 == 0; });
+    }
+    auto database = db::Database(util::MakePtr<mem::File>("test.data"), db::OpenMode::kRead);
+    size_t count = 0;
+    database.VisitNodes(coords, db::kAll, [&count](auto) { ++count; });
+    ASSERT_EQ(count, 500);
+}
+
+TEST(Superblock, PageSizeMismatch) {
+    auto name = ts::NewClass<ts::StringClass>("name");
+    {
+        auto database = db::Database(util::MakePtr<mem::File>("test.data"), db::OpenMode::kWrite);
+        database.AddClass(name);
+        database.AddNode(ts::New<ts::String>(name, "test name"));
+    }
+    auto file = util::MakePtr<mem::File>("test.data");
+    ASSERT_EQ(file->Read<size_t>(mem::kPageSizeOffset), static_cast<size_t>(mem::kPageSize));
+    file->Write<size_t>(2 * mem::kPageSize, mem::kPageSizeOffset);
+    file->Flush();
+    ASSERT_THROW(db::Database(file, db::OpenMode::kDefault), error::RuntimeError);
+    ASSERT_EQ(file->Read<size_t>(mem::kPageSizeOffset), static_cast<size_t>(2 * mem::kPageSize));
+}
+
+TEST(PageAllocator, Extents) {
+    auto file = util::MakePtr<mem::File>("test.data");
+    file->Clear();
+    mem::Superblock().InitSuperblock(file);
+    {
+        auto headers = util::MakePtr<mem::HeaderCache>(file);
+        auto alloc = util::MakePtr<mem::PageAllocator>(headers);
+        ASSERT_THROW(alloc->SetExtentPages(2048), error::BadArgument);
+        alloc->SetExtentPages(128);
+        for (size_t i = 0; i < 300; ++i) {
+            ASSERT_EQ(alloc->AllocatePage(), i);
+        }
+        // Extents double the file up to 128 pages: 1, 1, 2, 4, ..., 64, 128, 128
+        ASSERT_EQ(alloc->GetCapacity(), 384);
+        ASSERT_EQ(file->GetSize(), mem::GetPageAddress(384));
+        headers->Flush();
+    }
+
+    auto headers = util::MakePtr<mem::HeaderCache>(file);
+    auto alloc = util::MakePtr<mem::PageAllocator>(headers);
+    ASSERT_EQ(alloc->GetPagesCount(), 300);
+    ASSERT_EQ(alloc->GetCapacity(), 384);
+    ASSERT_EQ(alloc->AllocatePage(), 300);
+}
+
+TEST(PageAllocator, FreeSpaceBitmap) {
+    auto file = util::MakePtr<mem::File>("test.data");
+    file->Clear();
+    mem::Superblock().InitSuperblock(file);
+    {
+        auto headers = util::MakePtr<mem::HeaderCache>(file);
+        auto alloc = util::MakePtr<mem::PageAllocator>(headers);
+        for (size_t i = 0; i < 300; ++i) {
+            auto page = mem::Page(alloc->AllocatePage());
+            page.type_ = mem::PageType::kData;
+            mem::WritePage(page, headers);
+        }
+        // First freed page keeps the bitmap
+        alloc->FreePage(1);
+        ASSERT_EQ(alloc->GetFreePagesCount(), 0);
+        ASSERT_THROW(alloc->FreePage(1), error::RuntimeError);
+        for (size_t i = 10; i < 20; ++i) {
+            alloc->FreePage(i);
+        }
+        ASSERT_THROW(alloc->FreePage(15), error::RuntimeError);
+        ASSERT_THROW(alloc->FreePage(300), error::BadArgument);
+        ASSERT_EQ(alloc->GetFreePagesCount(), 10);
+        headers->Flush();
+    }
+
+    auto headers = util::MakePtr<mem::HeaderCache>(file);
+    auto alloc = util::MakePtr<mem::PageAllocator>(headers);
+    ASSERT_EQ(alloc->GetFreePagesCount(), 10);
+    // The lowest free pages are taken first
+    ASSERT_EQ(alloc->AllocatePage(), 10);
+    ASSERT_EQ(alloc->AllocatePage(), 11);
+    // Free tail is cut off together with the reserved pages once half of the pages are free
+    for (size_t i = 299; i >= 157; --i) {
+        alloc->FreePage(i);
+    }
+    ASSERT_EQ(alloc->GetPagesCount(), 157);
+    ASSERT_EQ(alloc->GetFreePagesCount(), 8);
+    ASSERT_EQ(alloc->GetCapacity(), alloc->GetPagesCount());
+    ASSERT_EQ(file->GetSize(), mem::GetPageAddress(alloc->GetPagesCount()));
+}
+
+TEST(PageAllocator, BitmapOfCutTail) {
+    auto file = util::MakePtr<mem::File>("test.data");
+    file->Clear();
+    mem::Superblock().InitSuperblock(file);
+    {
+        auto headers = util::MakePtr<mem::HeaderCache>(file);
+        auto alloc = util::MakePtr<mem::PageAllocator>(headers);
+        for (size_t i = 0; i < 300; ++i) {
+            alloc->AllocatePage();
+        }
+        // Bitmap at the end of the file is dropped with the tail, the next freed page keeps it
+        for (size_t i = 299; i >= 140; --i) {
+            alloc->FreePage(i);
+        }
+        ASSERT_EQ(alloc->GetPagesCount(), 148);
+        ASSERT_EQ(alloc->GetFreePagesCount(), 7);
+        ASSERT_EQ(file->GetSize(), mem::GetPageAddress(alloc->GetPagesCount()));
+
+        // Bitmap moves to the lowest free page of its group
+        alloc->FreePage(5);
+        for (size_t i = 139; i >= 73; --i) {
+            alloc->FreePage(i);
+        }
+        ASSERT_EQ(alloc->GetPagesCount(), 73);
+        ASSERT_EQ(alloc->GetFreePagesCount(), 0);
+        ASSERT_THROW(alloc->FreePage(5), error::RuntimeError);
+        alloc->FreePage(10);
+        headers->Flush();
+    }
+
+    auto headers = util::MakePtr<mem::HeaderCache>(file);
+    auto alloc = util::MakePtr<mem::PageAllocator>(headers);
+    ASSERT_EQ(alloc->GetFreePagesCount(), 1);
+    ASSERT_EQ(alloc->AllocatePage(), 10);
+}
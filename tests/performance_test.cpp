@@ -29,6 +29,33 @@ TEST(Performance, Insert) {
     }
 }
 
+TEST(Performance, BulkInsert) {
+    auto file = util::MakePtr<mem::File>("perf.ddb");
+    auto database = db::Database(file, db::OpenMode::kWrite);
+
+    auto name = ts::NewClass<ts::StringClass>("name");
+    auto age = ts::NewClass<ts::PrimitiveClass<int>>("age");
+
+    database.AddClass(name);
+    database.AddClass(age);
+
+    auto names = db::Database::BulkLoader<ts::String>(database);
+    auto ages = db::Database::BulkLoader<ts::Primitive<int>>(database);
+    for (size_t i = 0; i < 10'000; ++i) {
+        auto start = std::chrono::high_resolution_clock::now();
+        names.Add(ts::New<ts::String>(name, "test name"));
+        auto stop = std::chrono::high_resolution_clock::now();
+        std::cerr << 2 * i + 1 << ","
+                  << duration_cast<std::chrono::microseconds>(stop - start).count() << "\n";
+
+        start = std::chrono::high_resolution_clock::now();
+        ages.Add(ts::New<ts::Primitive<int>>(age, 100));
+        stop = std::chrono::high_resolution_clock::now();
+        std::cerr << 2 * i + 2 << ","
+                  << duration_cast<std::chrono::microseconds>(stop - start).count() << "\n";
+    }
+}
+
 TEST(Performance, RemoveVal) {
     auto file = util::MakePtr<mem::File>("perf.ddb");
     auto database = db::Database(file, db::OpenMode::kWrite);
@@ -47,7 +74,7 @@ TEST(Performance, RemoveVal) {
 
     for (size_t i = 0; i < size; ++i) {
         auto start = std::chrono::high_resolution_clock::now();
-        database.RemoveNodesIf(age, [i](auto it) { return it->Id() == ID(i); });
+        database.RemoveNode(age, ID(i));
         auto stop = std::chrono::high_resolution_clock::now();
         std::cerr << 2 * size - i << ","
                   << duration_cast<std::chrono::microseconds>(stop - start).count() << "\n";
@@ -72,7 +99,7 @@ TEST(Performance, RemoveVar) {
 
     for (size_t i = 0; i < size; ++i) {
         auto start = std::chrono::high_resolution_clock::now();
-        database.RemoveNodesIf(name, [i](auto it) { return it->Id() == ID(i); });
+        database.RemoveNode(name, ID(i));
         auto stop = std::chrono::high_resolution_clock::now();
         std::cerr << 2 * size - i << ","
                   << duration_cast<std::chrono::microseconds>(stop - start).count() << "\n";
@@ -95,7 +122,7 @@ TEST(Performance, Compression) {
         std::cerr << i << "," << file->GetSize() << "\n";
     }
     for (size_t i = size; i > 0; --i) {
-        database.RemoveNodesIf(name, [i](auto it) { return it->Id() == ID(i); });
+        database.RemoveNode(name, ID(i));
         std::cerr << i << "," << file->GetSize() << "\n";
     }
     for (size_t i = 0; i < size; ++i) {
@@ -103,7 +130,7 @@ TEST(Performance, Compression) {
         std::cerr << i << "," << file->GetSize() << "\n";
     }
     for (size_t i = size; i > 0; --i) {
-        database.RemoveNodesIf(age, [i](auto it) { return it->Id() == ID(i); });
+        database.RemoveNode(age, ID(i));
         std::cerr << i << "," << file->GetSize() << "\n";
     }
 }
@@ -2,6 +2,8 @@
 #include "relation.hpp"
 
 #include <ostream>
+#include <set>
+#include <vector>
 
 #include "test.hpp"
 
@@ -249,4 +251,94 @@ TEST(Relation, Stress) {
     for (auto& structure : result) {
         std::cerr << structure->ToString() << std::endl;
     }
-}
\ No newline at end of file
+}
+TEST(Relation, Outgoing) {
+    auto point = ts::NewClass<ts::PrimitiveClass<int>>("point");
+    auto connected = ts::NewClass<ts::RelationClass>("connected", point, point);
+    auto outgoing = [](db::Database& database, const ts::RelationClass::Ptr& relation,
+                       ts::ObjectId from) {
+        std::multiset<ts::ObjectId> to;
+        database.VisitOutgoing(relation, from, [&to](ts::ObjectId id, ts::ObjectId) {
+            to.insert(id);
+        });
+        return to;
+    };
+    {
+        auto database = db::Database(util::MakePtr<mem::File>("test.data"), db::OpenMode::kWrite);
+        database.AddClass(point);
+        database.AddClass(connected);
+        for (int i = 0; i < 10; ++i) {
+            database.AddNode(ts::New<ts::Primitive<int>>(point, i));
+        }
+        // Ring and star from the node 0, relation of the ring has id of its from node
+        for (int i = 0; i < 10; ++i) {
+            database.AddNode(ts::New<ts::Relation>(connected, ID(i), ID((i + 1) % 10)));
+        }
+        for (int i = 1; i < 10; ++i) {
+            database.AddNode(ts::New<ts::Relation>(connected, ID(0), ID(i)));
+        }
+        ASSERT_EQ(outgoing(database, connected, 0),
+                  std::multiset<ts::ObjectId>({1, 1, 2, 3, 4, 5, 6, 7, 8, 9}));
+
+        database.RemoveNodesIf(connected, [](db::ValNodeIterator it) {
+            return it->Data<ts::Relation>()->ToId() == 5;
+        });
+        ASSERT_TRUE(database.RemoveNode(connected, ID(7)));
+    }
+
+    auto database = db::Database(util::MakePtr<mem::File>("test.data"), db::OpenMode::kRead);
+    ASSERT_EQ(outgoing(database, connected, 0),
+              std::multiset<ts::ObjectId>({1, 1, 2, 3, 4, 6, 7, 8, 9}));
+    ASSERT_TRUE(outgoing(database, connected, 4).empty());
+    ASSERT_TRUE(outgoing(database, connected, 7).empty());
+    ASSERT_EQ(outgoing(database, connected, 8), std::multiset<ts::ObjectId>({9}));
+
+    auto pattern = util::MakePtr<db::Pattern>(point);
+    pattern->AddRelation(connected, db::kAll);
+    std::vector<ts::Struct::Ptr> result;
+    database.PatternMatch(pattern, std::back_inserter(result));
+    ASSERT_EQ(result.size(), 16);
+}
+
+TEST(Relation, Incoming) {
+    auto point = ts::NewClass<ts::PrimitiveClass<int>>("point");
+    auto follows = ts::NewClass<ts::RelationClass>("follows", point, point);
+    auto database = db::Database(util::MakePtr<mem::File>("test.data"), db::OpenMode::kWrite);
+    database.AddClass(point);
+    database.AddClass(follows);
+    for (int i = 0; i < 100; ++i) {
+        database.AddNode(ts::New<ts::Primitive<int>>(point, i));
+    }
+    // Every node follows the nodes with ids that are its multiples
+    for (int i = 1; i < 100; ++i) {
+        for (int j = 2 * i; j < 100; j += i) {
+            database.AddNode(ts::New<ts::Relation>(follows, ID(i), ID(j)));
+        }
+    }
+    auto incoming = [&database, &follows](ts::ObjectId to) {
+        std::set<ts::ObjectId> from;
+        database.VisitIncoming(follows, to, [&from](ts::ObjectId id, ts::ObjectId) {
+            from.insert(id);
+        });
+        return from;
+    };
+    ASSERT_EQ(incoming(60), std::set<ts::ObjectId>({1, 2, 3, 4, 5, 6, 10, 12, 15, 20, 30}));
+    ASSERT_TRUE(incoming(97) == std::set<ts::ObjectId>({1}));
+
+    database.RemoveNodesIf(follows, [](db::ValNodeIterator it) {
+        return it->Data<ts::Relation>()->FromId() == 1;
+    });
+    ASSERT_TRUE(incoming(97).empty());
+
+    // Chains of two relations ending in the node 64: 2-4-64, 2-8-64, ..., 16-32-64
+    auto pattern = util::MakePtr<db::Pattern>(point);
+    auto middle = util::MakePtr<db::Pattern>(point);
+    auto last = util::MakePtr<db::Pattern>(point);
+    pattern->AddRelation(follows, db::kAll, middle);
+    middle->AddRelation(follows, [](db::Node, db::Node to) {
+        return to.Data<ts::Primitive<int>>()->Value() == 64;
+    }, last);
+    std::vector<ts::Struct::Ptr> result;
+    database.PatternMatch(pattern, std::back_inserter(result));
+    ASSERT_EQ(result.size(), 10);
+}
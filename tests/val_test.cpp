@@ -1,3 +1,6 @@
+#include <limits>
+#include <vector>
+
 #include "test.hpp"
 
 TEST(ValNodeStorage, NodeAddition) {
@@ -146,4 +149,172 @@ TEST(ValNodeStorage, IdLogic) {
         std::cerr << it.GetRealOffset() << std::endl;
         return true;
     });
-}
\ No newline at end of file
+}
+TEST(ValNodeStorage, Filter) {
+    auto make_class = [](const std::string& name) {
+        return ts::NewClass<ts::StructClass>(
+            name, ts::NewClass<ts::PrimitiveClass<int>>("value"),
+            ts::NewClass<ts::PrimitiveClass<unsigned long>>("big"),
+            ts::NewClass<ts::StructClass>("pos", ts::NewClass<ts::PrimitiveClass<float>>("x"),
+                                          ts::NewClass<ts::PrimitiveClass<bool>>("odd")));
+    };
+    auto rows = make_class("rows");
+    auto columns = make_class("columns");
+    auto database = db::Database(util::MakePtr<mem::File>("test.data"), db::OpenMode::kWrite);
+    database.AddClass(rows);
+    database.AddClass(columns, mem::PageLayout::kColumns);
+    for (auto& node_class : {rows, columns}) {
+        for (int i = 0; i < 3001; ++i) {
+            database.AddNode(ts::New<ts::Struct>(node_class, i - 1500, (1ul << 63) + i,
+                                                 static_cast<float>(i) / 4, i % 2 == 1));
+        }
+        database.RemoveNodesIf(node_class, [](db::ValNodeIterator it) { return it.Id() % 7 == 0; });
+    }
+
+    for (auto& node_class : {rows, columns}) {
+        auto count = [&database, &node_class](const auto& filter) {
+            return database.CountNodes(node_class, filter);
+        };
+        // Every count is checked against the nodes that were added
+        auto expected = [](auto predicate) {
+            size_t result = 0;
+            for (int i = 0; i < 3001; ++i) {
+                result += i % 7 != 0 && predicate(i);
+            }
+            return result;
+        };
+        ASSERT_EQ(count(db::Filter<int>("value")), expected([](int) { return true; }));
+        ASSERT_EQ(count(db::Filter<int>("value").Between(-10, 10)),
+                  expected([](int i) { return 1490 <= i && i <= 1510; }));
+        ASSERT_EQ(count(db::Filter<int>("value").AtLeast(1499)),
+                  expected([](int i) { return i >= 2999; }));
+        ASSERT_EQ(count(db::Filter<unsigned long>("big").AtMost((1ul << 63) + 99)),
+                  expected([](int i) { return i <= 99; }));
+        ASSERT_EQ(count(db::Filter<double>("pos.x").Between(100, 200.25)),
+                  expected([](int i) { return 400 <= i && i <= 801; }));
+        ASSERT_EQ(count(db::Filter<bool>("pos.odd").Equal(true)),
+                  expected([](int i) { return i % 2 == 1; }));
+        // Fractional bounds of the int field are rounded inwards
+        ASSERT_EQ(count(db::Filter<double>("value").Between(0.5, 2.5)),
+                  expected([](int i) { return 1501 <= i && i <= 1502; }));
+        // Bounds beyond the type of the field are clamped
+        ASSERT_EQ(count(db::Filter<long long>("value").AtMost(1ll << 40)),
+                  expected([](int) { return true; }));
+        ASSERT_EQ(count(db::Filter<unsigned>("value")),
+                  expected([](int i) { return i >= 1500; }));
+
+        std::vector<int> values;
+        database.VisitNodes(node_class, db::Filter<int>("value").Between(0, 20),
+                            [&values](const db::Node::Ptr& node) {
+                                values.push_back(node->Data<ts::Struct>()
+                                                     ->GetField<ts::Primitive<int>>("value")
+                                                     ->Value());
+                            });
+        // Removed ids are multiples of 7, their values are 5, 12 and 19
+        ASSERT_EQ(values, std::vector<int>(
+                              {0, 1, 2, 3, 4, 6, 7, 8, 9, 10, 11, 13, 14, 15, 16, 17, 18, 20}));
+    }
+
+    auto named = ts::NewClass<ts::StructClass>("named", ts::NewClass<ts::StringClass>("name"),
+                                               ts::NewClass<ts::PrimitiveClass<int>>("age"));
+    database.AddClass(named);
+    for (int i = 0; i < 100; ++i) {
+        database.AddNode(ts::New<ts::Struct>(named, std::string("name"), i));
+    }
+    ASSERT_EQ(database.CountNodes(named, db::Filter<int>("age").Between(18, 65)), 48);
+    // Bounds of a wider type are clamped as for the columns
+    ASSERT_EQ(database.CountNodes(named, db::Filter<long>("age").AtLeast(50)), 50);
+    ASSERT_EQ(database.CountNodes(named, db::Filter<unsigned>("age")), 100);
+    size_t visited = 0;
+    database.VisitNodes(named, db::Filter<long>("age").AtMost(9),
+                        [&visited](const db::Node::Ptr&) { ++visited; });
+    ASSERT_EQ(visited, 10);
+}
+
+TEST(ValNodeStorage, FilterNan) {
+    auto check = []<typename T>(T nan) {
+        // Lanes of the vector part and the tail left to the scalar loop have the same result
+        std::vector<T> values(19);
+        for (size_t i = 0; i < values.size(); ++i) {
+            values[i] = static_cast<T>(i);
+        }
+        values[2] = nan;
+        values[17] = nan;
+        uint64_t bits = 0;
+        db::SelectBetween<T>(values.data(), values.size(), 0, 10, &bits);
+        ASSERT_EQ(bits, 0x7fbull);
+
+        std::vector<T> nans(9, nan);
+        db::SelectBetween<T>(nans.data(), nans.size(), 0, 10, &bits);
+        ASSERT_EQ(bits, 0ull);
+    };
+    check(std::numeric_limits<float>::quiet_NaN());
+    check(std::numeric_limits<double>::quiet_NaN());
+}
+
+TEST(ValNodeStorage, SparsePages) {
+    auto coords =
+        ts::NewClass<ts::StructClass>("coords", ts::NewClass<ts::PrimitiveClass<double>>("lat"),
+                                      ts::NewClass<ts::PrimitiveClass<double>>("lon"));
+    {
+        auto database =
+            db::Database(util::MakePtr<mem::File>("test.data"), db::OpenMode::kWrite);
+        database.AddClass(coords);
+        for (size_t i = 0; i < 2000; ++i) {
+            database.AddNode(ts::New<ts::Struct>(coords, i * 1., 0.));
+        }
+        database.RemoveNodesIf(coords, [](db::ValNodeIterator it) { return it.Id() % 10 != 0; });
+    }
+
+    auto file = util::MakePtr<mem::File>("test.data");
+    auto database = db::Database(file);
+    std::vector<ts::ObjectId> ids;
+    database.VisitNodes(coords, db::kAll, [&ids](auto it) { ids.push_back(it.Id()); });
+    ASSERT_EQ(ids.size(), 200);
+    for (size_t i = 0; i < ids.size(); ++i) {
+        ASSERT_EQ(ids[i], i * 10);
+    }
+
+    // Holes of the back page are taken before the file grows
+    auto size = file->GetSize();
+    for (size_t i = 0; i < 20; ++i) {
+        database.AddNode(ts::New<ts::Struct>(coords, -1., 0.));
+    }
+    ASSERT_EQ(file->GetSize(), size);
+    ASSERT_EQ(database.CountNodes(coords, db::Filter<double>("lat").AtMost(0.)), 21);
+}
+
+TEST(ValNodeStorage, PageDirectory) {
+    auto sample =
+        ts::NewClass<ts::StructClass>("sample", ts::NewClass<ts::PrimitiveClass<int>>("value"));
+    {
+        auto database =
+            db::Database(util::MakePtr<mem::File>("test.data"), db::OpenMode::kWrite);
+        database.AddClass(sample, mem::PageLayout::kColumns);
+        for (int i = 0; i < 20'000; ++i) {
+            database.AddNode(ts::New<ts::Struct>(sample, i));
+        }
+        // Pages in the middle of the list are freed
+        database.RemoveNodesIf(sample, [](db::ValNodeIterator it) {
+            return 5'000 <= it.Id() && it.Id() < 15'000;
+        });
+    }
+
+    auto database = db::Database(util::MakePtr<mem::File>("test.data"));
+    for (int i = 0; i < 1'000; ++i) {
+        database.AddNode(ts::New<ts::Struct>(sample, 20'000 + i));
+    }
+    auto filter = db::Filter<int>("value").Between(4'000, 20'499);
+    ASSERT_EQ(database.CountNodes(sample, filter), 6'500);
+    ASSERT_EQ(database.CountNodes(sample, filter, 4), 6'500);
+
+    // Pages are visited in the order of the list
+    std::vector<int> values;
+    database.VisitNodes(sample, db::Range<int>{"value", 0, 30'000}, [&values](auto node) {
+        values.push_back(node->template Data<ts::Struct>()
+                             ->template GetField<ts::Primitive<int>>("value")
+                             ->Value());
+    });
+    ASSERT_EQ(values.size(), 11'000);
+    ASSERT_TRUE(std::is_sorted(values.begin(), values.end()));
+}
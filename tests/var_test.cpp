@@ -1,3 +1,7 @@
+#include <format>
+#include <iterator>
+#include <vector>
+
 #include "test.hpp"
 
 TEST(VarNodeStorage, NodeAddition) {
@@ -64,4 +68,96 @@ TEST(VarNodeStorage, NodeDeletionWithDeallocation) {
     database.RemoveNodesIf(
         name, [](db::VarNodeIterator it) { return it->Data<ts::String>()->Value()[0] == 'G'; });
     database.PrintNodesIf(name, db::kAll);
-}
\ No newline at end of file
+}
+TEST(VarNodeStorage, SlotReuse) {
+    auto name = ts::NewClass<ts::StringClass>("name");
+    {
+        auto file = util::MakePtr<mem::File>("test.data");
+        auto database = db::Database(file, db::OpenMode::kWrite);
+        database.AddClass(name);
+        for (size_t i = 0; i < 1000; ++i) {
+            database.AddNode(ts::New<ts::String>(name, std::format("name {}", i)));
+        }
+        for (size_t i = 0; i < 1000; i += 2) {
+            ASSERT_TRUE(database.RemoveNode(name, ID(i)));
+        }
+        // Space of the removed nodes is compacted inside their pages and taken by the new ones,
+        // only the directory of the ids grows
+        auto size = file->GetSize();
+        for (size_t i = 1000; i < 1500; ++i) {
+            database.AddNode(ts::New<ts::String>(name, std::format("name {}", i)));
+        }
+        ASSERT_LE(file->GetSize(), size + 2 * mem::kPageSize);
+    }
+    auto database = db::Database(util::MakePtr<mem::File>("test.data"), db::OpenMode::kRead);
+    for (size_t i = 0; i < 1500; ++i) {
+        auto node = database.GetNode(name, ID(i));
+        if (i < 1000 && i % 2 == 0) {
+            ASSERT_EQ(node, nullptr);
+        } else {
+            ASSERT_EQ(node->Data<ts::String>()->Value(), std::format("name {}", i));
+        }
+    }
+    std::vector<ts::String::Ptr> names;
+    database.CollectNodesIf<ts::String>(name, std::back_inserter(names), db::kAll);
+    ASSERT_EQ(names.size(), 1000);
+}
+
+TEST(VarNodeStorage, OverflowPages) {
+    auto person = ts::NewClass<ts::StructClass>("person", ts::NewClass<ts::StringClass>("name"),
+                                                ts::NewClass<ts::StringClass>("bio"));
+    auto make_bio = [](size_t i) { return std::string(1000 + i * 3000, 'a' + i % 26); };
+    {
+        auto database = db::Database(util::MakePtr<mem::File>("test.data"), db::OpenMode::kWrite);
+        database.AddClass(person);
+        for (size_t i = 0; i < 20; ++i) {
+            database.AddNode(
+                ts::New<ts::Struct>(person, std::format("name {}", i), make_bio(i)));
+        }
+        database.RemoveNodesIf(person, [](db::VarNodeIterator it) { return it.Id() % 3 == 0; });
+    }
+
+    auto file = util::MakePtr<mem::File>("test.data");
+    auto database = db::Database(file);
+    for (size_t i = 0; i < 20; ++i) {
+        auto node = database.GetNode(person, ID(i));
+        if (i % 3 == 0) {
+            ASSERT_EQ(node, nullptr);
+        } else {
+            auto data = node->Data<ts::Struct>();
+            ASSERT_EQ(data->GetField<ts::String>("name")->Value(), std::format("name {}", i));
+            ASSERT_EQ(data->GetField<ts::String>("bio")->Value(), make_bio(i));
+        }
+    }
+    database.PrintNodesIf(person, db::Equals{"name", "name 19"});
+
+    // Pages of the removed chains are reused
+    auto size = file->GetSize();
+    database.RemoveNodesIf(person, db::kAll);
+    database.AddNode(ts::New<ts::Struct>(person, std::string("long"), make_bio(19)));
+    ASSERT_LE(file->GetSize(), size);
+}
+
+TEST(VarNodeStorage, PageDirectoryCompaction) {
+    auto person = ts::NewClass<ts::StructClass>("person", ts::NewClass<ts::StringClass>("name"),
+                                                ts::NewClass<ts::StringClass>("bio"));
+    {
+        auto database = db::Database(util::MakePtr<mem::File>("test.data"), db::OpenMode::kWrite);
+        database.AddClass(person);
+        for (size_t i = 0; i < 3000; ++i) {
+            database.AddNode(ts::New<ts::Struct>(person, std::format("name {}", i),
+                                                 std::string(900, 'a' + i % 26)));
+        }
+        // Directory is compacted once the freed pages outnumber the rest
+        database.RemoveNodesIf(person, [](db::VarNodeIterator it) { return it.Id() < 2990; });
+    }
+
+    auto database = db::Database(util::MakePtr<mem::File>("test.data"));
+    std::vector<ts::Struct::Ptr> people;
+    database.CollectNodesIf<ts::Struct>(person, std::back_inserter(people), db::kAll);
+    ASSERT_EQ(people.size(), 10);
+    people.clear();
+    database.CollectNodesIf<ts::Struct>(person, std::back_inserter(people),
+                                        db::Equals{"name", "name 2995"});
+    ASSERT_EQ(people.size(), 1);
+}
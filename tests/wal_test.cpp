@@ -0,0 +1,173 @@
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <format>
+#include <stdexcept>
+#include <thread>
+
+#include "test.hpp"
+
+namespace {
+
+auto MakeCoords() {
+    return ts::NewClass<ts::StructClass>("coords", ts::NewClass<ts::PrimitiveClass<double>>("lat"),
+                                         ts::NewClass<ts::PrimitiveClass<double>>("lon"));
+}
+
+size_t CountNodes(db::Database& database, const ts::StructClass::Ptr& coords) {
+    size_t count = 0;
+    database.VisitNodes(coords, db::kAll, [&count](auto) { ++count; });
+    return count;
+}
+
+// Runs the functor in a child process that dies without destructors, like on a crash
+template <typename Functor>
+void Crash(Functor functor) {
+    auto pid = fork();
+    if (pid == 0) {
+        functor();
+        _exit(::testing::Test::HasFailure() ? 1 : 0);
+    }
+    int status = 0;
+    waitpid(pid, &status, 0);
+    ASSERT_TRUE(WIFEXITED(status));
+    ASSERT_EQ(WEXITSTATUS(status), 0);
+}
+
+}  // namespace
+
+TEST(Wal, RecoversCommittedTransactions) {
+    mem::Wal::Remove("test.data.wal");
+    auto coords = MakeCoords();
+    Crash([&coords] {
+        auto wal = util::MakePtr<mem::Wal>("test.data.wal",
+                                           mem::WalOptions{mem::SyncPolicy::kPerOperation});
+        auto database = new db::Database(util::MakePtr<mem::File>("test.data"), wal,
+                                         db::OpenMode::kWrite);
+        database->AddClass(coords);
+        for (size_t i = 0; i < 1000; ++i) {
+            database->AddNode(ts::New<ts::Struct>(coords, 1. * i, 0.));
+        }
+        database->RemoveNodesIf(coords, [](db::ValNodeIterator it) { return it.Id() < 100; });
+    });
+
+    auto wal = util::MakePtr<mem::Wal>("test.data.wal");
+    ASSERT_GT(wal->GetSize(), 0);
+    auto database = db::Database(util::MakePtr<mem::File>("test.data"), wal, db::OpenMode::kRead);
+    ASSERT_EQ(CountNodes(database, coords), 900);
+}
+
+TEST(Wal, GroupCommit) {
+    mem::Wal::Remove("test.data.wal");
+    auto coords = MakeCoords();
+    Crash([&coords] {
+        auto options = mem::WalOptions{mem::SyncPolicy::kGroup, std::chrono::milliseconds(5)};
+        auto wal = util::MakePtr<mem::Wal>("test.data.wal", options);
+        auto database = new db::Database(util::MakePtr<mem::File>("test.data"), wal,
+                                         db::OpenMode::kWrite);
+        database->AddClass(coords);
+        for (size_t i = 0; i < 500; ++i) {
+            database->AddNode(ts::New<ts::Struct>(coords, 1. * i, 0.));
+        }
+        // Flusher syncs the last group
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    });
+
+    auto database = db::Database(util::MakePtr<mem::File>("test.data"),
+                                 util::MakePtr<mem::Wal>("test.data.wal"), db::OpenMode::kRead);
+    ASSERT_EQ(CountNodes(database, coords), 500);
+}
+
+TEST(Wal, RollbackOnException) {
+    mem::Wal::Remove("test.data.wal");
+    auto coords = MakeCoords();
+    auto database =
+        db::Database(util::MakePtr<mem::File>("test.data"),
+                     util::MakePtr<mem::Wal>("test.data.wal"), db::OpenMode::kWrite);
+    database.AddClass(coords);
+    for (size_t i = 0; i < 2000; ++i) {
+        database.AddNode(ts::New<ts::Struct>(coords, 1. * i, 0.));
+    }
+
+    ASSERT_THROW(database.RemoveNodesIf(coords,
+                                        [](db::ValNodeIterator it) {
+                                            if (it.Id() == 1500) {
+                                                throw std::runtime_error("predicate failed");
+                                            }
+                                            return true;
+                                        }),
+                 std::runtime_error);
+    ASSERT_EQ(CountNodes(database, coords), 2000);
+
+    database.RemoveNodesIf(coords, [](db::ValNodeIterator it) { return it.Id() % 2 == 0; });
+    ASSERT_EQ(CountNodes(database, coords), 1000);
+}
+
+TEST(Wal, CheckpointOnClose) {
+    mem::Wal::Remove("test.data.wal");
+    auto coords = MakeCoords();
+    auto wal = util::MakePtr<mem::Wal>("test.data.wal");
+    {
+        auto database =
+            db::Database(util::MakePtr<mem::File>("test.data"), wal, db::OpenMode::kWrite);
+        database.AddClass(coords);
+        database.AddNode(ts::New<ts::Struct>(coords, 1., 2.));
+    }
+    // Only the committed size of the file is left in the log
+    ASSERT_LT(wal->GetSize(), 64);
+    auto database = db::Database(util::MakePtr<mem::File>("test.data"), db::OpenMode::kRead);
+    ASSERT_EQ(CountNodes(database, coords), 1);
+}
+
+TEST(Wal, FuzzyCheckpoint) {
+    mem::Wal::Remove("test.data.wal");
+    auto coords = MakeCoords();
+    Crash([&coords] {
+        auto options = mem::WalOptions{mem::SyncPolicy::kPerOperation};
+        options.checkpoint_interval = std::chrono::milliseconds(10);
+        options.checkpoint_bytes = 16 << 10;
+        options.segment_bytes = 4 << 10;
+        auto wal = util::MakePtr<mem::Wal>("test.data.wal", options);
+        auto database = new db::Database(util::MakePtr<mem::File>("test.data"), wal,
+                                         db::OpenMode::kWrite);
+        database->AddClass(coords);
+        for (size_t i = 0; i < 2000; ++i) {
+            database->AddNode(ts::New<ts::Struct>(coords, 1. * i, 0.));
+        }
+        database->Checkpoint();
+        // Only the segment of the last checkpoint is left
+        ASSERT_EQ(wal->GetSegmentsCount(), 1);
+        for (size_t i = 0; i < 500; ++i) {
+            database->AddNode(ts::New<ts::Struct>(coords, 1. * i, 0.));
+        }
+    });
+
+    auto wal = util::MakePtr<mem::Wal>("test.data.wal");
+    ASSERT_GT(wal->GetSegmentsCount(), 1);
+    auto database = db::Database(util::MakePtr<mem::File>("test.data"), wal, db::OpenMode::kRead);
+    ASSERT_EQ(CountNodes(database, coords), 2500);
+    ASSERT_GT(wal->GetCheckpointLsn(), 0);
+}
+
+TEST(Wal, EqualsAfterRemoval) {
+    mem::Wal::Remove("test.data.wal");
+    auto name = ts::NewClass<ts::StringClass>("name");
+    auto database =
+        db::Database(util::MakePtr<mem::File>("test.data"),
+                     util::MakePtr<mem::Wal>("test.data.wal"), db::OpenMode::kWrite);
+    database.AddClass(name);
+    for (size_t i = 0; i < 50; ++i) {
+        database.AddNode(ts::New<ts::String>(name, std::format("n{}", i)));
+    }
+    ASSERT_TRUE(database.RemoveNode(name, ID(3)));
+
+    // Filter of the compacted page is rebuilt by the removal, the scan only reads
+    auto count = [&database, &name](const db::Equals& equals) {
+        size_t found = 0;
+        database.VisitNodes(name, equals, [&found](const db::Node::Ptr&) { ++found; });
+        return found;
+    };
+    ASSERT_EQ(count(db::Equals{"name", "n7"}), 1);
+    ASSERT_EQ(count(db::Equals{"name", "n3"}), 0);
+}